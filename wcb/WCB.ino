@@ -20,7 +20,6 @@
 
 // ============================= Librarires  =============================
 //You must install these into your Arduino IDE
-#include <SoftwareSerial.h>                 // ESPSoftwareSerial library by Dirk Kaar, Peter Lerup V8.1.0
 #include <Adafruit_NeoPixel.h>              // Adafruit NeoPixel library by Adafruit V1.12.5
 
 //  All of these librarires are included in the ESP32 by Espressif board library V3.1.1
@@ -31,9 +30,32 @@
 #include <HardwareSerial.h>
 #include "WCB_Storage.h"
 #include "WCB_Maestro.h"
+#include "WCB_CommandPool.h"
+#include "WCB_CommandLanes.h"
+#include "WCB_Frame.h"
+#include "WCB_RxRing.h"
+#include "WCB_SerialTx.h"
+#include "WCB_Dispatch.h"
+#include "WCB_Reliable.h"
+#include "WCB_MessageCache.h"
+#include "WCB_Mesh.h"
+#include "WCB_Coalesce.h"
+#include "WCB_KyberBridge.h"
+#include "WCB_Tunnel.h"
+#include "WCB_TxQueue.h"
+#include "WCB_Routing.h"
+#include "WCB_Subscribe.h"
+#include "WCB_Groups.h"
+#include "WCB_Fragment.h"
+#include "WCB_RmtSerial.h"
+#include "WCB_TimeSync.h"
+#include "WCB_Sequencer.h"
+#include "WCB_Macro.h"
+#include "WCB_Trace.h"
 #include "wcb_pin_map.h"
 #include "esp_task_wdt.h"
 #include "esp_system.h"
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 
@@ -71,9 +93,16 @@ bool maestroEnabled = false;
 bool Kyber_Local = false;    // this tracks if the Kyber is plugged into this board directly
 bool Kyber_Remote = false;  // this tracks if the Kyber is plugged into this board directly
 String Kyber_Location;
+int Kyber_Peer = 0;          // WCB the Kyber bridge sends to, 0 = all WCBs
 
-// Flag to track if last received message was via ESP-NOW
-bool lastReceivedViaESPNOW = false;
+// Transmit the old fixed 249-byte frames so boards still on older firmware can hear us
+bool espnowLegacyFrames = false;
+
+// Send unicast commands with sequence numbers, ACKs and retransmission
+bool espnowReliable = false;
+
+// Commands for the same WCB sent within this many milliseconds share one ESP-NOW frame, 0 = off
+uint8_t espnowCoalesceMs = 2;
 
 // Debugging flag (default: off)
 bool debugEnabled = false;
@@ -200,6 +229,8 @@ void turnOffLED(){
 
 // Simple reboot helper
 void reboot(){
+  flushStoredCommands();  // Don't lose stored commands still waiting for write-back
+  flushAllCoalescedCommands();
   Serial.println("Rebooting in 2 seconds");
   delay(2000);
   ESP.restart();
@@ -209,7 +240,7 @@ void reboot(){
 uint8_t WCBMacAddresses[9][6];
 uint8_t broadcastMACAddress[1][6]; // Will be updated dynamically
 
-// ESP-NOW message struct
+// Legacy ESP-NOW message struct.  Still accepted on receive, and sent when espnowLegacyFrames is set.
 typedef struct __attribute__((packed)) {
   char structPassword[40];
   char structSenderID[4];
@@ -222,37 +253,62 @@ typedef struct __attribute__((packed)) {
 espnow_struct_message commandsToSend[10]; // Includes 1-9 and broadcast
 espnow_struct_message commandsToReceive[10];
 
-// SoftwareSerial objects
-SoftwareSerial Serial3(SERIAL3_RX_PIN, SERIAL3_TX_PIN);
-SoftwareSerial Serial4(SERIAL4_RX_PIN, SERIAL4_TX_PIN);
-SoftwareSerial Serial5(SERIAL5_RX_PIN, SERIAL5_TX_PIN);
+// Serial3-Serial5 are timed by the RMT and a GPIO interrupt instead of bit-banging (see WCB_RmtSerial.h)
+RmtSerial Serial3;
+RmtSerial Serial4;
+RmtSerial Serial5;
+
+// ============================= Command Queue =============================
+// Commands wait for loop() in priority lanes (see WCB_CommandLanes.h)
+
+// Commands received from another WCB.  They are never broadcast over ESP-NOW again.
+#define SOURCE_ID_ESPNOW  6
+
+// ============================= Serial Line Assemblers =============================
+// Each input port assembles its own line so partial lines from two ports never mix
+#define SERIAL_INPUT_PORTS          6                           // USB Serial (0) plus Serial1-Serial5
+#define SERIAL_LINE_BUFFER_SIZE     COMMAND_LARGE_SLOT_SIZE     // Longest line accepted from a port
+#define SOFTWARE_SERIAL_SERVICE_MS  1                           // How often the received edges of Serial3-Serial5 are decoded
 
-// ============================= FreeRTOS Queue Setup =============================
 typedef struct {
-  char *cmd;     // Dynamically allocated
-  int sourceID;  // 1..5 for serial, or 0 if we want to designate ESP-NOW or WCBX
-} CommandQueueItem;
+  char buffer[SERIAL_LINE_BUFFER_SIZE];
+  uint16_t length;
+  int64_t startedUs;    // esp_timer when the line's first byte was read, for tracing
+  bool overflowed;      // Discarding the rest of an over-long line
+  uint32_t overflows;   // Lines discarded for being too long
+} SerialLineAssembler;
+
+static SerialLineAssembler lineAssemblers[SERIAL_INPUT_PORTS];
 
-static QueueHandle_t commandQueue = nullptr;
+// Woken by the UART receive callbacks, one notification bit per source ID
+static TaskHandle_t serialTaskHandle = nullptr;
 
-// ============================= Stored Commands =============================
-#define MAX_STORED_COMMANDS 50
-String storedCommands[MAX_STORED_COMMANDS];
+// Woken by the ESP-NOW receive callback whenever a frame lands in the receive ring
+static TaskHandle_t espnowRxTaskHandle = nullptr;
 
 // ============================= Forward Declarations =============================
-void writeSerialString(Stream &serialPort, String stringData);
+void writeSerialString(int port, const char *stringData);
+void writeSerialString(int port, const char *data, size_t length);
 void sendESPNowMessage(uint8_t target, const char *message);
 // void handleSingleCommand(const String &cmd, int sourceID);
 void enqueueCommand(const String &cmd, int sourceID);
+void enqueueCommand(const char *cmd, size_t length, int sourceID);
+void enqueueCommand(const char *cmd, size_t length, int sourceID, uint32_t traceId);
 
 
 
-// Write a string + `\r` to a given Stream
-void writeSerialString(Stream &serialPort, String stringData) {
-  String completeString = stringData + '\r';
-  for (int i = 0; i < completeString.length(); i++) {
-    serialPort.write(completeString[i]);
+// Queue a string + `\r` for a serial port (1-5).  Only waits while the port's buffer is full; the Serial TX task does the writing.
+void writeSerialString(int port, const char *stringData) {
+  writeSerialString(port, stringData, strlen(stringData));
+}
+
+void writeSerialString(int port, const char *data, size_t length) {
+  uint32_t traceId = currentTraceId();
+  if (!queueSerialWriteTraced(port, (const uint8_t *)data, length, true, traceId)) {
+    Serial.printf("Serial%d stopped sending! Discarding: %.*s\n", port, (int)length, data);
+    return;
   }
+  traceEvent(traceId, TRACE_PORT_QUEUED, port);
 }
 
 Stream &getSerialStream(int port) {
@@ -268,50 +324,69 @@ Stream &getSerialStream(int port) {
 
 // Enqueue commands for asynchronous processing
 void enqueueCommand(const String &cmd, int sourceID) {
-  if (!commandQueue) return;
+  enqueueCommand(cmd.c_str(), cmd.length(), sourceID);
+}
 
-  CommandQueueItem item;
-  item.sourceID = sourceID;
+void enqueueCommand(const char *cmd, size_t length, int sourceID) {
+  enqueueCommand(cmd, length, sourceID, 0);
+}
+
+// Copies the command into a preallocated pool slot and queues it in its priority lane; no heap is touched
+void enqueueCommand(const char *cmd, size_t length, int sourceID, uint32_t traceId) {
+  uint8_t priority = commandPriority(cmd, length, sourceID);
 
-  // Allocate enough space for the command (including null terminator)
-  int length = cmd.length() + 1;
-  item.cmd = (char *)malloc(length);
-  if (!item.cmd) {
-    Serial.println("Out of memory while enqueuing command!");
+  CommandLaneItem item;
+  item.slot = allocateCommandSlot(length, priority == COMMAND_PRIORITY_HIGH);
+  if (item.slot == COMMAND_SLOT_NONE) {
+    Serial.println("Command pool is full or command too long! Discarding command.");
+    countCommandDropped(priority);
     return;
   }
+  item.sourceID = sourceID;
+  item.length = length;
+  item.queuedAtUs = micros();
+  item.traceId = traceId;
 
-  strncpy(item.cmd, cmd.c_str(), length);
-  item.cmd[length - 1] = '\0';
+  char *data = commandSlotData(item.slot);
+  memcpy(data, cmd, length);
+  data[length] = '\0';
 
-  // Attempt to enqueue
-  if (xQueueSend(commandQueue, &item, 0) != pdTRUE) {
-    // If queue is full, free memory
+  if (!pushCommandLane(priority, item)) {
+    // This source already has a full lane in this class, hand the slot back
     Serial.println("Command queue is full! Discarding command.");
-    free(item.cmd);
+    releaseCommandSlot(item.slot);
+    return;
   }
+  traceEvent(traceId, TRACE_QUEUED, sourceID);
 }
 
 // parseCommandsAndEnqueue used by recallCommandSlot
 void parseCommandsAndEnqueue(const String &data, int sourceID) {
-  int startIdx = 0;
+  enqueueDelimitedCommands(data.c_str(), data.length(), sourceID);
+}
+
+void enqueueDelimitedCommands(const char *data, size_t length, int sourceID) {
+  enqueueDelimitedCommands(data, length, sourceID, 0);
+}
+
+// Split on the command delimiter, trim each piece and enqueue the non-empty ones
+void enqueueDelimitedCommands(const char *data, size_t length, int sourceID, uint32_t traceId) {
+  size_t startIdx = 0;
   while (true) {
-    int delimPos = data.indexOf(commandDelimiter, startIdx);
-    if (delimPos == -1) {
-      String singleCmd = data.substring(startIdx);
-      singleCmd.trim();
-      if (!singleCmd.isEmpty()) {
-        enqueueCommand(singleCmd, sourceID);
-      }
-      break;
-    } else {
-      String singleCmd = data.substring(startIdx, delimPos);
-      singleCmd.trim();
-      if (!singleCmd.isEmpty()) {
-        enqueueCommand(singleCmd, sourceID);
-      }
-      startIdx = delimPos + 1;
+    const char *delim = (const char *)memchr(data + startIdx, commandDelimiter, length - startIdx);
+    size_t endIdx = delim ? (size_t)(delim - data) : length;
+
+    // Trim leading/trailing whitespace in place
+    size_t first = startIdx;
+    size_t last = endIdx;
+    while (first < last && isspace((unsigned char)data[first])) first++;
+    while (last > first && isspace((unsigned char)data[last - 1])) last--;
+    if (last > first) {
+      enqueueCommand(data + first, last - first, sourceID, traceId);
     }
+
+    if (!delim) break;
+    startIdx = endIdx + 1;
   }
 }
 
@@ -337,10 +412,14 @@ void printConfigInfo() {
   Serial.printf("Serial3 TX Pin: %d, RX Pin: %d\n", SERIAL3_TX_PIN, SERIAL3_RX_PIN);
   Serial.printf("Serial4 TX Pin: %d, RX Pin: %d\n", SERIAL4_TX_PIN, SERIAL4_RX_PIN);
   Serial.printf("Serial5 TX Pin: %d, RX Pin: %d\n", SERIAL5_TX_PIN, SERIAL5_RX_PIN);
+  printSerialCoalesceKeys();
 
   Serial.println("--------------- ESPNOW Settings ----------------------");
   // Print ESP-NOW password
   Serial.printf("ESP-NOW Password: %s\n", espnowPassword);
+  Serial.printf("ESP-NOW Transmit Format: %s\n", espnowLegacyFrames ? "Legacy (249 byte)" : "Compact");
+  Serial.printf("ESP-NOW Reliable Unicast: %s\n", espnowReliable ? "Enabled" : "Disabled");
+  Serial.printf("ESP-NOW Command Coalescing: %d ms\n", espnowCoalesceMs);
   // Print MAC address used for ESP-NOW (station MAC)
   uint8_t baseMac[6];
   esp_wifi_get_mac(WIFI_IF_STA, baseMac);
@@ -354,6 +433,10 @@ void printConfigInfo() {
 
   // Print all stored commands
   listStoredCommands(); // List stored commands
+  printTunnelSettings();
+  printCommandPrioritySettings();
+  printCommandRoutes();
+  printWCBGroups();
   Serial.println("--- End of Configuration Info ---\n");
 }
 
@@ -363,13 +446,105 @@ void printConfigInfo() {
 //*******************************
 // Send an ESP-NOW message (unicast or broadcast)
 void sendESPNowMessage(uint8_t target, const char *message) {
-    // Skip broadcast if last was from ESP-NOW
-    if (target == 0 && lastReceivedViaESPNOW) {
-      Serial.println("insdie retrun");
+    size_t length = strlen(message);
+
+    if (espnowLegacyFrames) {
+        if (length >= sizeof(espnow_struct_message::structCommand)) {
+            Serial.printf("Legacy ESP-NOW frames carry %d characters, command truncated!\n",
+                          (int)sizeof(espnow_struct_message::structCommand) - 1);
+        }
+        uint8_t *mac = (target == 0) ? broadcastMACAddress[0] : WCBMacAddresses[target - 1];
+        printESPNowSendResult(sendLegacyESPNowMessage(mac, target, message));
+        return;
+    }
+
+    // Commands for the same target within espnowCoalesceMs share one frame
+    if (coalesceCommand(target, message, length)) {
+        return;
+    }
+    sendESPNowCommandFrame(target, 0, (const uint8_t *)message, length);
+}
+
+// Send one command to several WCBs (bit n = WCBn) in a single multicast frame
+void sendESPNowMulticast(uint16_t targets, const char *message) {
+    targets &= WCB_TARGETS_ALL & ~(1 << WCB_Number);
+    if (targets == 0) return;
+    if ((targets & (targets - 1)) == 0) {
+        sendESPNowMessage(__builtin_ctz(targets), message);   // Just one WCB
+        return;
+    }
+
+    size_t length = strlen(message);
+    if (espnowLegacyFrames || espnowReliable) {
+        // Legacy frames have no target mask, and a multicast frame isn't acknowledged: reliable mode
+        // keeps a reliable unicast per WCB
+        for (int wcb = 1; wcb <= 9; wcb++) {
+            if (targets & (1 << wcb)) sendESPNowMessage(wcb, message);
+        }
+        return;
+    }
+
+    // Commands already waiting for these WCBs go out first
+    flushCoalescedCommands(0);
+    for (int wcb = 1; wcb <= 9; wcb++) {
+        if (targets & (1 << wcb)) flushCoalescedCommands(wcb);
+    }
+
+    if (length > FRAGMENT_MAX_MESSAGE) {
+        Serial.printf("Command of %u bytes is too long to send via ESP-NOW! Discarding.\n", (unsigned)length);
         return;
     }
-      // turnOnLEDESPNOW();
 
+    // Only loop() sends commands; too long for a frame stack buffer
+    static uint8_t payload[WCB_MULTICAST_MASK_SIZE + FRAGMENT_MAX_MESSAGE];
+    payload[0] = targets & 0xFF;
+    payload[1] = targets >> 8;
+    memcpy(payload + WCB_MULTICAST_MASK_SIZE, message, length);
+    sendESPNowCommandFrame(0, WCB_FLAG_MULTICAST, payload, length + WCB_MULTICAST_MASK_SIZE);
+}
+
+// Send one compact COMMAND frame, a single command or a batch of them.  Longer commands go out in fragments.
+void sendESPNowCommandFrame(uint8_t target, uint8_t flags, const uint8_t *payload, size_t length) {
+    size_t maxPayload = commandPayloadLimit(target);
+    if (length > maxPayload) {
+        sendFragmentedCommand(target, flags, payload, length, maxPayload);
+        return;
+    }
+
+    if (target != 0 && espnowReliable &&
+        sendReliableFrame(target, WCB_FRAME_COMMAND, flags, payload, length)) {
+        // Retransmitted by the reliable unicast task until WCBx acknowledges it
+        if (debugEnabled) { Serial.printf("ESP-NOW message queued for reliable delivery to WCB%d\n", target); }
+        return;
+    }
+
+    // Select MAC address, unicasts go to the next hop towards target
+    uint8_t *mac = (target == 0) ? broadcastMACAddress[0] : WCBMacAddresses[meshNextHop(target) - 1];
+
+    // Debug Output
+    // Serial.printf("Sending ESP-NOW message to MAC: %02X:%02X:%02X:%02X:%02X:%02X\n",
+    //               mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    // Only the header, the command itself and the auth tag go on air
+    uint8_t frame[WCB_FRAME_BUFFER_SIZE];
+    size_t frameLength = buildWCBFrame(frame, WCB_FRAME_COMMAND, flags, target, payload, length);
+    if (frameLength == 0) {
+        Serial.printf("Command of %u bytes doesn't fit in an ESP-NOW frame! Discarding.\n", (unsigned)length);
+        return;
+    }
+    printESPNowSendResult(queueESPNowSend(mac, frame, frameLength));
+}
+
+void printESPNowSendResult(esp_err_t result) {
+    if (result == ESP_OK) {
+        Serial.println("ESP-NOW message queued for sending!");
+    } else {
+        Serial.printf("ESP-NOW send failed! Error code: %d\n", result);
+    }
+}
+
+// Send a command in the legacy fixed-size format
+esp_err_t sendLegacyESPNowMessage(const uint8_t *mac, uint8_t target, const char *message) {
     // Prepare the struct
     espnow_struct_message msg;
     memset(&msg, 0, sizeof(msg));
@@ -391,57 +566,21 @@ void sendESPNowMessage(uint8_t target, const char *message) {
     strncpy(msg.structCommand, message, sizeof(msg.structCommand) - 1);
     msg.structCommand[sizeof(msg.structCommand) - 1] = '\0';
 
-    // Select MAC address
-    uint8_t *mac = (target == 0) ? broadcastMACAddress[0] : WCBMacAddresses[target - 1];
-
-    // Debug Output
-    // Serial.printf("Sending ESP-NOW message to MAC: %02X:%02X:%02X:%02X:%02X:%02X\n",
-    //               mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    // Serial.printf("Sender ID: WCB%s, Target ID: WCB%s, Message: %s\n",
-    //               msg.structSenderID, msg.structTargetID, msg.structCommand);
-
-    // Send ESP-NOW message
-    esp_err_t result = esp_now_send(mac, (uint8_t *)&msg, sizeof(msg));
-    if (result == ESP_OK) {
-        Serial.println("ESP-NOW message sent successfully!");
-    } else {
-        Serial.printf("ESP-NOW send failed! Error code: %d\n", result);
-    }
-  // turnOffLED();
+    return queueESPNowSend(mac, (uint8_t *)&msg, sizeof(msg));
 }
 
-void sendESPNowRaw(const uint8_t *data, size_t len) {
+// Bridged Kyber data always goes out as RAW frames, also when commands use the legacy format
+void sendESPNowRaw(uint8_t target, const uint8_t *data, size_t len) {
     size_t offset = 0;
     while (offset < len) {
         size_t chunkSize = len - offset;
-        if (chunkSize > 180) chunkSize = 180; // Prevent overflow in structCommand
-
-        // Prepare ESP-NOW message
-        espnow_struct_message msg;
-        memset(&msg, 0, sizeof(msg));
-
-        strncpy(msg.structPassword, espnowPassword, sizeof(msg.structPassword) - 1);
-        msg.structPassword[sizeof(msg.structPassword) - 1] = '\0';
-        
-        // Mark sender ID as this WCB number
-        snprintf(msg.structSenderID, sizeof(msg.structSenderID), "%d", WCB_Number);
-        
-        // Set Target ID to "0" -> Means raw bridging data
-        snprintf(msg.structTargetID, sizeof(msg.structTargetID), "9");
-
-        msg.structCommandIncluded = true;
-
-        // **Store chunk length in first 2 bytes**
-        msg.structCommand[0] = (uint8_t)(chunkSize & 0xFF);
-        msg.structCommand[1] = (uint8_t)((chunkSize >> 8) & 0xFF);
+        if (chunkSize > WCB_FRAME_MAX_PAYLOAD) chunkSize = WCB_FRAME_MAX_PAYLOAD;
 
-        // Copy the chunk into structCommand
-        memcpy(msg.structCommand + 2, data + offset, chunkSize);
+        uint8_t *mac = (target == 0) ? broadcastMACAddress[0] : WCBMacAddresses[meshNextHop(target) - 1];
+        uint8_t frame[WCB_FRAME_MAX_SIZE];
+        size_t frameLength = buildWCBFrame(frame, WCB_FRAME_RAW, 0, target, data + offset, chunkSize);
+        esp_err_t result = queueESPNowSend(mac, frame, frameLength);
 
-        // Send via ESP-NOW broadcast
-        uint8_t *mac = broadcastMACAddress[0];
-
-        esp_err_t result = esp_now_send(mac, (uint8_t*)&msg, sizeof(msg));
         if (result == ESP_OK) {
             if (debugEnabled) {
                 // Serial.printf("Sent chunk of %d bytes via ESP-NOW\n", (int)chunkSize);
@@ -454,142 +593,192 @@ void sendESPNowRaw(const uint8_t *data, size_t len) {
     }
 }
 
+// Runs in the Wi-Fi task: copy the frame into the receive ring and get out of the way
 void espNowReceiveCallback(const esp_now_recv_info_t *info, const uint8_t *incomingData, int len) {
-   
+  uint32_t startCycles = ESP.getCycleCount();
 
-  if (len != sizeof(espnow_struct_message)) {
-      // Serial.printf("Received unexpected size: %d (expected %d)\n", len, (int)sizeof(espnow_struct_message));
-      return;
+  int8_t rssi = info->rx_ctrl ? info->rx_ctrl->rssi : 0;
+  if (espnowRxPush(info->src_addr, rssi, incomingData, len) && espnowRxTaskHandle) {
+    xTaskNotifyGive(espnowRxTaskHandle);
   }
 
-  espnow_struct_message received;
-  memcpy(&received, incomingData, sizeof(received));
-  received.structPassword[sizeof(received.structPassword) - 1] = '\0';
+  recordESPNowCallbackCycles(ESP.getCycleCount() - startCycles);
+}
 
-  // memcpy(&received, incomingData, len);
-  String temp_espnowpassword = String(received.structPassword);
-  if (temp_espnowpassword == espnowPassword){
-    // Serial.printf("Received ESP-NOW Message from MAC: %02X:%02X:%02X:%02X:%02X:%02X\n",
-    //             info->src_addr[0], info->src_addr[1], info->src_addr[2],
-    //             info->src_addr[3], info->src_addr[4], info->src_addr[5]);
+// Driver send status for every esp_now_send (Wi-Fi task)
+void espNowSendCallback(const uint8_t *mac, esp_now_send_status_t status) {
+  espnowTxComplete(mac, status == ESP_NOW_SEND_SUCCESS);
+  meshRecordSendStatus(mac, status == ESP_NOW_SEND_SUCCESS);
+}
 
-    Serial.printf("Received Command: %s\n", received.structCommand);
+// esp_timer time the frame being processed arrived, for tracing.  Only used in the ESP-NOW receive task.
+static int64_t espnowFrameReceivedUs = 0;
 
-    // Convert sender and target ID to integers
-    int senderWCB = atoi(received.structSenderID);
-    int targetWCB = atoi(received.structTargetID);
+// Authentication, filtering, logging and dispatch of one received frame
+void processESPNowFrame(const ESPNowRxEntry &entry) {
+  int64_t now = esp_timer_get_time();
+  espnowFrameReceivedUs = now - (uint32_t)((uint32_t)now - entry.receivedAt);
 
-    Serial.printf("Sender ID: WCB%d, Target ID: WCB%d\n", senderWCB, targetWCB);
+  // Ensure message is from a WCB in the same group
+  if (entry.srcMac[1] != umac_oct2 || entry.srcMac[2] != umac_oct3) {
+      if (debugEnabled){Serial.println("Received message from an unrelated WCB group, ignoring."); } 
+      return;
+  }
 
-    // Ensure message is from a WCB in the same group
-    if (info->src_addr[1] != umac_oct2 || info->src_addr[2] != umac_oct3) {
-        if (debugEnabled){Serial.println("Received message from an unrelated WCB group, ignoring."); } 
-        return;
+  if (isWCBFrame(entry.data, entry.length)) {
+    wcb_frame frame;
+    if (!parseWCBFrame(entry.data, entry.length, &frame)) {
+      // Serial.println("ESP-NOW frame failed authentication or is malformed!");
+      return;
     }
-    if (targetWCB == 9) {
-        // Extract chunk length from first 2 bytes of structCommand
-        size_t chunkLen = (uint8_t)received.structCommand[0] | ((uint8_t)received.structCommand[1] << 8);
-
-        // Safety check to prevent invalid length
-        if (chunkLen > 180 || chunkLen == 0) {
-            if (debugEnabled) {
-                Serial.printf("Invalid bridging chunk length: %d, Ignoring.\n", (int)chunkLen);
-            }
-            return;
-        }
+    if (frame.header.sender == WCB_Number) {
+      return;   // One of our own broadcasts relayed back to us
+    }
+    meshRecordReceive(entry.srcMac, entry.rssi);
 
-        // Forward valid chunk data to Serial1
-        if (Kyber_Local){ 
-          Serial1.write((uint8_t*)(received.structCommand + 2), chunkLen);
-          Serial2.write((uint8_t*)(received.structCommand + 2), chunkLen); 
-          }  
-        else if (Kyber_Remote) {
-          Serial1.write((uint8_t*)(received.structCommand + 2), chunkLen);
-        }      
-
-        if (debugEnabled) {
-            // Serial.printf("Bridging chunk of %d bytes received from WCB%s\n", (int)chunkLen, received.structSenderID);
-        }
-        return;
+    if (frame.header.type == WCB_FRAME_ROUTE) {
+      meshHandleBeacon(entry.srcMac, frame);
+      return;
+    }
+    if (frame.header.target != 0 && frame.header.target != WCB_Number) {
+      // Unicast for another WCB that was sent to us as the next hop
+      relayWCBFrame(entry.srcMac, frame);
+      return;
     }
 
-     lastReceivedViaESPNOW = true; // Prevent loopback issues
-      colorWipeStatus("ES", green, 200);
-    // Check if this message is meant for this WCB
-    if (targetWCB != 0 && targetWCB != WCB_Number ) {
-        Serial.println("Message not for this WCB, ignoring.");
+    if (frame.header.type == WCB_FRAME_SUBSCRIBE) {
+      // Relayed like a broadcast command so WCBs out of range learn about us too
+      if (frame.header.target != 0 || messageAlreadySeen(frame.header.sender, frame.header.seq)) return;
+      relayWCBFrame(entry.srcMac, frame);
+      handleSubscribeBeacon(frame);
+    } else if (frame.header.type == WCB_FRAME_TIME) {
+      handleTimeBeacon(frame, entry.receivedAt);
+    } else if (frame.header.type == WCB_FRAME_RAW) {
+      kyberBridgeReceive(frame.payload, frame.header.length, entry.receivedAt);
+    } else if (frame.header.type == WCB_FRAME_TUNNEL) {
+      handleTunnelFrame(frame);
+    } else if (frame.header.type == WCB_FRAME_ACK) {
+      if (frame.header.target == WCB_Number) {
+        handleReliableAck(frame.header);
+      }
+    } else if (frame.header.type == WCB_FRAME_COMMAND) {
+      // Reliable frames are acknowledged here; retransmitted copies we already ran are dropped
+      if ((frame.header.flags & WCB_FLAG_RELIABLE) && frame.header.target == WCB_Number &&
+          !acceptReliableFrame(frame.header)) {
         return;
+      }
+      // A broadcast is identified by its origin and sequence number; run and relay each one only once
+      if (frame.header.target == 0) {
+        if (messageAlreadySeen(frame.header.sender, frame.header.seq)) {
+          if (debugEnabled) { Serial.printf("Duplicate broadcast %u from WCB%d, ignoring.\n", frame.header.seq, frame.header.sender); }
+          return;
+        }
+        relayWCBFrame(entry.srcMac, frame);
+      }
+      // Multicasts for other WCBs stop here, before the command is looked at
+      if (!(wcbFrameTargets(frame) & (1 << WCB_Number))) {
+        return;
+      }
+      const uint8_t *payload = frame.payload;
+      size_t length = frame.header.length;
+      if (frame.header.flags & WCB_FLAG_MULTICAST) {
+        payload += WCB_MULTICAST_MASK_SIZE;
+        length -= WCB_MULTICAST_MASK_SIZE;
+      }
+      if (frame.header.flags & WCB_FLAG_FRAGMENT) {
+        handleCommandFragment(frame.header.sender, frame.header.target, payload, length);
+      } else if (frame.header.flags & WCB_FLAG_BATCH) {
+        handleESPNowCommandBatch(frame.header.sender, frame.header.target, payload, length);
+      } else {
+        handleESPNowCommand(frame.header.sender, frame.header.target, (const char *)payload, length);
+      }
     }
+    return;
+  }
 
-    // If valid, enqueue the command
-    enqueueCommand(String(received.structCommand), 0);
+  if (entry.length == sizeof(espnow_struct_message)) {
+    receiveLegacyESPNowMessage(entry.data);
   } else {
-    // Serial.println("ESPNOW password does not match local password!");
+    // Serial.printf("Received unexpected size: %d (expected %d)\n", entry.length, (int)sizeof(espnow_struct_message));
   }
-    colorWipeStatus("ES", blue, 10);
 }
 
-//*******************************
-/// Kyber Serial Forwarding Commands
-//*******************************
-void forwardDataFromKyber() {
-  static uint8_t buffer[64];
+// Legacy fixed-size frames from boards that have not been updated yet
+void receiveLegacyESPNowMessage(const uint8_t *incomingData) {
+  espnow_struct_message received;
+  memcpy(&received, incomingData, sizeof(received));
+  received.structPassword[sizeof(received.structPassword) - 1] = '\0';
+  received.structCommand[sizeof(received.structCommand) - 1] = '\0';
 
-  // **Check if Serial2 has data**
-  if (Serial2.available() > 0) {
-    int len = Serial2.readBytes((char*)buffer, sizeof(buffer));
+  if (strcmp(received.structPassword, espnowPassword) != 0) {
+    // Serial.println("ESPNOW password does not match local password!");
+    return;
+  }
 
-    // **Forward data to Serial1**
-    Serial1.write(buffer, len);
-    Serial1.flush(); // Ensure immediate transmission
+  // Convert sender and target ID to integers
+  int senderWCB = atoi(received.structSenderID);
+  int targetWCB = atoi(received.structTargetID);
 
-    // **Forward via ESP-NOW broadcast**
-    sendESPNowRaw(buffer, len);
-  }
+  handleESPNowCommand(senderWCB, targetWCB, received.structCommand, strlen(received.structCommand));
 }
 
-void forwardMaestroDataToLocalKyber() {
-  static uint8_t buffer[64];
-
-  // **Check if Serial2 has data**
-  if (Serial1.available() > 0) {
-    int len = Serial1.readBytes((char*)buffer, sizeof(buffer));
+// An authenticated command from another WCB.  command is not null terminated.
+void handleESPNowCommand(int senderWCB, int targetWCB, const char *command, size_t len) {
+  Serial.printf("Received Command: %.*s\n", (int)len, command);
+  Serial.printf("Sender ID: WCB%d, Target ID: WCB%d\n", senderWCB, targetWCB);
 
-    // **Forward data to Serial1**
-    Serial2.write(buffer, len);
-    Serial2.flush(); // Ensure immediate transmission
-    // **Forward via ESP-NOW broadcast**
-    if (Kyber_Remote){sendESPNowRaw(buffer, len);}
+  colorWipeStatus("ES", green, 200);
+  // Check if this message is meant for this WCB
+  if (targetWCB != 0 && targetWCB != WCB_Number ) {
+      Serial.println("Message not for this WCB, ignoring.");
+      colorWipeStatus("ES", blue, 10);
+      return;
+  }
 
+  // A trace tag is always taken off, the ports behind us must not see it
+  uint32_t traceId = 0;
+  size_t tagLength = parseTraceTag(command, len, &traceId);
+  if (tagLength > 0) {
+    command += tagLength;
+    len -= tagLength;
+    traceEventAt(traceId, TRACE_ESPNOW_RX, senderWCB, espnowFrameReceivedUs);
   }
-}
 
-void forwardMaestroDataToRemoteKyber() {
-  static uint8_t buffer[64];
+  // If valid, enqueue the command
+  enqueueCommand(command, len, SOURCE_ID_ESPNOW, traceId);
+  colorWipeStatus("ES", blue, 10);
+}
 
-  // **Check if Serial2 has data**
-  if (Serial1.available() > 0) {
-    int len = Serial1.readBytes((char*)buffer, sizeof(buffer));
-  sendESPNowRaw(buffer, len);
+// Several commands coalesced into one frame, queued in the order they were sent
+void handleESPNowCommandBatch(int senderWCB, int targetWCB, const uint8_t *records, size_t len) {
+  size_t offset = 0;
+  while (offset < len) {
+    size_t recordLength = records[offset++];
+    if (offset + recordLength > len) {
+      if (debugEnabled) { Serial.printf("Malformed command batch from WCB%d, ignoring the rest.\n", senderWCB); }
+      return;
+    }
+    if (recordLength > 0) {
+      handleESPNowCommand(senderWCB, targetWCB, (const char *)records + offset, recordLength);
+    }
+    offset += recordLength;
   }
 }
 
-
-
 //*******************************
 /// Processing Input Functions
 //*******************************
-void handleSingleCommand(String cmd, int sourceID) {
+void handleSingleCommand(const char *cmd, int sourceID) {
     // cmd.toLowerCase(); // Convert entire command to lowercase
 
     // 1) LocalFunctionIdentifier-based commands (e.g., `?commands`)
-    if (cmd.startsWith(String(LocalFunctionIdentifier))) {
+    if (cmd[0] == LocalFunctionIdentifier) {
         // cmd.toLowerCase();
-        processLocalCommand(cmd.substring(1)); // Process local function
+        processLocalCommand(cmd + 1); // Process local function
     } 
     // 2) CommandCharacter-based commands (e.g., `;commands`)
-    else if (cmd.startsWith(String(CommandCharacter))) {
-        processCommandCharcter(cmd.substring(1), sourceID); // Process serial-specific command
+    else if (cmd[0] == CommandCharacter) {
+        processCommandCharcter(cmd + 1, sourceID); // Process serial-specific command
     } 
     // 3) Default to broadcasting if not a recognized prefix
     else {
@@ -600,111 +789,98 @@ void handleSingleCommand(String cmd, int sourceID) {
 //*******************************
 /// Processing Local Function Identifier 
 //*******************************
-void processLocalCommand(const String &message) {
-    if (message == "don" || message == "DON") {
-        debugEnabled = true;
-        Serial.println("Debugging enabled");
-        return;
-    } else if (message == "doff" || message == "DOFF") {
-        debugEnabled = false;
-        Serial.println("Debugging disabled");
-        return;
-    } else if (message.startsWith("lf") || message.startsWith("LF")) {
-        updateLocalFunctionIdentifier(message);
-        return;
-    } else if (message.equals("cclear") || message.equals("CCLEAR")) {
-        clearAllStoredCommands();
-        return;
-    } else if (message.startsWith("cc") || message.startsWith("CC")) {
-        updateCommandCharacter(message);
-        return;
-    } else if (message.startsWith("cs") || message.startsWith("CS")) {
-        storeCommand(message);
-        return;
-    } else if (message == "reboot" || message == "REBOOT") {
-        reboot();
-    } else if (message == "config" || message == "CONFIG") {
-        printConfigInfo();
-        return;
-    } else if (message.startsWith("d") || message.startsWith("D")) {
-        updateCommandDelimiter(message);
-        return;
-    }  else if (message.startsWith("m2") || message.startsWith("M2")){
-        update2ndMACOctet(message);
-        return;
-    } else if (message.startsWith("m3") || message.startsWith("M3")) {
-        update3rdMACOctet(message);
-        return;
-    } else if (message == "wcb_erase" || message == "WCB_ERASE") {
-        eraseNVSFlash();
-    } else if (message.startsWith("wcbq") || message.startsWith("WCBQ")) {
-        updateWCBQuantity(message);
-        return;
-    } else if (message.startsWith("wcb") || message.startsWith("WCB")) {
-        updateWCBNumber(message);
-        return;
-    } else if (message.startsWith("epass") || message.startsWith("EPASS")) {
-        updateESPNowPassword(message);
-        return;
-    } else if (message.startsWith("s") || message.startsWith("S")) {
-        updateSerialSettings(message);
-        return;
-    } else if (message.startsWith("maestro_enable") || message.startsWith("MAESTRO_ENABLE")) {
-        enableMaestroSerialBaudRate();
-        return;
-    }else if (message.startsWith("maestro_disable") || message.startsWith("MAESTRO_DISABLE")) {
-        disableMaestroSerialBaudRate();
-        return;
-    } else if (message.equals("kyber_local") || message.equals("KYBER_LOCAL")){
-        storeKyberSettings("local");
-        printKyberSettings();
-        return;
-    } else if (message.equals("kyber_remote") || message.equals("KYBER_REMOTE")){
-        storeKyberSettings("remote");
-        printKyberSettings();
-        return;
-    } else if (message.equals("kyber_clear") || message.equals("KYBER_CLEAR")){
-        storeKyberSettings("clear");
-        printKyberSettings();
-        return;
-    } else if (message.startsWith("hw") || message.startsWith("HW")) {
-        updateHWVersion(message);
-        return;
-    } else {
+typedef void (*LocalCommandHandler)(const char *message, size_t length);
+
+// Keywords are matched case insensitively; the longest match wins, so order does not matter
+static constexpr CommandEntry<LocalCommandHandler> localCommands[] = {
+    {"don",             MATCH_EXACT,  [](const char *, size_t) { debugEnabled = true; Serial.println("Debugging enabled"); }},
+    {"doff",            MATCH_EXACT,  [](const char *, size_t) { debugEnabled = false; Serial.println("Debugging disabled"); }},
+    {"d",               MATCH_PREFIX, [](const char *m, size_t n) { updateCommandDelimiter(m, n); }},
+    {"lf",              MATCH_PREFIX, [](const char *m, size_t n) { updateLocalFunctionIdentifier(m, n); }},
+    {"cclear",          MATCH_EXACT,  [](const char *, size_t) { clearAllStoredCommands(); }},
+    {"cc",              MATCH_PREFIX, [](const char *m, size_t n) { updateCommandCharacter(m, n); }},
+    {"cs",              MATCH_PREFIX, [](const char *m, size_t n) { storeCommand(m, n); }},
+    {"stats",           MATCH_EXACT,  [](const char *, size_t) { printStats(); }},
+    {"reboot",          MATCH_EXACT,  [](const char *, size_t) { reboot(); }},
+    {"config",          MATCH_EXACT,  [](const char *, size_t) { printConfigInfo(); }},
+    {"m2",              MATCH_PREFIX, [](const char *m, size_t n) { update2ndMACOctet(m, n); }},
+    {"m3",              MATCH_PREFIX, [](const char *m, size_t n) { update3rdMACOctet(m, n); }},
+    {"wcb_erase",       MATCH_EXACT,  [](const char *, size_t) { eraseNVSFlash(); }},
+    {"wcbq",            MATCH_PREFIX, [](const char *m, size_t n) { updateWCBQuantity(m, n); }},
+    {"wcb",             MATCH_PREFIX, [](const char *m, size_t n) { updateWCBNumber(m, n); }},
+    {"elegacy",         MATCH_PREFIX, [](const char *m, size_t n) { updateESPNowFrameFormat(m, n); }},
+    {"epass",           MATCH_PREFIX, [](const char *m, size_t n) { updateESPNowPassword(m, n); }},
+    {"ereliable",       MATCH_PREFIX, [](const char *m, size_t n) { updateESPNowReliable(m, n); }},
+    {"ecoalesce",       MATCH_PREFIX, [](const char *m, size_t n) { updateESPNowCoalesceWindow(m, n); }},
+    {"s",               MATCH_PREFIX, [](const char *m, size_t n) { updateSerialSettings(m, n); }},
+    {"scoalesce_clear", MATCH_PREFIX, [](const char *m, size_t n) { clearSerialCoalescing(m, n); }},
+    {"scoalesce",       MATCH_PREFIX, [](const char *m, size_t n) { updateSerialCoalescing(m, n); }},
+    {"maestro_enable",  MATCH_PREFIX, [](const char *, size_t) { enableMaestroSerialBaudRate(); }},
+    {"maestro_disable", MATCH_PREFIX, [](const char *, size_t) { disableMaestroSerialBaudRate(); }},
+    {"kyber_local",     MATCH_EXACT,  [](const char *, size_t) { storeKyberSettings("local"); printKyberSettings(); }},
+    {"kyber_remote",    MATCH_EXACT,  [](const char *, size_t) { storeKyberSettings("remote"); printKyberSettings(); }},
+    {"kyber_clear",     MATCH_EXACT,  [](const char *, size_t) { storeKyberSettings("clear"); printKyberSettings(); }},
+    {"kyber_peer",      MATCH_PREFIX, [](const char *m, size_t n) { updateKyberPeer(m, n); }},
+    {"tunnel_clear",    MATCH_PREFIX, [](const char *m, size_t n) { clearSerialTunnel(m, n); }},
+    {"tunnel",          MATCH_PREFIX, [](const char *m, size_t n) { updateSerialTunnel(m, n); }},
+    {"prio_port",       MATCH_PREFIX, [](const char *m, size_t n) { updatePortCommandPriority(m, n); }},
+    {"prio_prefix",     MATCH_PREFIX, [](const char *m, size_t n) { updateCommandPriorityPrefix(m, n); }},
+    {"prio_clear",      MATCH_EXACT,  [](const char *, size_t) { clearCommandPriorityPrefixes(); saveCommandPriorities(); Serial.println("Command priority prefixes cleared"); }},
+    {"route_clear",     MATCH_EXACT,  [](const char *, size_t) { clearCommandRoutes(); saveCommandRoutes(); Serial.println("Command routes cleared"); }},
+    {"route_del",       MATCH_PREFIX, [](const char *m, size_t n) { deleteCommandRoute(m, n); }},
+    {"route",           MATCH_PREFIX, [](const char *m, size_t n) { updateCommandRoute(m, n); }},
+    {"group_del",       MATCH_PREFIX, [](const char *m, size_t n) { deleteWCBGroup(m, n); }},
+    {"group",           MATCH_PREFIX, [](const char *m, size_t n) { updateWCBGroup(m, n); }},
+    {"seq_stop",        MATCH_PREFIX, [](const char *m, size_t n) { stopSequenceByName(m, n); }},
+    {"seq_clear",       MATCH_EXACT,  [](const char *, size_t) { stopAllSequences(); Serial.println("All sequences stopped"); }},
+    {"time_clear",      MATCH_EXACT,  [](const char *, size_t) { clearScheduledCommands(); }},
+    {"trace",           MATCH_PREFIX, [](const char *m, size_t n) { updateTracing(m, n); }},
+    {"trace_dump",      MATCH_EXACT,  [](const char *, size_t) { dumpTrace(); }},
+    {"trace_clear",     MATCH_EXACT,  [](const char *, size_t) { clearTrace(); Serial.println("Trace records cleared"); }},
+    {"hw",              MATCH_PREFIX, [](const char *m, size_t n) { updateHWVersion(m, n); }},
+};
+
+void processLocalCommand(const char *message) {
+    int index = matchCommandKeyword(localCommands, message);
+    if (index < 0) {
         Serial.println("Invalid Local Command");
+        return;
     }
+    localCommands[index].handler(message, strlen(message));
 }
 
 //*******************************
 /// Processing Local Function Identifier Functions
 //*******************************
-void updateLocalFunctionIdentifier(const String &message){
-  if (message.length() >= 3) {
-    LocalFunctionIdentifier = message.charAt(2);
+void updateLocalFunctionIdentifier(const char *message, size_t length){
+  if (length >= 3) {
+    LocalFunctionIdentifier = message[2];
     saveLocalFunctionIdentifierAndCommandCharacter();
+    recompileStoredCommands();
     Serial.printf("LocalFunctionIdentifier updated to '%c'\n", LocalFunctionIdentifier);
   } else {
     Serial.println("Invalid LocalFunctionIdentifier update command");
   }
 }
 
-void updateCommandCharacter(const String &message){
-  if (message.length() >= 3) {
-    CommandCharacter = message.charAt(2);
+void updateCommandCharacter(const char *message, size_t length){
+  if (length >= 3) {
+    CommandCharacter = message[2];
     saveLocalFunctionIdentifierAndCommandCharacter();
+    recompileStoredCommands();
     Serial.printf("CommandCharacter updated to '%c'\n", CommandCharacter);
   } else {
     Serial.println("Invalid CommandCharacter update command");
   }
 }
 
-void storeCommand(const String &message){
-  saveStoredCommandsToPreferences(message.substring(2));
+void storeCommand(const char *message, size_t length){
+  saveStoredCommandsToPreferences(message + 2, length - 2);
 }
 
-void updateCommandDelimiter(const String &message){
-  if (message.length() == 2) {
-    char newDelimiter = message.charAt(1);
+void updateCommandDelimiter(const char *message, size_t length){
+  if (length == 2) {
+    char newDelimiter = message[1];
     setCommandDelimiter(newDelimiter);
     Serial.printf("Command delimiter updated to: '%c'\n", newDelimiter);
   } else {
@@ -712,31 +888,33 @@ void updateCommandDelimiter(const String &message){
   }
 }
 
-void update2ndMACOctet(const String &message){
-    String hexValue = message.substring(2, 4);
-    int newValue = strtoul(hexValue.c_str(), NULL, 16);
+void update2ndMACOctet(const char *message, size_t length){
+    char hexValue[3] = {};
+    if (length > 2) strncpy(hexValue, message + 2, 2);
+    int newValue = strtoul(hexValue, NULL, 16);
     umac_oct2 = static_cast<uint8_t>(newValue);
     saveMACPreferences();
     Serial.printf("Updated the 2nd Octet to 0x%02X\n", umac_oct2);
 }
 
-void update3rdMACOctet(const String &message){
-  String hexValue = message.substring(2, 4);
-  int newValue = strtoul(hexValue.c_str(), NULL, 16);
+void update3rdMACOctet(const char *message, size_t length){
+  char hexValue[3] = {};
+  if (length > 2) strncpy(hexValue, message + 2, 2);
+  int newValue = strtoul(hexValue, NULL, 16);
   umac_oct3 = static_cast<uint8_t>(newValue);
   saveMACPreferences();
   Serial.printf("Updated the 3rd Octet to 0x%02X\n", umac_oct3);
 }
 
-void updateWCBQuantity(const String &message){
-  int wcbQty = message.substring(4).toInt();
+void updateWCBQuantity(const char *message, size_t length){
+  int wcbQty = commandNumber(message, length, 4);
   saveWCBQuantityPreferences(wcbQty);
 }
 
-void updateSerialSettings(const String &message){
-  int port = message.substring(1, 2).toInt();
-  int state = message.substring(2, 3).toInt();
-  if ((state == 0 || state == 1) && message.length()==3){
+void updateSerialSettings(const char *message, size_t length){
+  int port = commandDigit(message, length, 1);
+  int state = commandDigit(message, length, 2);
+  if ((state == 0 || state == 1) && length == 3){
     if (port >= 1 && port <= 5) {
       serialBroadcastEnabled[port - 1] = (state == 1);
       saveBroadcastSettingsToPreferences();
@@ -744,7 +922,7 @@ void updateSerialSettings(const String &message){
           port, serialBroadcastEnabled[port - 1] ? "Enabled" : "Disabled");
     }
   } else {
-    int baud = message.substring(2).toInt();
+    int baud = commandNumber(message, length, 2);
     if (port >= 1 && port <= 5) {
       updateBaudRate(port, baud);
       Serial.printf("Updated Serial%d baud rate to %d and stored in NVS\n", port, baud);
@@ -752,23 +930,262 @@ void updateSerialSettings(const String &message){
   }
 }
 
-void updateWCBNumber(const String &message){
-  int newWCB = message.substring(3).toInt();
+// ?SCOALESCEp,key: a command for Serialp starting with key replaces an older one still waiting to go out
+void updateSerialCoalescing(const char *message, size_t length){
+  int port = commandDigit(message, length, 9);
+  if (length < 12 || message[10] != ',' || port < 1 || port > 5 || length - 11 > SERIAL_COALESCE_KEY_MAX) {
+    Serial.printf("Invalid format.  Use ?SCOALESCEp,key with port p 1-5 and a key of 1-%d characters.\n", SERIAL_COALESCE_KEY_MAX);
+    return;
+  }
+  const char *key = message + 11;
+  if (!addSerialCoalesceKey(port, key)) {
+    Serial.printf("Serial%d already has %d coalescing keys.  Use ?SCOALESCE_CLEAR%d to remove them.\n",
+                  port, SERIAL_COALESCE_KEYS, port);
+    return;
+  }
+  saveSerialCoalesceKeys(port);
+  Serial.printf("Serial%d: commands starting with \"%s\" now replace older ones still waiting, stored in NVS\n",
+                port, key);
+}
+
+void clearSerialCoalescing(const char *message, size_t length){
+  int port = commandNumber(message, length, 15);
+  if (length != 16 || port < 1 || port > 5) {
+    Serial.println("Invalid format.  Use ?SCOALESCE_CLEARp to remove the coalescing keys of Serialp.");
+    return;
+  }
+  clearSerialCoalesceKeys(port);
+  saveSerialCoalesceKeys(port);
+  Serial.printf("Serial%d coalescing keys cleared\n", port);
+}
+
+void updateWCBNumber(const char *message, size_t length){
+  int newWCB = commandNumber(message, length, 3);
   if (newWCB >= 1 && newWCB <= 9) {
     saveWCBNumberToPreferences(newWCB);
   }
 }
 
-void updateESPNowPassword(const String &message){
-  String newPassword = message.substring(5);
-  if (newPassword.length() > 0 && newPassword.length() < sizeof(espnowPassword)) {
-    setESPNowPassword(newPassword.c_str());
-    Serial.printf("ESP-NOW Password updated to: %s\n", newPassword.c_str());
+void updateESPNowPassword(const char *message, size_t length){
+  if (length > 5 && length - 5 < sizeof(espnowPassword)) {
+    const char *newPassword = message + 5;
+    setESPNowPassword(newPassword);
+    Serial.printf("ESP-NOW Password updated to: %s\n", newPassword);
   } else {
     Serial.println("Invalid ESP-NOW password length. Must be between 1 and 39 characters.");
   }
 }
 
+void updateESPNowFrameFormat(const char *message, size_t length){
+  int state = commandNumber(message, length, 7);
+  if (length == 8 && (state == 0 || state == 1)) {
+    saveESPNowFrameFormat(state == 1);
+    Serial.printf("ESP-NOW transmit format: %s\n", espnowLegacyFrames ? "Legacy (249 byte)" : "Compact");
+  } else {
+    Serial.println("Invalid format.  Use ?ELEGACY1 to send legacy frames or ?ELEGACY0 for compact frames.");
+  }
+}
+
+// ?TUNNELc,p,w binds channel c to local Serialp and WCBw
+void updateSerialTunnel(const char *message, size_t length){
+  int channel = 0, port = 0, wcb = 0;
+  if (length < 6 || sscanf(message + 6, "%d,%d,%d", &channel, &port, &wcb) != 3 ||
+      channel < 1 || channel > TUNNEL_CHANNELS || port < 1 || port > 5 || wcb < 1 || wcb > 9 || wcb == WCB_Number) {
+    Serial.printf("Invalid format.  Use ?TUNNELc,p,w to join channel c (1-%d) from Serialp to WCBw.\n", TUNNEL_CHANNELS);
+    return;
+  }
+  if ((port == 1 && (Kyber_Local || Kyber_Remote)) || (port == 2 && Kyber_Local)) {
+    Serial.printf("Serial%d is used by the Kyber bridge.\n", port);
+    return;
+  }
+  if (!bindTunnel(channel, port, wcb)) {
+    Serial.printf("Serial%d is already used by another tunnel.\n", port);
+    return;
+  }
+  saveTunnelBinding(channel);
+  Serial.printf("Tunnel %d: Serial%d <-> WCB%d, stored in NVS\n", channel, port, wcb);
+}
+
+void clearSerialTunnel(const char *message, size_t length){
+  int channel = commandNumber(message, length, 12);
+  if (length != 13 || channel < 1 || channel > TUNNEL_CHANNELS) {
+    Serial.printf("Invalid format.  Use ?TUNNEL_CLEARc to remove channel c (1-%d).\n", TUNNEL_CHANNELS);
+    return;
+  }
+  clearTunnel(channel);
+  saveTunnelBinding(channel);
+  Serial.printf("Tunnel %d cleared\n", channel);
+}
+
+// ?PRIO_PORTp,c: commands from port p (0 = USB, 1-5, E = other WCBs) default to class c (H, N or L)
+void updatePortCommandPriority(const char *message, size_t length){
+  char port = (length == 12) ? toupper(message[9]) : 0;
+  int source = (port == 'E') ? SOURCE_ID_ESPNOW : port - '0';
+  int priority = (length == 12) ? commandPriorityFromChar(message[11]) : -1;
+  if (source < 0 || source > SOURCE_ID_ESPNOW || message[10] != ',' || priority < 0) {
+    Serial.println("Invalid format.  Use ?PRIO_PORTp,c with port p 0-5 or E (other WCBs) and class c H, N or L.");
+    return;
+  }
+  portCommandPriority[source] = priority;
+  saveCommandPriorities();
+  printCommandPrioritySettings();
+}
+
+// ?PRIO_PREFIXc,prefix: commands starting with prefix are class c (H, N or L)
+void updateCommandPriorityPrefix(const char *message, size_t length){
+  int priority = (length > 13 && message[12] == ',') ? commandPriorityFromChar(message[11]) : -1;
+  if (priority < 0 || length - 13 > COMMAND_PRIORITY_PREFIX_MAX) {
+    Serial.printf("Invalid format.  Use ?PRIO_PREFIXc,prefix with class c H, N or L and a prefix of 1-%d characters.\n",
+                  COMMAND_PRIORITY_PREFIX_MAX);
+    return;
+  }
+  if (!setCommandPriorityPrefix(message + 13, priority)) {
+    Serial.printf("Only %d priority prefixes can be stored.  Use ?PRIO_CLEAR to remove them.\n", COMMAND_PRIORITY_PREFIXES);
+    return;
+  }
+  saveCommandPriorities();
+  printCommandPrioritySettings();
+}
+
+// ?ROUTEprefix,targets with targets a list of Sn (local Serialn) and Wn (WCBn), e.g. ?ROUTE:PP,S1W2
+void updateCommandRoute(const char *message, size_t length){
+  const char *comma = strrchr(message, ',');
+  size_t prefixLength = (comma && comma > message + 5) ? comma - message - 5 : 0;
+  const char *targets = prefixLength ? comma + 1 : "";
+  size_t targetsLength = prefixLength ? message + length - targets : 0;
+  uint8_t ports = 0;
+  uint16_t wcbs = 0;
+  bool valid = prefixLength > 0 && prefixLength <= ROUTE_PREFIX_MAX && targetsLength > 0 && targetsLength % 2 == 0;
+  for (size_t i = 0; valid && i < targetsLength; i += 2) {
+    char kind = toupper(targets[i]);
+    int number = targets[i + 1] - '0';
+    if (kind == 'S' && number >= 1 && number <= 5) {
+      ports |= 1 << number;
+    } else if (kind == 'W' && number >= 1 && number <= 9) {
+      wcbs |= 1 << number;
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid) {
+    Serial.printf("Invalid format.  Use ?ROUTEprefix,targets with a prefix of 1-%d characters and targets like S1S3W2 "
+                  "(Sn = local Serialn, Wn = WCBn).\n", ROUTE_PREFIX_MAX);
+    return;
+  }
+  char prefix[ROUTE_PREFIX_MAX + 1];
+  memcpy(prefix, message + 5, prefixLength);
+  prefix[prefixLength] = '\0';
+  if (!setCommandRoute(prefix, ports, wcbs)) {
+    Serial.printf("Only %d routes can be stored.  Use ?ROUTE_DELprefix or ?ROUTE_CLEAR to remove some.\n", ROUTE_MAX_RULES);
+    return;
+  }
+  saveCommandRoutes();
+  printCommandRoutes();
+}
+
+void deleteCommandRoute(const char *message, size_t length){
+  const char *prefix = (length > 9) ? message + 9 : "";
+  if (!removeCommandRoute(prefix)) {
+    Serial.printf("No route for \"%s\".  Use ?ROUTE_DELprefix to remove a route.\n", prefix);
+    return;
+  }
+  saveCommandRoutes();
+  Serial.printf("Route \"%s\" removed\n", prefix);
+}
+
+// ?GROUPname,2,4,7 stores a named set of WCBs for ;W{name}
+void updateWCBGroup(const char *message, size_t length){
+  const char *comma = strchr(message, ',');
+  size_t nameLength = (comma && comma > message + 5) ? comma - message - 5 : 0;
+  const char *set = nameLength ? comma + 1 : "";
+  uint16_t targets = nameLength ? parseWCBTargetSet(set, message + length - set) : 0;
+  bool validName = nameLength > 0 && nameLength <= WCB_GROUP_NAME_MAX && isalpha(message[5]) &&
+                   !memchr(message + 5, '}', nameLength);
+  if (!validName || targets == 0 || !(set[0] >= '1' && set[0] <= '9')) {
+    Serial.printf("Invalid format.  Use ?GROUPname,2,4,7 with a name of 1-%d characters starting with a letter.\n",
+                  WCB_GROUP_NAME_MAX);
+    return;
+  }
+  char name[WCB_GROUP_NAME_MAX + 1];
+  memcpy(name, message + 5, nameLength);
+  name[nameLength] = '\0';
+  if (!setWCBGroup(name, targets)) {
+    Serial.printf("Only %d groups can be stored.  Use ?GROUP_DELname to remove one.\n", WCB_MAX_GROUPS);
+    return;
+  }
+  saveWCBGroups();
+  printWCBGroups();
+}
+
+void deleteWCBGroup(const char *message, size_t length){
+  const char *name = (length > 9) ? message + 9 : "";
+  if (!removeWCBGroup(name)) {
+    Serial.printf("No group \"%s\".  Use ?GROUP_DELname to remove a group.\n", name);
+    return;
+  }
+  saveWCBGroups();
+  Serial.printf("Group \"%s\" removed\n", name);
+}
+
+void stopSequenceByName(const char *message, size_t length){
+  const char *text = (length > 8) ? message + 8 : "";
+  size_t textLength = (length > 8) ? length - 8 : 0;
+  trimCommandText(text, textLength);
+  char name[SEQUENCE_NAME_MAX + 1] = "";
+  if (textLength <= SEQUENCE_NAME_MAX) {
+    memcpy(name, text, textLength);
+    name[textLength] = '\0';
+  }
+  if (textLength <= SEQUENCE_NAME_MAX && stopSequence(name)) {
+    Serial.printf("Sequence '%s' stopped\n", name);
+  } else {
+    Serial.printf("No sequence '%.*s' is running\n", (int)textLength, text);
+  }
+}
+
+void updateTracing(const char *message, size_t length){
+  int state = commandNumber(message, length, 5);
+  if (length == 6 && (state == 0 || state == 1)) {
+    traceEnabled = state == 1;
+    Serial.printf("Command tracing: %s\n", traceEnabled ? "Enabled" : "Disabled");
+  } else {
+    Serial.println("Invalid format.  Use ?TRACE1 to trace commands, ?TRACE0 to stop, ?TRACE_DUMP to print the records.");
+  }
+}
+
+void updateKyberPeer(const char *message, size_t length){
+  int peer = commandNumber(message, length, 10);
+  if (length == 11 && peer >= 0 && peer <= 9) {
+    storeKyberPeer(peer);
+    printKyberSettings();
+  } else {
+    Serial.println("Invalid format.  Use ?KYBER_PEERx to send bridged data to WCBx, or ?KYBER_PEER0 to send it to all WCBs.");
+  }
+}
+
+void updateESPNowCoalesceWindow(const char *message, size_t length){
+  int windowMs = commandNumber(message, length, 9);
+  if (length > 9 && length <= 11 && windowMs >= 0 && windowMs <= 50) {
+    saveESPNowCoalesceWindow(windowMs);
+    if (windowMs == 0) {
+      flushAllCoalescedCommands();
+    }
+    Serial.printf("ESP-NOW command coalescing window: %d ms%s\n", windowMs, windowMs == 0 ? " (disabled)" : "");
+  } else {
+    Serial.println("Invalid format.  Use ?ECOALESCExx with a window of 0-50 ms, 0 disables coalescing.");
+  }
+}
+
+void updateESPNowReliable(const char *message, size_t length){
+  int state = commandNumber(message, length, 9);
+  if (length == 10 && (state == 0 || state == 1)) {
+    saveESPNowReliable(state == 1);
+    Serial.printf("ESP-NOW reliable unicast: %s\n", espnowReliable ? "Enabled" : "Disabled");
+  } else {
+    Serial.println("Invalid format.  Use ?ERELIABLE1 to enable reliable unicast or ?ERELIABLE0 to disable it.");
+  }
+}
+
 void enableMaestroSerialBaudRate(){
     recallBaudRatefromSerial(1);
     Serial.printf("Saved original baud rate of %d for Serial 1\n, Updating to 57600 to support Maestro\n", storedBaudRate[1], 1);
@@ -780,178 +1197,384 @@ void disableMaestroSerialBaudRate(){
     Serial.printf("Saved original baud rate of %d for Serial 1\n", storedBaudRate[1]);
 }
 
-void updateHWVersion(const String &message) {
-  int temp_hw_version = message.substring(2).toInt();
+void printStats() {
+  printCommandPoolStats();
+  printCommandLaneStats();
+  printRoutingStats();
+  printSubscriptions();
+  printFragmentStats();
+  printTimeSync();
+  printSequencer();
+  printMacroStats();
+  printESPNowRxStats();
+  printESPNowTxStats();
+  printSerialTxStats();
+  printRmtSerialStats(3, Serial3);
+  printRmtSerialStats(4, Serial4);
+  printRmtSerialStats(5, Serial5);
+  printStoredCommandStats();
+  printReliableStats();
+  printMessageCacheStats();
+  printMeshStats();
+  printCoalesceStats();
+  printKyberBridgeStats();
+  printTunnelStats();
+}
+
+void updateHWVersion(const char *message, size_t length) {
+  int temp_hw_version = commandNumber(message, length, 2);
   saveHWversion(temp_hw_version);
 }
 
 //*******************************
 /// Processing Command Character
 //*******************************
-void processCommandCharcter(const String &message, int sourceID) {
-    if (message.startsWith("s") || message.startsWith("S")) {
-        processSerialMessage(message);
-    } else if (message.startsWith("w") || message.startsWith("W")) {
-        processWCBMessage(message);
-    } else if (message.startsWith("c") || message.startsWith("C")) {
-        recallStoredCommand(message, sourceID);
-    } else if (message.startsWith("m") || message.startsWith("M")) {
-        processMaestroCommand(message);
-    } else {
+typedef void (*CommandCharacterHandler)(const char *message, size_t length, int sourceID);
+
+static constexpr CommandEntry<CommandCharacterHandler> commandCharacterCommands[] = {
+    {"s", MATCH_PREFIX, [](const char *m, size_t n, int) { processSerialMessage(m, n); }},
+    {"w", MATCH_PREFIX, [](const char *m, size_t n, int) { processWCBMessage(m, n); }},
+    {"c", MATCH_PREFIX, [](const char *m, size_t n, int sourceID) { recallStoredCommand(m, n, sourceID); }},
+    {"m", MATCH_PREFIX, [](const char *m, size_t n, int) { processMaestroCommand(m, n); }},
+    {"t", MATCH_PREFIX, [](const char *m, size_t, int sourceID) { processTimedCommand(m, sourceID); }},
+    {"v", MATCH_PREFIX, [](const char *m, size_t, int) { setMacroVariable(m); }},
+    {"d", MATCH_PREFIX, [](const char *, size_t, int) { Serial.println("Delays only work inside stored commands, e.g. ?CSkey,cmd1^;D500^cmd2"); }},
+    {"r", MATCH_PREFIX, [](const char *, size_t, int) { Serial.println("Repeats only work inside stored commands, e.g. ?CSkey,;R3^cmd^;D500^;R"); }},
+    {"i", MATCH_PREFIX, [](const char *, size_t, int) { Serial.println("Conditions only work inside stored commands, e.g. ?CSkey,;Ix=1^cmd^;I"); }},
+};
+
+void processCommandCharcter(const char *message, int sourceID) {
+    int index = matchCommandKeyword(commandCharacterCommands, message);
+    if (index < 0) {
         Serial.println("Invalid Serial Command");
+        return;
     }
+    commandCharacterCommands[index].handler(message, strlen(message), sourceID);
 }
 
 //*******************************
 /// Processing Command Character Functions
 //*******************************
-void processSerialMessage(const String &message) {
-    if (message.length() < 2) {
+void processSerialMessage(const char *message, size_t length) {
+    if (length < 2) {
         Serial.println("Invalid serial message format.");
         return;
     }
 
     // Extract serial port number
-    int target = message.substring(1, 2).toInt();  // Extract Serial port (1-5)
+    int target = commandDigit(message, length, 1);  // Extract Serial port (1-5)
     if (target < 1 || target > 5) {
         Serial.println("Invalid serial port number. Must be between 1 and 5.");
         return;
     }
 
     // Extract message to send
-    String serialMessage = message.substring(2);
-    serialMessage.trim();
+    const char *serialMessage = message + 2;
+    size_t serialLength = length - 2;
+    trimCommandText(serialMessage, serialLength);
 
     // Send to selected serial port
-    Stream &targetSerial = getSerialStream(target);
-    writeSerialString(targetSerial, serialMessage);
-    targetSerial.flush(); // Ensure it's sent immediately
+    writeSerialString(target, serialMessage, serialLength);
 
     if (debugEnabled) {
-        Serial.printf("Sent to Serial%d: %s\n", target, serialMessage.c_str());
+        Serial.printf("Sent to Serial%d: %.*s\n", target, (int)serialLength, serialMessage);
     }
 }
 
-void processWCBMessage(const String &message){
-  int targetWCB = message.substring(1, 2).toInt();
-        String espnow_message = message.substring(2);
-        if (targetWCB >= 1 && targetWCB <= Default_WCB_Quantity) {
-          Serial.printf("Sending Unicast ESP-NOW message to WCB%d: %s\n", targetWCB, espnow_message.c_str());
-          sendESPNowMessage(targetWCB, espnow_message.c_str());
-        } else {
-          Serial.println("Invalid WCB number for unicast.");
-        }
+void processWCBMessage(const char *message, size_t length){
+  forwardWCBMessage(message, length, "");
+}
+
+// ;W... with tag put in front of the command that is sent, e.g. the execution time of a ;T command
+void forwardWCBMessage(const char *message, size_t length, const char *tag){
+  uint32_t traceId = currentTraceId();
+  char traceTag[TRACE_TAG_MAX] = "";
+  if (traceId) formatTraceTag(traceId, traceTag);
+
+  // Only loop() sends commands; too long for a stack buffer
+  static char espnow_message[FRAGMENT_MAX_MESSAGE + 1];
+
+  // ;W{2,4,7}cmd or ;W{group}cmd: one multicast frame for several WCBs
+  if (length > 1 && message[1] == '{') {
+    const char *close = strchr(message, '}');
+    uint16_t targets = (close && close > message + 2) ? parseWCBTargetSet(message + 2, close - message - 2) : 0;
+    size_t commandLength = close ? message + length - (close + 1) : 0;
+    if (targets == 0 || commandLength == 0) {
+      Serial.println("Invalid WCB set for multicast.  Use ;W{2,4,7}cmd or ;W{group}cmd.");
+      return;
+    }
+    if (snprintf(espnow_message, sizeof(espnow_message), "%s%s%s", traceTag, tag, close + 1) >= (int)sizeof(espnow_message)) {
+      Serial.println("Command is too long to send via ESP-NOW! Discarding.");
+      return;
+    }
+    traceEvent(traceId, TRACE_ESPNOW_QUEUED, 0);
+    Serial.printf("Sending Multicast ESP-NOW message to %.*s: %s\n", (int)(close - message), message + 1, espnow_message);
+    sendESPNowMulticast(targets, espnow_message);
+    return;
+  }
+
+  int targetWCB = commandDigit(message, length, 1);
+  if (targetWCB < 1 || targetWCB > Default_WCB_Quantity) {
+    Serial.println("Invalid WCB number for unicast.");
+    return;
+  }
+  if (snprintf(espnow_message, sizeof(espnow_message), "%s%s%s", traceTag, tag, message + 2) >= (int)sizeof(espnow_message)) {
+    Serial.println("Command is too long to send via ESP-NOW! Discarding.");
+    return;
+  }
+  traceEvent(traceId, TRACE_ESPNOW_QUEUED, targetWCB);
+  Serial.printf("Sending Unicast ESP-NOW message to WCB%d: %s\n", targetWCB, espnow_message);
+  sendESPNowMessage(targetWCB, espnow_message);
 }
 
-void recallStoredCommand(const String &message, int sourceID) {
-  String key = message.substring(1);
-  key.trim();
-  if (key.length() > 0) {
-    recallCommandSlot(key, sourceID);
+void recallStoredCommand(const char *message, size_t length, int sourceID) {
+  const char *key = message + 1;
+  size_t keyLength = length - 1;
+  trimCommandText(key, keyLength);
+  if (keyLength > 0) {
+    recallCommandSlot(key, keyLength, sourceID);
   } else {
     Serial.println("Invalid recall command. Use ;Ckey to recall a command.");
   }
 }
 
-void processMaestroCommand(const String &message){
-  int message_maestroID = message.substring(1,2).toInt();
-  int message_maestroSeq = message.substring(2).toInt();
+void processMaestroCommand(const char *message, size_t length){
+  int message_maestroID = commandDigit(message, length, 1);
+  int message_maestroSeq = commandNumber(message, length, 2);
   sendMaestroCommand(message_maestroID,message_maestroSeq);
 }
 
+// ;T250,cmd runs cmd 250 ms from now, ;T@81234567,cmd at that network time (see WCB_TimeSync.h)
+void processTimedCommand(const char *message, int sourceID) {
+    const char *cmd = strchr(message, ',');
+    if (!cmd || cmd == message + 1 || cmd[1] == '\0') {
+        Serial.println("Invalid timed command.  Use ;T<ms>,cmd or ;T@<network ms>,cmd.");
+        return;
+    }
+    cmd++;
+
+    // Everything is done in whole network milliseconds, the unit other WCBs are told
+    bool synced = networkTimeSynced();
+    int64_t nowMs = networkTimeUs() / 1000;
+    int64_t delayMs;
+    if (message[1] == '@') {
+        if (!synced) {
+            // Our clock can't say when that is; better now than at some random time
+            if (debugEnabled) { Serial.printf("Network time is not synchronized, running now: %s\n", cmd); }
+            countUnsyncedTimedCommand();
+            runTimedCommandNow(cmd, sourceID);
+            return;
+        }
+        uint32_t at = strtoul(message + 2, nullptr, 10);
+        delayMs = (int32_t)(at - (uint32_t)nowMs);
+    } else {
+        delayMs = strtoul(message + 1, nullptr, 10);
+    }
+    if (delayMs > TIME_MAX_HORIZON_MS) {
+        Serial.printf("Timed command is %lld ms ahead, more than %d ms.  Discarding command.\n", delayMs, TIME_MAX_HORIZON_MS);
+        countRefusedTimedCommand();
+        return;
+    }
+    int64_t atMs = nowMs + delayMs;
+
+    // The absolute time goes along to the other WCBs so they all run cmd at the same moment.  Without
+    // a synchronized clock they get the delay instead, it is at least closer than our idea of network time.
+    char tag[24];
+    if (synced) {
+        snprintf(tag, sizeof(tag), "%cT@%lu,", CommandCharacter, (unsigned long)(uint32_t)atMs);
+    } else {
+        snprintf(tag, sizeof(tag), "%cT%lu,", CommandCharacter, (unsigned long)max(delayMs, (int64_t)0));
+    }
+
+    if (cmd[0] == CommandCharacter && (cmd[1] == 'W' || cmd[1] == 'w')) {
+        forwardWCBMessage(cmd + 1, strlen(cmd + 1), tag);
+        return;
+    }
+    if (cmd[0] != LocalFunctionIdentifier && cmd[0] != CommandCharacter && sourceID != SOURCE_ID_ESPNOW) {
+        // Sent on now, only the local ports wait
+        String tagged = String(tag) + cmd;
+        forwardBroadcastCommand(cmd, findCommandRoute(cmd), tagged.c_str());
+    }
+    if (!scheduleCommandAt(atMs * 1000, cmd, strlen(cmd), sourceID)) {
+        Serial.println("Too many scheduled commands! Discarding command.");
+    }
+}
+
+// A ;T@ command whose time can't be told, handled as if it had no time
+void runTimedCommandNow(const char *cmd, int sourceID) {
+    if (cmd[0] != LocalFunctionIdentifier && cmd[0] != CommandCharacter) {
+        processBroadcastCommand(cmd, sourceID);
+    } else {
+        handleSingleCommand(cmd, sourceID);
+    }
+}
+
+// A command from scheduleCommandAt() whose time has come.  Broadcast commands were already sent to other WCBs.
+void runScheduledCommand(const char *cmd, int sourceID) {
+    if (cmd[0] != LocalFunctionIdentifier && cmd[0] != CommandCharacter) {
+        writeBroadcastToPorts(cmd, findCommandRoute(cmd), sourceID);
+    } else {
+        handleSingleCommand(cmd, sourceID);
+    }
+}
+
 
 //*******************************
 /// Processing Broadcast Function
 //*******************************
-void processBroadcastCommand(const String &cmd, int sourceID) {
+void processBroadcastCommand(const char *cmd, int sourceID) {
+    // A matching route limits where the command goes, otherwise it goes everywhere
+    const CommandRoute *route = findCommandRoute(cmd);
     if (debugEnabled) {
-        Serial.printf("Broadcasting command: %s\n", cmd.c_str());
+        if (route) {
+            Serial.printf("Routing command via \"%s\": %s\n", route->prefix, cmd);
+        } else {
+            Serial.printf("Broadcasting command: %s\n", cmd);
+        }
+    }
+
+    writeBroadcastToPorts(cmd, route, sourceID);
+
+    // Commands that came in over ESP-NOW were already sent to every WCB that should have them
+    if (sourceID == SOURCE_ID_ESPNOW) {
+        return;
     }
+    forwardBroadcastCommand(cmd, route, cmd);
+}
 
-    // Send to all serial ports except restricted ones
+// Send to all serial ports (or the routed ones) except restricted ones
+void writeBroadcastToPorts(const char *cmd, const CommandRoute *route, int sourceID) {
     for (int i = 1; i <= 5; i++) {
         // Skip Serial1 if Kyber_Remote is enabled
         if ((i == 1 && Kyber_Remote) || 
             (i <= 2 && Kyber_Local) || 
-            i == sourceID || !serialBroadcastEnabled[i - 1]) {
+            isTunnelPort(i) ||
+            i == sourceID) {
+            continue;
+        }
+        if (route ? !(route->ports & (1 << i)) : !serialBroadcastEnabled[i - 1]) {
             continue;
         }
 
-        writeSerialString(getSerialStream(i), cmd);
-        if (debugEnabled) { Serial.printf("Sent to Serial%d: %s\n", i, cmd.c_str()); }
+        writeSerialString(i, cmd);
+        if (debugEnabled) { Serial.printf("Sent to Serial%d: %s\n", i, cmd); }
     }
+}
 
-    // Always send via ESP-NOW broadcast
-    sendESPNowMessage(0, cmd.c_str());
-    if (debugEnabled) { Serial.printf("Broadcasted via ESP-NOW: %s\n", cmd.c_str()); }
+// Send message to the WCBs that should get cmd (message is cmd itself, or cmd with a ;T tag in front)
+void forwardBroadcastCommand(const char *cmd, const CommandRoute *route, const char *message) {
+    // A traced command takes its trace ID along
+    uint32_t traceId = currentTraceId();
+    String traced;
+    if (traceId) {
+        char tag[TRACE_TAG_MAX];
+        formatTraceTag(traceId, tag);
+        traced = String(tag) + message;
+        message = traced.c_str();
+        traceEvent(traceId, TRACE_ESPNOW_QUEUED, 0);
+    }
+
+    if (route) {
+        sendESPNowMulticast(route->wcbs, message);
+        if (debugEnabled) { Serial.printf("Routed via ESP-NOW to WCB mask 0x%03X: %s\n", route->wcbs, message); }
+        return;
+    }
+    // Only the WCBs that subscribe to the command get it, when we know who they are
+    publishCommand(cmd, message);
 }
 
 // processIncomingSerial for each serial port
 void processIncomingSerial(Stream &serial, int sourceID) {
-    if (!serial.available()) return;  // Exit if no data available
-
-    static String serialBuffer = "";  // Buffer for incoming serial data
+    SerialLineAssembler &line = lineAssemblers[sourceID];
 
     while (serial.available()) {
         char c = serial.read();
 
         if (c == '\r' || c == '\n') {  // End of command
-            if (!serialBuffer.isEmpty()) {
-                serialBuffer.trim();  // Remove leading/trailing spaces
-                if (debugEnabled){Serial.printf("Processing input from Serial%d: %s\n", sourceID, serialBuffer.c_str());} 
-
-                // Reset last received flag since we are reading from Serial
-                lastReceivedViaESPNOW = false;
+            if (line.overflowed) {
+                // Tail end of a line that was too long, drop it
+                line.overflowed = false;
+                line.length = 0;
+            } else if (line.length > 0) {
+                line.buffer[line.length] = '\0';
+                if (debugEnabled){Serial.printf("Processing input from Serial%d: %s\n", sourceID, line.buffer);} 
 
                 // Process the command
-                processSerialCommandHelper(serialBuffer, sourceID);
+                processSerialCommandHelper(line.buffer, line.length, sourceID, startTrace(sourceID, line.startedUs));
 
                 // Clear buffer for next command
-                serialBuffer = "";
+                line.length = 0;
             }
+        } else if (line.overflowed) {
+            // Keep discarding until the terminator
+        } else if (line.length < SERIAL_LINE_BUFFER_SIZE - 1) {
+            if (line.length == 0) line.startedUs = esp_timer_get_time();
+            line.buffer[line.length++] = c;  // Append new characters to buffer
         } else {
-            serialBuffer += c;  // Append new characters to buffer
+            line.overflowed = true;
+            line.overflows++;
+            Serial.printf("Input from Serial%d longer than %d characters, discarding line\n", sourceID, SERIAL_LINE_BUFFER_SIZE - 1);
         }
     }
 }
 
 // Helper function to process serial commands
-void processSerialCommandHelper(String &data, int sourceID) {
+void processSerialCommandHelper(const char *data, size_t length, int sourceID, uint32_t traceId) {
     if (debugEnabled) {
-        Serial.printf("Processing command from Serial%d: %s\n", sourceID, data.c_str());
+        Serial.printf("Processing command from Serial%d: %s\n", sourceID, data);
     }
 
-    if (data.length() == 0) return;
+    // Trim leading/trailing spaces
+    while (length > 0 && isspace((unsigned char)*data)) { data++; length--; }
+    while (length > 0 && isspace((unsigned char)data[length - 1])) length--;
+    if (length == 0) return;
 
     // Direct enqueue if command starts with "?C"
-    if (data.startsWith(String(LocalFunctionIdentifier) + "C") || 
-        data.startsWith(String(LocalFunctionIdentifier) + "c")) {
-        enqueueCommand(data, sourceID);
+    if (length >= 2 && data[0] == LocalFunctionIdentifier && (data[1] == 'C' || data[1] == 'c')) {
+        enqueueCommand(data, length, sourceID, traceId);
         return;
     }
 
     // Parse command using the stored delimiter
-    int startIdx = 0;
-    while (true) {
-        int delimPos = data.indexOf(commandDelimiter, startIdx);
-        if (delimPos == -1) {
-            String singleCmd = data.substring(startIdx);
-            singleCmd.trim();
-            if (!singleCmd.isEmpty()) {
-                enqueueCommand(singleCmd, sourceID);
-            }
-            break;
-        } else {
-            String singleCmd = data.substring(startIdx, delimPos);
-            singleCmd.trim();
-            if (!singleCmd.isEmpty()) {
-                enqueueCommand(singleCmd, sourceID);
-            }
-            startIdx = delimPos + 1;
-        }
+    enqueueDelimitedCommands(data, length, sourceID, traceId);
+}
+
+// Called from the UART event task when a hardware port has received data
+void notifySerialInput(int sourceID) {
+    if (serialTaskHandle) {
+        xTaskNotify(serialTaskHandle, 1UL << sourceID, eSetBits);
     }
 }
 
+// Should this port's input be parsed as commands, or is it owned by the Kyber bridge?
+bool isCommandInputPort(int sourceID) {
+    if (isTunnelPort(sourceID)) return false;
+    if (sourceID == 1) return !Kyber_Local && !Kyber_Remote;
+    if (sourceID == 2) return !Kyber_Local;
+    return true;
+}
+
+// Hook the receive callbacks of every port that carries commands
+void attachSerialInputCallbacks() {
+    // Hardware UARTs raise an event after one idle character time, so a line is picked up right after its terminator
+    Serial.onReceive([]() { notifySerialInput(0); });
+    Serial.setRxTimeout(1);
+    if (isCommandInputPort(1)) {
+        Serial1.onReceive([]() { notifySerialInput(1); });
+        Serial1.setRxTimeout(1);
+    }
+    if (isCommandInputPort(2)) {
+        Serial2.onReceive([]() { notifySerialInput(2); });
+        Serial2.setRxTimeout(1);
+    }
+
+    // Serial3-Serial5 handlers run from perform_work() inside the serial task
+    // (a tunnelled port is left alone, serviceTunnels() reads it)
+    Serial3.onReceive([]() { if (isCommandInputPort(3)) processIncomingSerial(Serial3, 3); });
+    Serial4.onReceive([]() { if (isCommandInputPort(4)) processIncomingSerial(Serial4, 4); });
+    Serial5.onReceive([]() { if (isCommandInputPort(5)) processIncomingSerial(Serial5, 5); });
+}
+
 void printResetReason() {
     esp_reset_reason_t reason = esp_reset_reason();
     Serial.printf("Reset reason: %d - ", reason);
@@ -971,39 +1594,39 @@ void printResetReason() {
 }
 
 /// Task Definition for multi threading.  Act as separate loops within the main loop.
-void KyberLocalTask(void *pvParameters) {
-    while (true) {
-        forwardMaestroDataToLocalKyber();
-        forwardDataFromKyber();
-        vTaskDelay(pdMS_TO_TICKS(5)); // Reduce CPU usage while maintaining speed
-    }
-}
 
-void KyberRemoteTask(void *pvParameters) {
+void espnowReceiveTask(void *pvParameters) {
     while (true) {
-        forwardMaestroDataToRemoteKyber();
-        vTaskDelay(pdMS_TO_TICKS(5)); // Reduce CPU usage while maintaining speed
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        ESPNowRxEntry *entry;
+        while ((entry = espnowRxPeek()) != nullptr) {
+            processESPNowFrame(*entry);
+            espnowRxPop();
+        }
     }
 }
 
 void serialCommandTask(void *pvParameters) {
+    // Pick up anything that arrived before the callbacks were attached
+    uint32_t pending = (1UL << SERIAL_INPUT_PORTS) - 1;
+
     while (true) {
-        processIncomingSerial(Serial, 0);  // USB Serial
-        processIncomingSerial(Serial3, 3);
-        processIncomingSerial(Serial4, 4);
-        processIncomingSerial(Serial5, 5);
-
-        if (Kyber_Local) {
-          // don't add serial 1 or 2 for processing strings
-        } else if (Kyber_Remote){
-            processIncomingSerial(Serial2, 2);
-          // add only serial 2 for processing strings
-        } else {
-          processIncomingSerial(Serial1, 1);
-          processIncomingSerial(Serial2, 2);
+        for (int i = 0; i <= 2; i++) {
+            if ((pending & (1UL << i)) && isCommandInputPort(i)) {
+                processIncomingSerial(getSerialStream(i), i);
+            }
         }
 
-        vTaskDelay(pdMS_TO_TICKS(5)); // Allow time for other tasks
+        // Decodes what Serial3-Serial5 received and runs their receive handlers
+        Serial3.perform_work();
+        Serial4.perform_work();
+        Serial5.perform_work();
+
+        serviceTunnels();
+
+        // Hardware UART events wake us immediately, the timeout keeps Serial3-Serial5 serviced
+        pending = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &pending, pdMS_TO_TICKS(SOFTWARE_SERIAL_SERVICE_MS));
     }
 }
 
@@ -1015,6 +1638,10 @@ void setup() {
 
   loadHWversion();
   loadKyberSettings();
+  loadTunnelBindings();
+  loadCommandRoutes();
+  loadWCBGroups();
+  initTunnels();
   printResetReason();  // Show the exact cause of reset
 
 // Initialize the NeoPixel status LED
@@ -1033,11 +1660,10 @@ void setup() {
   loadWCBQuantitiesFromPreferences();
   loadMACPreferences();
 
-  // Create the command queue
-  commandQueue = xQueueCreate(20, sizeof(CommandQueueItem));
-  if (!commandQueue) {
-    Serial.println("Failed to create command queue!");
-  }
+  // Set up the command slot pool and the priority lanes that feed loop()
+  initCommandPool();
+  loadCommandPriorities();
+  initCommandLanes();
 
   Serial.println("\n\n-------------------------------------------------------");
   String hostname = getBoardHostname();
@@ -1050,12 +1676,16 @@ void setup() {
   printBaudRates();
   Serial.println("-------------------------------------------------------");
 
-  // Initialize hardware serial
+  // Initialize hardware serial.  The driver TX buffers let the Serial TX task hand over whole commands without blocking.
+  Serial1.setTxBufferSize(256);
+  Serial2.setTxBufferSize(256);
   Serial1.begin(baudRates[0], SERIAL_8N1, SERIAL1_RX_PIN, SERIAL1_TX_PIN);
   Serial2.begin(baudRates[1], SERIAL_8N1, SERIAL2_RX_PIN, SERIAL2_TX_PIN);
-  Serial3.begin(baudRates[2], SWSERIAL_8N1, SERIAL3_RX_PIN, SERIAL3_TX_PIN, false, 95);
-  Serial4.begin(baudRates[3], SWSERIAL_8N1, SERIAL4_RX_PIN, SERIAL4_TX_PIN, false, 95);
-  Serial5.begin(baudRates[4], SWSERIAL_8N1, SERIAL5_RX_PIN, SERIAL5_TX_PIN, false, 95);
+  Serial3.begin(baudRates[2], SERIAL3_RX_PIN, SERIAL3_TX_PIN);
+  Serial4.begin(baudRates[3], SERIAL4_RX_PIN, SERIAL4_TX_PIN);
+  Serial5.begin(baudRates[4], SERIAL5_RX_PIN, SERIAL5_TX_PIN);
+  initSerialTx();
+  loadSerialCoalesceKeys();
 
   // Initialize Wi-Fi
   WiFi.mode(WIFI_STA);
@@ -1081,6 +1711,9 @@ void setup() {
   esp_wifi_set_mac(WIFI_IF_STA, WCBMacAddresses[WCB_Number - 1]);
   
   loadESPNowPasswordFromPreferences();
+  loadESPNowFrameFormat();
+  loadESPNowReliable();
+  loadESPNowCoalesceWindow();
 
   // Print final MAC
   uint8_t baseMac[6];
@@ -1095,6 +1728,11 @@ void setup() {
     return;
   }
 
+  initWCBFrameSequence();
+  initESPNowTxQueue();
+  initReliableUnicast();
+  esp_now_register_send_cb(espNowSendCallback);
+
   // Add peers
   for (int i = 0; i < Default_WCB_Quantity; i++) {
     if (i + 1 == WCB_Number) continue; // skip ourselves
@@ -1135,32 +1773,37 @@ void setup() {
   Serial.printf("Command Character: %c\n", CommandCharacter);
   Serial.println("-------------------------------------------------------");
   printKyberSettings();
+
+  // The receive task must exist before the callback can hand it frames
+  xTaskCreatePinnedToCore(espnowReceiveTask, "ESP-NOW Receive Task", 4096, NULL, 2, &espnowRxTaskHandle, 1);
   esp_now_register_recv_cb(espNowReceiveCallback);
 
   // Create FreeRTOS Tasks
-  xTaskCreatePinnedToCore(serialCommandTask, "Serial Command Task", 4096, NULL, 1, NULL, 1);
-
-  // If bridging is enabled, create the bridging task
-  if (Kyber_Local) {
-      xTaskCreatePinnedToCore(KyberLocalTask, "Kyber Local Task", 4096, NULL, 1, NULL, 1);
-      Serial.println("Kyber_Local Task Created");
-  }    
-  if (Kyber_Remote) {
-      xTaskCreatePinnedToCore(KyberRemoteTask, "Kyber Remote Task", 4096, NULL, 1, NULL, 1);
-      Serial.println("Kyber_Remote Task Created");
-  }
+  xTaskCreatePinnedToCore(serialCommandTask, "Serial Command Task", 4096, NULL, 1, &serialTaskHandle, 1);
+  attachSerialInputCallbacks();
+
+  // If bridging is enabled, start the event-driven Kyber bridge
+  initKyberBridge();
   turnOffLED();
 
 }
 
 void loop() {
 
-  // Handle all queued commands
-  if (!commandQueue) return;
-  CommandQueueItem inItem;
-  while (xQueueReceive(commandQueue, &inItem, 0) == pdTRUE) {
-    String commandStr(inItem.cmd);
-    free(inItem.cmd); // release dynamic memory
-    handleSingleCommand(commandStr, inItem.sourceID);
+  // Handle all queued commands, highest priority first
+  CommandLaneItem inItem;
+  while (popCommandLane(inItem)) {
+    setCurrentTraceId(inItem.traceId);
+    traceEvent(inItem.traceId, TRACE_RUN, 0);
+    handleSingleCommand(commandSlotData(inItem.slot), inItem.sourceID);
+    setCurrentTraceId(0);
+    releaseCommandSlot(inItem.slot); // hand the slot back to the pool
   }
+
+  serviceCoalescedCommands();
+  serviceStoredCommandWriteBack();
+  serviceMesh();
+  serviceSubscriptions();
+  serviceTimeSync();
+  serviceSequencer();
 }
@@ -0,0 +1,91 @@
+#include "WCB_Coalesce.h"
+#include "WCB_Trace.h"
+
+extern uint8_t espnowCoalesceMs;
+extern void sendESPNowCommandFrame(uint8_t target, uint8_t flags, const uint8_t *payload, size_t length);
+
+typedef struct {
+  uint8_t payload[WCB_FRAME_MAX_PAYLOAD];
+  uint16_t length;
+  uint8_t records;
+  uint32_t openedAtUs;      // micros() when the first record went in
+  uint32_t traceId;         // First traced command in the batch, the frame is traced under its ID
+} CommandBatch;
+
+// Only loop() sends commands, so the batches need no lock
+static CommandBatch batches[COALESCE_TARGETS];
+static CoalesceStats coalesceStats = {};
+
+// Adds a command to the target's batch.  Returns false if the caller has to send it on its own.
+bool coalesceCommand(uint8_t target, const char *command, size_t length) {
+  if (espnowCoalesceMs == 0 || target >= COALESCE_TARGETS) return false;
+
+  CommandBatch &batch = batches[target];
+  if (length + 1 > WCB_FRAME_MAX_PAYLOAD) {
+    // Too long to batch; send what is waiting first so the order is kept
+    flushCoalescedCommands(target);
+    return false;
+  }
+  if (batch.length + 1 + length > WCB_FRAME_MAX_PAYLOAD) {
+    coalesceStats.fullFlushes++;
+    flushCoalescedCommands(target);
+  }
+
+  if (batch.records == 0) {
+    batch.openedAtUs = micros();
+  }
+  if (batch.traceId == 0) {
+    batch.traceId = currentTraceId();
+  }
+  batch.payload[batch.length++] = length;
+  memcpy(batch.payload + batch.length, command, length);
+  batch.length += length;
+  batch.records++;
+  coalesceStats.commands++;
+  return true;
+}
+
+void flushCoalescedCommands(uint8_t target) {
+  CommandBatch &batch = batches[target];
+  if (batch.records == 0) return;
+
+  uint32_t running = currentTraceId();
+  if (batch.traceId != 0) {
+    setCurrentTraceId(batch.traceId);
+  }
+  if (batch.records == 1) {
+    // Nothing was coalesced, send the plain command
+    sendESPNowCommandFrame(target, 0, batch.payload + 1, batch.length - 1);
+  } else {
+    sendESPNowCommandFrame(target, WCB_FLAG_BATCH, batch.payload, batch.length);
+  }
+  setCurrentTraceId(running);
+  coalesceStats.frames++;
+  batch.length = 0;
+  batch.records = 0;
+  batch.traceId = 0;
+}
+
+void flushAllCoalescedCommands() {
+  for (int target = 0; target < COALESCE_TARGETS; target++) {
+    flushCoalescedCommands(target);
+  }
+}
+
+// Called from loop(): send batches whose window has closed
+void serviceCoalescedCommands() {
+  uint32_t now = micros();
+  for (int target = 0; target < COALESCE_TARGETS; target++) {
+    CommandBatch &batch = batches[target];
+    if (batch.records > 0 && now - batch.openedAtUs >= (uint32_t)espnowCoalesceMs * 1000) {
+      flushCoalescedCommands(target);
+    }
+  }
+}
+
+void printCoalesceStats() {
+  Serial.println("--------------- ESP-NOW Coalescing ----------------------");
+  Serial.printf("Window: %u ms, %lu commands sent in %lu frames, %lu batches sent early because they were full\n",
+                espnowCoalesceMs, (unsigned long)coalesceStats.commands, (unsigned long)coalesceStats.frames,
+                (unsigned long)coalesceStats.fullFlushes);
+}
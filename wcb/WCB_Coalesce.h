@@ -0,0 +1,35 @@
+#ifndef WCB_COALESCE_H
+#define WCB_COALESCE_H
+
+#include <Arduino.h>
+#include "WCB_Frame.h"
+
+// =============== ESP-NOW Command Coalescing ===============
+// A line such as ";W2:S1:PP100*;W2:S2:R01*;W2:S3:MD904" turns into several
+// commands for the same WCB a few microseconds apart.  Instead of sending one
+// frame each, commands for a target are collected for up to
+// espnowCoalesceMs milliseconds and sent as one COMMAND frame with the
+// WCB_FLAG_BATCH flag.  The payload of a batch is a list of records:
+//
+//   | length (1) | command ... | length (1) | command ... | ...
+//
+// The receiver queues the records in order, so they reach its ports together.
+// A batch is sent early when the next command wouldn't fit.  A window of 0
+// sends every command on its own as before.
+
+#define COALESCE_TARGETS   10      // Broadcast (0) plus WCB1-WCB9
+
+typedef struct {
+  uint32_t commands;        // Commands that went through a batch
+  uint32_t frames;          // Frames those commands were sent in
+  uint32_t fullFlushes;     // Batches sent early because the next command didn't fit
+} CoalesceStats;
+
+// =============== Function Declarations ===============
+bool coalesceCommand(uint8_t target, const char *command, size_t length);
+void flushCoalescedCommands(uint8_t target);
+void flushAllCoalescedCommands();
+void serviceCoalescedCommands();
+void printCoalesceStats();
+
+#endif
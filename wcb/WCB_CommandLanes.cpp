@@ -0,0 +1,191 @@
+#include "WCB_CommandLanes.h"
+#include <freertos/FreeRTOS.h>
+
+typedef struct {
+  CommandLaneItem items[COMMAND_LANE_DEPTH];
+  uint8_t head;         // Next item written
+  uint8_t tail;         // Next item dispatched
+} CommandLane;
+
+uint8_t portCommandPriority[COMMAND_LANE_SOURCES] = {
+  COMMAND_PRIORITY_NORMAL, COMMAND_PRIORITY_NORMAL, COMMAND_PRIORITY_NORMAL, COMMAND_PRIORITY_NORMAL,
+  COMMAND_PRIORITY_NORMAL, COMMAND_PRIORITY_NORMAL, COMMAND_PRIORITY_NORMAL
+};
+CommandPriorityPrefix commandPriorityPrefixes[COMMAND_PRIORITY_PREFIXES];
+uint8_t commandPriorityPrefixCount = 0;
+
+static CommandLane commandLanes[COMMAND_PRIORITY_CLASSES][COMMAND_LANE_SOURCES];
+static uint8_t nextLaneSource[COMMAND_PRIORITY_CLASSES];     // Round-robin position in each class
+static CommandClassStats classStats[COMMAND_PRIORITY_CLASSES];
+
+// Commands are queued by the serial task, the ESP-NOW receive task and loop() itself (stored commands)
+static portMUX_TYPE commandLaneMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *const prioritySourceNames[COMMAND_LANE_SOURCES] = {
+  "USB Serial", "Serial1", "Serial2", "Serial3", "Serial4", "Serial5", "ESP-NOW"
+};
+
+// Priority settings are loaded from NVS before this runs
+void initCommandLanes() {
+  portENTER_CRITICAL(&commandLaneMux);
+  for (int c = 0; c < COMMAND_PRIORITY_CLASSES; c++) {
+    for (int s = 0; s < COMMAND_LANE_SOURCES; s++) {
+      commandLanes[c][s].head = 0;
+      commandLanes[c][s].tail = 0;
+    }
+    nextLaneSource[c] = 0;
+    classStats[c] = {};
+  }
+  portEXIT_CRITICAL(&commandLaneMux);
+}
+
+// Longest matching prefix, else the class of the port the command came from
+uint8_t commandPriority(const char *cmd, size_t length, int sourceID) {
+  uint8_t priority = (sourceID >= 0 && sourceID < COMMAND_LANE_SOURCES) ? portCommandPriority[sourceID]
+                                                                        : COMMAND_PRIORITY_NORMAL;
+  size_t bestLength = 0;
+
+  portENTER_CRITICAL(&commandLaneMux);
+  for (int i = 0; i < commandPriorityPrefixCount; i++) {
+    const CommandPriorityPrefix &rule = commandPriorityPrefixes[i];
+    size_t prefixLength = strlen(rule.prefix);
+    if (prefixLength > bestLength && prefixLength <= length && strncasecmp(cmd, rule.prefix, prefixLength) == 0) {
+      bestLength = prefixLength;
+      priority = rule.priority;
+    }
+  }
+  portEXIT_CRITICAL(&commandLaneMux);
+  return priority;
+}
+
+bool pushCommandLane(uint8_t priority, const CommandLaneItem &item) {
+  if (priority >= COMMAND_PRIORITY_CLASSES || item.sourceID < 0 || item.sourceID >= COMMAND_LANE_SOURCES) return false;
+
+  portENTER_CRITICAL(&commandLaneMux);
+  CommandLane &lane = commandLanes[priority][item.sourceID];
+  if ((uint8_t)(lane.head - lane.tail) >= COMMAND_LANE_DEPTH) {
+    classStats[priority].dropped++;
+    portEXIT_CRITICAL(&commandLaneMux);
+    return false;
+  }
+  lane.items[lane.head & (COMMAND_LANE_DEPTH - 1)] = item;
+  lane.head++;
+  classStats[priority].queued++;
+  portEXIT_CRITICAL(&commandLaneMux);
+  return true;
+}
+
+// Next command for loop(): highest class first, round-robin over the sources within it
+bool popCommandLane(CommandLaneItem &item) {
+  portENTER_CRITICAL(&commandLaneMux);
+  for (int c = 0; c < COMMAND_PRIORITY_CLASSES; c++) {
+    for (int i = 0; i < COMMAND_LANE_SOURCES; i++) {
+      int source = (nextLaneSource[c] + i) % COMMAND_LANE_SOURCES;
+      CommandLane &lane = commandLanes[c][source];
+      if (lane.head == lane.tail) continue;
+
+      item = lane.items[lane.tail & (COMMAND_LANE_DEPTH - 1)];
+      lane.tail++;
+      nextLaneSource[c] = (source + 1) % COMMAND_LANE_SOURCES;
+
+      uint32_t delayUs = micros() - item.queuedAtUs;
+      CommandClassStats &stats = classStats[c];
+      stats.dispatched++;
+      stats.totalDelayUs += delayUs;
+      if (delayUs > stats.maxDelayUs) {
+        stats.maxDelayUs = delayUs;
+      }
+      portEXIT_CRITICAL(&commandLaneMux);
+      return true;
+    }
+  }
+  portEXIT_CRITICAL(&commandLaneMux);
+  return false;
+}
+
+// A command of this class that never made it into a lane (no pool slot)
+void countCommandDropped(uint8_t priority) {
+  if (priority >= COMMAND_PRIORITY_CLASSES) return;
+  portENTER_CRITICAL(&commandLaneMux);
+  classStats[priority].dropped++;
+  portEXIT_CRITICAL(&commandLaneMux);
+}
+
+// H, N or L.  Returns -1 for anything else.
+int commandPriorityFromChar(char c) {
+  switch (toupper((unsigned char)c)) {
+    case 'H': return COMMAND_PRIORITY_HIGH;
+    case 'N': return COMMAND_PRIORITY_NORMAL;
+    case 'L': return COMMAND_PRIORITY_LOW;
+    default:  return -1;
+  }
+}
+
+char commandPriorityChar(uint8_t priority) {
+  static const char letters[COMMAND_PRIORITY_CLASSES] = {'H', 'N', 'L'};
+  return priority < COMMAND_PRIORITY_CLASSES ? letters[priority] : '?';
+}
+
+// Adds a prefix or changes the class of an existing one.  Returns false if the table is full.
+bool setCommandPriorityPrefix(const char *prefix, uint8_t priority) {
+  size_t length = strlen(prefix);
+  if (length == 0 || length > COMMAND_PRIORITY_PREFIX_MAX || priority >= COMMAND_PRIORITY_CLASSES) return false;
+
+  bool stored = false;
+  portENTER_CRITICAL(&commandLaneMux);
+  for (int i = 0; i < commandPriorityPrefixCount && !stored; i++) {
+    if (strcasecmp(commandPriorityPrefixes[i].prefix, prefix) == 0) {
+      commandPriorityPrefixes[i].priority = priority;
+      stored = true;
+    }
+  }
+  if (!stored && commandPriorityPrefixCount < COMMAND_PRIORITY_PREFIXES) {
+    CommandPriorityPrefix &rule = commandPriorityPrefixes[commandPriorityPrefixCount++];
+    strcpy(rule.prefix, prefix);
+    rule.priority = priority;
+    stored = true;
+  }
+  portEXIT_CRITICAL(&commandLaneMux);
+  return stored;
+}
+
+void clearCommandPriorityPrefixes() {
+  portENTER_CRITICAL(&commandLaneMux);
+  commandPriorityPrefixCount = 0;
+  portEXIT_CRITICAL(&commandLaneMux);
+}
+
+void printCommandPrioritySettings() {
+  Serial.print("Command priority by port:");
+  for (int s = 0; s < COMMAND_LANE_SOURCES; s++) {
+    Serial.printf(" %s=%c", prioritySourceNames[s], commandPriorityChar(portCommandPriority[s]));
+  }
+  Serial.println();
+  for (int i = 0; i < commandPriorityPrefixCount; i++) {
+    Serial.printf("Command priority prefix \"%s\": %c\n", commandPriorityPrefixes[i].prefix,
+                  commandPriorityChar(commandPriorityPrefixes[i].priority));
+  }
+}
+
+void printCommandLaneStats() {
+  static const char *const classNames[COMMAND_PRIORITY_CLASSES] = {"High", "Normal", "Low"};
+
+  portENTER_CRITICAL(&commandLaneMux);
+  CommandClassStats stats[COMMAND_PRIORITY_CLASSES];
+  uint8_t waiting[COMMAND_PRIORITY_CLASSES] = {};
+  for (int c = 0; c < COMMAND_PRIORITY_CLASSES; c++) {
+    stats[c] = classStats[c];
+    for (int s = 0; s < COMMAND_LANE_SOURCES; s++) {
+      waiting[c] += (uint8_t)(commandLanes[c][s].head - commandLanes[c][s].tail);
+    }
+  }
+  portEXIT_CRITICAL(&commandLaneMux);
+
+  Serial.println("--------------- Command Priority Lanes ----------------------");
+  for (int c = 0; c < COMMAND_PRIORITY_CLASSES; c++) {
+    uint32_t averageUs = stats[c].dispatched ? (uint32_t)(stats[c].totalDelayUs / stats[c].dispatched) : 0;
+    Serial.printf("%-6s: queued %lu, dispatched %lu, waiting %u, dropped %lu, delay avg %lu us, max %lu us\n",
+                  classNames[c], (unsigned long)stats[c].queued, (unsigned long)stats[c].dispatched, waiting[c],
+                  (unsigned long)stats[c].dropped, (unsigned long)averageUs, (unsigned long)stats[c].maxDelayUs);
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef WCB_COMMANDLANES_H
+#define WCB_COMMANDLANES_H
+
+#include <Arduino.h>
+
+// =============== Command Priority Lanes ===============
+// Commands waiting for loop() are kept in three priority classes instead of
+// one FIFO, so a chatty sound board port can't hold up an emergency stop.
+// loop() always takes from the highest class that has anything waiting.
+// Within a class every source (USB Serial, Serial1-5 and other WCBs) has its
+// own lane, and the lanes are served round-robin; a source that fills its
+// lane only drops its own commands.
+//
+// A command's class comes from the longest matching priority prefix, e.g.
+//
+//   ?PRIO_PREFIXH,;S1ESTOP     ;S1ESTOP... is always high priority
+//
+// or, if no prefix matches, from the port it arrived on:
+//
+//   ?PRIO_PORT3,L              everything from Serial3 is low priority
+//   ?PRIO_PORTE,H              everything from other WCBs is high priority
+
+#define COMMAND_PRIORITY_HIGH       0
+#define COMMAND_PRIORITY_NORMAL     1
+#define COMMAND_PRIORITY_LOW        2
+#define COMMAND_PRIORITY_CLASSES    3
+
+#define COMMAND_LANE_SOURCES        7       // USB Serial (0), Serial1-5, other WCBs (SOURCE_ID_ESPNOW)
+#define COMMAND_LANE_DEPTH          32      // Commands per source and class, a power of two of at least the old queue's 20
+
+#define COMMAND_PRIORITY_PREFIXES   8
+#define COMMAND_PRIORITY_PREFIX_MAX 15      // Characters in a prefix
+
+typedef struct {
+  uint8_t slot;           // Index into the command slot pool (see WCB_CommandPool.h)
+  int8_t sourceID;        // 0 for USB Serial, 1..5 for Serial1-5, SOURCE_ID_ESPNOW for another WCB
+  uint16_t length;        // Command length, excluding the null terminator
+  uint32_t queuedAtUs;
+  uint32_t traceId;       // 0 unless the command is traced (see WCB_Trace.h)
+} CommandLaneItem;
+
+typedef struct {
+  char prefix[COMMAND_PRIORITY_PREFIX_MAX + 1];
+  uint8_t priority;
+} CommandPriorityPrefix;
+
+typedef struct {
+  uint32_t queued;
+  uint32_t dispatched;
+  uint32_t dropped;         // Lane or command pool full
+  uint64_t totalDelayUs;    // Time between queueing and dispatch, summed over dispatched commands
+  uint32_t maxDelayUs;
+} CommandClassStats;
+
+extern uint8_t portCommandPriority[COMMAND_LANE_SOURCES];
+extern CommandPriorityPrefix commandPriorityPrefixes[COMMAND_PRIORITY_PREFIXES];
+extern uint8_t commandPriorityPrefixCount;
+
+// =============== Function Declarations ===============
+void initCommandLanes();
+uint8_t commandPriority(const char *cmd, size_t length, int sourceID);
+bool pushCommandLane(uint8_t priority, const CommandLaneItem &item);
+bool popCommandLane(CommandLaneItem &item);
+void countCommandDropped(uint8_t priority);
+
+int commandPriorityFromChar(char c);
+char commandPriorityChar(uint8_t priority);
+bool setCommandPriorityPrefix(const char *prefix, uint8_t priority);
+void clearCommandPriorityPrefixes();
+
+void printCommandPrioritySettings();
+void printCommandLaneStats();
+
+#endif
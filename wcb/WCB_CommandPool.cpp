@@ -0,0 +1,119 @@
+#include "WCB_CommandPool.h"
+#include <freertos/FreeRTOS.h>
+
+// Slot indexes 0..COMMAND_SMALL_SLOT_COUNT-1 are small slots, the rest are large slots.
+static char smallSlots[COMMAND_SMALL_SLOT_COUNT][COMMAND_SMALL_SLOT_SIZE];
+static char largeSlots[COMMAND_LARGE_SLOT_COUNT][COMMAND_LARGE_SLOT_SIZE];
+
+// Free lists are simple stacks of slot indexes
+static uint8_t smallFree[COMMAND_SMALL_SLOT_COUNT];
+static uint8_t largeFree[COMMAND_LARGE_SLOT_COUNT];
+static uint8_t smallFreeCount = 0;
+static uint8_t largeFreeCount = 0;
+
+static CommandPoolClassStats smallStats = {};
+static CommandPoolClassStats largeStats = {};
+static uint32_t tooLongDrops = 0;
+static uint32_t largeFallbacks = 0;    // Short commands that went to a large slot because the small ones were taken
+
+// Enqueue runs from the ESP-NOW receive task and the serial task, dequeue from loop()
+static portMUX_TYPE commandPoolMux = portMUX_INITIALIZER_UNLOCKED;
+
+void initCommandPool() {
+  portENTER_CRITICAL(&commandPoolMux);
+  for (int i = 0; i < COMMAND_SMALL_SLOT_COUNT; i++) {
+    smallFree[i] = i;
+  }
+  for (int i = 0; i < COMMAND_LARGE_SLOT_COUNT; i++) {
+    largeFree[i] = COMMAND_SMALL_SLOT_COUNT + i;
+  }
+  smallFreeCount = COMMAND_SMALL_SLOT_COUNT;
+  largeFreeCount = COMMAND_LARGE_SLOT_COUNT;
+  smallStats = {};
+  largeStats = {};
+  largeFallbacks = 0;
+  portEXIT_CRITICAL(&commandPoolMux);
+}
+
+static uint8_t takeSlot(uint8_t *freeList, uint8_t &freeCount, CommandPoolClassStats &stats, uint8_t reserved) {
+  if (freeCount <= reserved) {
+    return COMMAND_SLOT_NONE;
+  }
+  uint8_t slot = freeList[--freeCount];
+  stats.inUse++;
+  stats.allocations++;
+  if (stats.inUse > stats.highWatermark) {
+    stats.highWatermark = stats.inUse;
+  }
+  return slot;
+}
+
+// The last COMMAND_RESERVED_SLOTS small slots are kept for high priority commands,
+// so a flood of ordinary ones can't leave an emergency stop without a slot
+uint8_t allocateCommandSlot(size_t length, bool highPriority) {
+  uint8_t slot = COMMAND_SLOT_NONE;
+  portENTER_CRITICAL(&commandPoolMux);
+  if (length < COMMAND_SMALL_SLOT_SIZE) {
+    slot = takeSlot(smallFree, smallFreeCount, smallStats, highPriority ? 0 : COMMAND_RESERVED_SLOTS);
+    // Fall back to a large slot so a burst of short commands is not dropped early
+    if (slot == COMMAND_SLOT_NONE) {
+      slot = takeSlot(largeFree, largeFreeCount, largeStats, 0);
+      if (slot != COMMAND_SLOT_NONE) {
+        largeFallbacks++;
+      } else {
+        smallStats.exhausted++;
+      }
+    }
+  } else if (length < COMMAND_LARGE_SLOT_SIZE) {
+    slot = takeSlot(largeFree, largeFreeCount, largeStats, 0);
+    if (slot == COMMAND_SLOT_NONE) {
+      largeStats.exhausted++;
+    }
+  } else {
+    tooLongDrops++;
+  }
+  portEXIT_CRITICAL(&commandPoolMux);
+  return slot;
+}
+
+void releaseCommandSlot(uint8_t slot) {
+  portENTER_CRITICAL(&commandPoolMux);
+  if (slot < COMMAND_SMALL_SLOT_COUNT) {
+    smallFree[smallFreeCount++] = slot;
+    smallStats.inUse--;
+  } else if (slot < COMMAND_POOL_SLOTS) {
+    largeFree[largeFreeCount++] = slot;
+    largeStats.inUse--;
+  }
+  portEXIT_CRITICAL(&commandPoolMux);
+}
+
+char *commandSlotData(uint8_t slot) {
+  if (slot < COMMAND_SMALL_SLOT_COUNT) {
+    return smallSlots[slot];
+  }
+  return largeSlots[slot - COMMAND_SMALL_SLOT_COUNT];
+}
+
+size_t commandSlotCapacity(uint8_t slot) {
+  return (slot < COMMAND_SMALL_SLOT_COUNT) ? COMMAND_SMALL_SLOT_SIZE : COMMAND_LARGE_SLOT_SIZE;
+}
+
+void printCommandPoolStats() {
+  // Copy under the lock so the numbers are consistent with each other
+  portENTER_CRITICAL(&commandPoolMux);
+  CommandPoolClassStats small = smallStats;
+  CommandPoolClassStats large = largeStats;
+  uint32_t tooLong = tooLongDrops;
+  uint32_t fallbacks = largeFallbacks;
+  portEXIT_CRITICAL(&commandPoolMux);
+
+  Serial.println("--------------- Command Pool ----------------------");
+  Serial.printf("Small slots (%d bytes): %u/%d in use, high watermark %u, allocations %lu, exhausted %lu, fell back to large %lu\n",
+                COMMAND_SMALL_SLOT_SIZE, small.inUse, COMMAND_SMALL_SLOT_COUNT, small.highWatermark,
+                (unsigned long)small.allocations, (unsigned long)small.exhausted, (unsigned long)fallbacks);
+  Serial.printf("Large slots (%d bytes): %u/%d in use, high watermark %u, allocations %lu, exhausted %lu\n",
+                COMMAND_LARGE_SLOT_SIZE, large.inUse, COMMAND_LARGE_SLOT_COUNT, large.highWatermark,
+                (unsigned long)large.allocations, (unsigned long)large.exhausted);
+  Serial.printf("Dropped: %lu too long\n", (unsigned long)tooLong);
+}
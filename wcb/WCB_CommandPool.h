@@ -0,0 +1,37 @@
+#ifndef WCB_COMMANDPOOL_H
+#define WCB_COMMANDPOOL_H
+
+#include <Arduino.h>
+
+// =============== Command Slot Pool ===============
+// Commands waiting in the command lanes live in preallocated, fixed-size slots
+// instead of malloc'd buffers so that long running droids never fragment the heap.
+// Two size classes are kept: plenty of small slots for everyday commands and a
+// few large ones for stored-command definitions and long macros.
+
+#define COMMAND_SMALL_SLOT_SIZE   128     // Bytes per small slot (including null terminator)
+#define COMMAND_SMALL_SLOT_COUNT  32      // Number of small slots
+#define COMMAND_LARGE_SLOT_SIZE   1024    // Bytes per large slot (including null terminator)
+#define COMMAND_LARGE_SLOT_COUNT  4       // Number of large slots
+#define COMMAND_RESERVED_SLOTS    4       // Small slots only high priority commands may take
+
+#define COMMAND_POOL_SLOTS        (COMMAND_SMALL_SLOT_COUNT + COMMAND_LARGE_SLOT_COUNT)
+#define COMMAND_SLOT_NONE         0xFF    // Returned when no slot could be taken
+
+typedef struct {
+  uint16_t inUse;           // Slots currently holding a command
+  uint16_t highWatermark;   // Most slots ever in use at once
+  uint32_t allocations;     // Slots handed out since boot
+  uint32_t exhausted;       // Commands of this size that got no slot at all, after any fallback
+} CommandPoolClassStats;
+
+// =============== Function Declarations ===============
+void initCommandPool();
+uint8_t allocateCommandSlot(size_t length, bool highPriority);   // length excludes the null terminator
+void releaseCommandSlot(uint8_t slot);
+char *commandSlotData(uint8_t slot);
+size_t commandSlotCapacity(uint8_t slot);
+
+void printCommandPoolStats();
+
+#endif
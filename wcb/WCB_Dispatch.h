@@ -0,0 +1,86 @@
+#ifndef WCB_DISPATCH_H
+#define WCB_DISPATCH_H
+
+#include <Arduino.h>
+
+// =============== Command Keyword Dispatch ===============
+// Local (?xxx) and command-character (;xxx) commands are resolved through
+// constexpr keyword tables instead of startsWith() chains.  The matcher walks
+// the input once, keeping a bitmask of keywords that still agree with every
+// byte seen so far, so table order does not matter ("cclear" vs "cc", "wcbq"
+// vs "wcb"): the longest keyword that matches wins.  Matching is case
+// insensitive and never allocates.
+//
+// Handlers get the command (without its ? or ;) and its length, and pick their
+// arguments out of it with the helpers below instead of building a String.
+// test/bench_dispatch.cpp times the table against the old startsWith() chain.
+
+enum CommandMatch : uint8_t {
+  MATCH_EXACT,    // The whole command must equal the keyword
+  MATCH_PREFIX    // The command only has to start with the keyword
+};
+
+template <typename Handler>
+struct CommandEntry {
+  const char *keyword;    // Lower case
+  CommandMatch match;
+  Handler handler;
+};
+
+// Returns the index of the best matching entry, or -1 if none matches
+template <typename Handler, size_t N>
+int matchCommandKeyword(const CommandEntry<Handler> (&table)[N], const char *input) {
+  static_assert(N <= 64, "Keyword table too large for the candidate mask");
+
+  uint64_t candidates = (N == 64) ? ~0ull : ((1ull << N) - 1);
+  int best = -1;
+
+  for (size_t i = 0; candidates != 0; i++) {
+    char c = input[i];
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+
+    uint64_t remaining = candidates;
+    while (remaining) {
+      int j = __builtin_ctzll(remaining);
+      remaining &= remaining - 1;
+
+      char k = table[j].keyword[i];
+      if (k == '\0') {
+        // Keyword fully matched; later (longer) matches replace it
+        if (table[j].match == MATCH_PREFIX || c == '\0') {
+          best = j;
+        }
+        candidates &= ~(1ull << j);
+      } else if (k != c) {
+        candidates &= ~(1ull << j);
+      }
+    }
+
+    if (c == '\0') break;
+  }
+  return best;
+}
+
+// The digit at offset, 0 if there is none (what substring(offset, offset + 1).toInt() gave)
+inline int commandDigit(const char *message, size_t length, size_t offset) {
+  return (offset < length && message[offset] >= '0' && message[offset] <= '9') ? message[offset] - '0' : 0;
+}
+
+// The number starting at offset, 0 if there is none (what substring(offset).toInt() gave).
+// message must be null terminated at length.
+inline int commandNumber(const char *message, size_t length, size_t offset) {
+  return (offset < length) ? atoi(message + offset) : 0;
+}
+
+// Drop leading and trailing whitespace, like String::trim()
+inline void trimCommandText(const char *&text, size_t &length) {
+  while (length > 0 && isspace((unsigned char)text[0])) {
+    text++;
+    length--;
+  }
+  while (length > 0 && isspace((unsigned char)text[length - 1])) {
+    length--;
+  }
+}
+
+#endif
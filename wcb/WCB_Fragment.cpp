@@ -0,0 +1,156 @@
+#include "WCB_Fragment.h"
+#include "WCB_Mesh.h"
+#include "WCB_Subscribe.h"
+
+extern bool debugEnabled;
+extern void sendESPNowCommandFrame(uint8_t target, uint8_t flags, const uint8_t *payload, size_t length);
+extern void handleESPNowCommand(int senderWCB, int targetWCB, const char *command, size_t len);
+
+typedef struct {
+  bool used;
+  uint8_t sender;
+  uint16_t message;
+  uint8_t count;
+  uint16_t total;
+  uint16_t received;      // Bit n = piece n is in
+  uint32_t startedAtMs;
+  char data[FRAGMENT_MAX_MESSAGE];
+} ReassemblySlot;
+
+// Slots are only touched from the ESP-NOW receive task; loop() only counts what it sends
+static ReassemblySlot slots[FRAGMENT_SLOTS];
+static FragmentStats fragmentStats = {};
+
+static uint16_t nextMessage = 0;
+static bool nextMessageSeeded = false;
+
+// Largest COMMAND payload that reaches target in one frame
+size_t commandPayloadLimit(uint8_t target) {
+#if WCB_FRAME_BUFFER_SIZE > WCB_FRAME_MAX_SIZE
+  // v2 frames only go straight to a WCB that said it can take them
+  if (target != 0 && meshNextHop(target) == target && wcbAcceptsLargeFrames(target)) {
+    return WCB_FRAME_BUFFER_PAYLOAD;
+  }
+#endif
+  return WCB_FRAME_MAX_PAYLOAD;
+}
+
+// Sends payload (a command, after the target mask of a multicast) as pieces of at most maxPayload bytes
+void sendFragmentedCommand(uint8_t target, uint8_t flags, const uint8_t *payload, size_t length, size_t maxPayload) {
+  size_t maskLength = (flags & WCB_FLAG_MULTICAST) ? WCB_MULTICAST_MASK_SIZE : 0;
+  size_t total = length - maskLength;
+  size_t pieceMax = maxPayload - maskLength - sizeof(wcb_fragment_header);
+  size_t count = (total + pieceMax - 1) / pieceMax;
+  if (total > FRAGMENT_MAX_MESSAGE || count > FRAGMENT_MAX_COUNT) {
+    Serial.printf("Command of %u bytes is too long to send via ESP-NOW! Discarding.\n", (unsigned)total);
+    return;
+  }
+
+  // A random start keeps a rebooted WCB from reusing numbers a receiver still has a slot for
+  if (!nextMessageSeeded) {
+    nextMessage = esp_random();
+    nextMessageSeeded = true;
+  }
+
+  wcb_fragment_header header;
+  header.message = nextMessage++;
+  header.count = count;
+  header.total = total;
+
+  uint8_t piece[WCB_FRAME_BUFFER_PAYLOAD];
+  memcpy(piece, payload, maskLength);
+  for (size_t index = 0; index < count; index++) {
+    size_t offset = index * pieceMax;
+    size_t pieceLength = min(pieceMax, total - offset);
+    header.index = index;
+    header.offset = offset;
+    memcpy(piece + maskLength, &header, sizeof(header));
+    memcpy(piece + maskLength + sizeof(header), payload + maskLength + offset, pieceLength);
+    sendESPNowCommandFrame(target, flags | WCB_FLAG_FRAGMENT, piece, maskLength + sizeof(header) + pieceLength);
+  }
+
+  fragmentStats.fragmented++;
+  fragmentStats.fragmentsSent += count;
+  if (debugEnabled) { Serial.printf("Sent %u byte command as %u fragments (message %u)\n", (unsigned)total, (unsigned)count, header.message); }
+}
+
+// Finds the slot for (sender, message), starting a new one if needed.  Drops slots that timed out on the way.
+static ReassemblySlot *findReassemblySlot(uint8_t sender, const wcb_fragment_header &header, uint32_t now) {
+  ReassemblySlot *free = nullptr;
+  ReassemblySlot *oldest = nullptr;
+  for (int i = 0; i < FRAGMENT_SLOTS; i++) {
+    ReassemblySlot &slot = slots[i];
+    if (slot.used && now - slot.startedAtMs > FRAGMENT_TIMEOUT_MS) {
+      slot.used = false;
+      fragmentStats.timeouts++;
+      if (debugEnabled) { Serial.printf("Fragments of message %u from WCB%d timed out\n", slot.message, slot.sender); }
+    }
+    if (!slot.used) {
+      if (!free) free = &slot;
+      continue;
+    }
+    if (slot.sender == sender && slot.message == header.message) return &slot;
+    if (!oldest || now - slot.startedAtMs > now - oldest->startedAtMs) oldest = &slot;
+  }
+
+  ReassemblySlot *slot = free;
+  if (!slot) {
+    slot = oldest;
+    fragmentStats.evicted++;
+  }
+  slot->used = true;
+  slot->sender = sender;
+  slot->message = header.message;
+  slot->count = header.count;
+  slot->total = header.total;
+  slot->received = 0;
+  slot->startedAtMs = now;
+  return slot;
+}
+
+// A COMMAND frame with WCB_FLAG_FRAGMENT (ESP-NOW receive task), payload after any target mask
+void handleCommandFragment(uint8_t sender, uint8_t target, const uint8_t *payload, size_t length) {
+  wcb_fragment_header header;
+  if (length < sizeof(header)) {
+    fragmentStats.malformed++;
+    return;
+  }
+  memcpy(&header, payload, sizeof(header));
+  const uint8_t *piece = payload + sizeof(header);
+  size_t pieceLength = length - sizeof(header);
+
+  if (header.count == 0 || header.count > FRAGMENT_MAX_COUNT || header.index >= header.count ||
+      header.total == 0 || header.total > FRAGMENT_MAX_MESSAGE || header.offset + pieceLength > header.total) {
+    fragmentStats.malformed++;
+    return;
+  }
+
+  ReassemblySlot *slot = findReassemblySlot(sender, header, millis());
+  if (slot->count != header.count || slot->total != header.total) {
+    // Same message number, different command: the sender rebooted, start over
+    fragmentStats.malformed++;
+    slot->count = header.count;
+    slot->total = header.total;
+    slot->received = 0;
+  }
+
+  uint16_t bit = 1 << header.index;
+  if (slot->received & bit) return;     // Retransmitted piece
+  memcpy(slot->data + header.offset, piece, pieceLength);
+  slot->received |= bit;
+
+  if (slot->received != (uint16_t)((1UL << slot->count) - 1)) return;
+  slot->used = false;
+  fragmentStats.reassembled++;
+  handleESPNowCommand(sender, target, slot->data, slot->total);
+}
+
+void printFragmentStats() {
+  FragmentStats stats = fragmentStats;
+  Serial.println("--------------- Fragmentation ----------------------");
+  Serial.printf("Commands sent in fragments %lu (%lu frames), reassembled %lu\n",
+                (unsigned long)stats.fragmented, (unsigned long)stats.fragmentsSent, (unsigned long)stats.reassembled);
+  Serial.printf("Reassembly timeouts %lu, evicted %lu, malformed fragments %lu.  Largest frame %u bytes\n",
+                (unsigned long)stats.timeouts, (unsigned long)stats.evicted, (unsigned long)stats.malformed,
+                (unsigned)WCB_FRAME_BUFFER_SIZE);
+}
@@ -0,0 +1,49 @@
+#ifndef WCB_FRAGMENT_H
+#define WCB_FRAGMENT_H
+
+#include <Arduino.h>
+#include "WCB_Frame.h"
+#include "WCB_CommandPool.h"
+
+// =============== Command Fragmentation ===============
+// A command longer than one frame (a stored macro can be up to 1 KB) is sent
+// as several COMMAND frames with WCB_FLAG_FRAGMENT.  Each one starts with a
+// fragment header, after the target mask of a multicast:
+//
+//   | message (2) | index (1) | count (1) | offset (2) | total (2) | piece ... |
+//
+// The receiver copies the pieces into a reassembly slot for (sender, message)
+// in whatever order they arrive and runs the command once every piece is in.
+// A slot that doesn't complete within FRAGMENT_TIMEOUT_MS is dropped; when all
+// slots are busy the oldest one makes room.  Every piece is its own frame, so
+// reliable delivery, the broadcast cache and mesh relaying work unchanged.
+
+#define FRAGMENT_SLOTS          4
+#define FRAGMENT_MAX_MESSAGE    (COMMAND_LARGE_SLOT_SIZE - 1)   // Longest command that can be reassembled
+#define FRAGMENT_MAX_COUNT      16
+#define FRAGMENT_TIMEOUT_MS     500
+
+typedef struct __attribute__((packed)) {
+  uint16_t message;       // Per-sender message number
+  uint8_t index;
+  uint8_t count;
+  uint16_t offset;        // Where the piece goes in the command
+  uint16_t total;         // Length of the whole command
+} wcb_fragment_header;
+
+typedef struct {
+  uint32_t fragmented;    // Commands sent in pieces
+  uint32_t fragmentsSent;
+  uint32_t reassembled;   // Commands put back together
+  uint32_t timeouts;      // Slots dropped because a piece never came
+  uint32_t evicted;       // Slots dropped to make room for a newer command
+  uint32_t malformed;     // Pieces that didn't fit the command they claimed to belong to
+} FragmentStats;
+
+// =============== Function Declarations ===============
+size_t commandPayloadLimit(uint8_t target);
+void sendFragmentedCommand(uint8_t target, uint8_t flags, const uint8_t *payload, size_t length, size_t maxPayload);
+void handleCommandFragment(uint8_t sender, uint8_t target, const uint8_t *payload, size_t length);
+void printFragmentStats();
+
+#endif
@@ -0,0 +1,101 @@
+#include "WCB_Frame.h"
+#include <mbedtls/md.h>
+
+extern char espnowPassword[40];
+extern int WCB_Number;
+
+static uint16_t nextFrameSeq = 0;
+
+// Frames are built in loop(), the Kyber bridge task, the serial task (tunnel data) and the ESP-NOW
+// receive task (ACKs); a sequence number handed out twice makes the broadcast cache drop a new broadcast
+static portMUX_TYPE frameSeqMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Truncated HMAC-SHA256 of header + payload, keyed with the ESP-NOW password
+static void computeFrameTag(const uint8_t *data, size_t len, uint8_t *tag) {
+  uint8_t digest[32];
+  mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                  (const unsigned char *)espnowPassword, strlen(espnowPassword),
+                  data, len, digest);
+  memcpy(tag, digest, WCB_FRAME_TAG_SIZE);
+}
+
+// Random start so other WCBs don't mistake our broadcasts for ones they saw before we rebooted
+void initWCBFrameSequence() {
+  nextFrameSeq = esp_random();
+}
+
+// Builds a frame into out (at least WCB_FRAME_BUFFER_SIZE bytes).  Returns the number of bytes to send,
+// 0 if the payload doesn't fit in a frame: the caller has to fragment it, a cut off command must never run.
+size_t buildWCBFrame(uint8_t *out, uint8_t type, uint8_t flags, uint8_t target,
+                     const uint8_t *payload, size_t length) {
+  portENTER_CRITICAL(&frameSeqMux);
+  uint16_t seq = nextFrameSeq++;
+  portEXIT_CRITICAL(&frameSeqMux);
+  return buildWCBFrameWithSeq(out, type, flags, target, seq, payload, length);
+}
+
+static size_t writeWCBFrame(uint8_t *out, const wcb_frame_header &header, const uint8_t *payload) {
+  memcpy(out, &header, sizeof(header));
+  memcpy(out + sizeof(header), payload, header.length);
+  size_t signedLength = sizeof(header) + header.length;
+  computeFrameTag(out, signedLength, out + signedLength);
+  return signedLength + WCB_FRAME_TAG_SIZE;
+}
+
+// Same as buildWCBFrame() for callers that keep their own sequence numbers (reliable unicast)
+size_t buildWCBFrameWithSeq(uint8_t *out, uint8_t type, uint8_t flags, uint8_t target, uint16_t seq,
+                            const uint8_t *payload, size_t length) {
+  if (length > WCB_FRAME_BUFFER_PAYLOAD) return 0;
+
+  wcb_frame_header header;
+  header.magic = WCB_FRAME_MAGIC;
+  header.version = WCB_FRAME_VERSION;
+  header.type = type;
+  header.flags = flags;
+  header.ttl = WCB_FRAME_DEFAULT_TTL;
+  header.sender = WCB_Number;
+  header.target = target;
+  header.seq = seq;
+  header.length = length;
+  return writeWCBFrame(out, header, payload);
+}
+
+// Copy of a received frame with one hop less to live, signed again for the next hop
+size_t buildRelayedWCBFrame(uint8_t *out, const wcb_frame &frame) {
+  wcb_frame_header header = frame.header;
+  header.ttl--;
+  return writeWCBFrame(out, header, frame.payload);
+}
+
+// Cheap check used to tell new frames from legacy espnow_struct_message frames
+bool isWCBFrame(const uint8_t *data, size_t len) {
+  return len >= WCB_FRAME_OVERHEAD && data[0] == WCB_FRAME_MAGIC;
+}
+
+// Validates version, length and authentication tag.  Returns false for anything that should be dropped.
+bool parseWCBFrame(const uint8_t *data, size_t len, wcb_frame *frame) {
+  if (!isWCBFrame(data, len)) return false;
+
+  memcpy(&frame->header, data, sizeof(frame->header));
+  if (frame->header.version != WCB_FRAME_VERSION) return false;
+  if (sizeof(wcb_frame_header) + frame->header.length + WCB_FRAME_TAG_SIZE != len) return false;
+
+  size_t signedLength = sizeof(wcb_frame_header) + frame->header.length;
+  uint8_t expectedTag[WCB_FRAME_TAG_SIZE];
+  computeFrameTag(data, signedLength, expectedTag);
+  if (memcmp(expectedTag, data + signedLength, WCB_FRAME_TAG_SIZE) != 0) return false;
+
+  if ((frame->header.flags & WCB_FLAG_MULTICAST) &&
+      (frame->header.target != 0 || frame->header.length < WCB_MULTICAST_MASK_SIZE)) return false;
+
+  frame->payload = data + sizeof(wcb_frame_header);
+  return true;
+}
+
+// WCBs a frame is for, bit n = WCBn
+uint16_t wcbFrameTargets(const wcb_frame &frame) {
+  if (frame.header.flags & WCB_FLAG_MULTICAST) {
+    return frame.payload[0] | (frame.payload[1] << 8);
+  }
+  return frame.header.target == 0 ? WCB_TARGETS_ALL : (1 << frame.header.target);
+}
@@ -0,0 +1,92 @@
+#ifndef WCB_FRAME_H
+#define WCB_FRAME_H
+
+#include <Arduino.h>
+#include <esp_now.h>
+
+// =============== Compact ESP-NOW Frame ===============
+// Frames on air are a small binary header, a variable-length payload and a
+// 32-bit authentication tag instead of the fixed 249-byte espnow_struct_message.
+//
+//   | magic | version | type | flags | ttl | sender | target | seq (2) | length (2) | payload ... | tag (4) |
+//
+// The tag is a truncated HMAC-SHA256 over header and payload keyed with the
+// ESP-NOW password, so the password itself never goes over the air.  sender
+// and target are the original sender and final target; a WCB relaying the
+// frame (see WCB_Mesh.h) only lowers ttl and signs it again.
+
+#define WCB_FRAME_MAGIC        0xC5    // Never a valid first byte of a legacy (ASCII password) frame
+#define WCB_FRAME_VERSION      2
+#define WCB_FRAME_TAG_SIZE     4
+#define WCB_FRAME_MAX_SIZE     250     // ESP_NOW_MAX_DATA_LEN, what every WCB can receive
+#define WCB_FRAME_DEFAULT_TTL  4       // Hops a frame may take to reach its target
+
+// Frame types
+#define WCB_FRAME_COMMAND      1       // Payload is a command string (no null terminator)
+#define WCB_FRAME_RAW          2       // Payload is raw bridged serial data (Kyber)
+#define WCB_FRAME_ACK          3       // Acknowledges the reliable frame with the same seq, no payload
+#define WCB_FRAME_ROUTE        4       // Mesh beacon: the sender's routes to every WCB, never relayed
+#define WCB_FRAME_TUNNEL       5       // Serial tunnel data or ACK (see WCB_Tunnel.h)
+#define WCB_FRAME_SUBSCRIBE    6       // Broadcast: command prefixes the sender consumes (see WCB_Subscribe.h)
+#define WCB_FRAME_TIME         7       // Broadcast: network time beacon, not forwarded by the mesh (see WCB_TimeSync.h)
+
+// Frame flags
+#define WCB_FLAG_RELIABLE      0x01    // seq is a per-peer sequence number and the target answers with an ACK
+#define WCB_FLAG_BATCH         0x02    // COMMAND payload is a list of length-prefixed commands (see WCB_Coalesce.h)
+#define WCB_FLAG_MULTICAST     0x04    // Broadcast whose payload starts with a target mask, see below
+#define WCB_FLAG_FRAGMENT      0x08    // COMMAND payload is one piece of a longer command (see WCB_Fragment.h)
+
+// A multicast frame is a broadcast (target 0) for a set of WCBs.  Its payload
+// starts with a 16-bit mask, bit n = WCBn, so a receiver that isn't in the set
+// drops it straight after parsing the header.  Relays forward it like any
+// broadcast, whether or not they are in the set.
+#define WCB_MULTICAST_MASK_SIZE  2
+#define WCB_TARGETS_ALL          0x03FE  // WCB1-WCB9
+
+typedef struct __attribute__((packed)) {
+  uint8_t  magic;
+  uint8_t  version;
+  uint8_t  type;
+  uint8_t  flags;
+  uint8_t  ttl;        // Hops left, a relay drops the frame instead of forwarding it with ttl 0
+  uint8_t  sender;     // WCB number of the original sender (1-9)
+  uint8_t  target;     // WCB number of the target (1-9), 0 = broadcast
+  uint16_t seq;        // Per-sender sequence number
+  uint16_t length;     // Payload length in bytes
+} wcb_frame_header;
+
+#define WCB_FRAME_OVERHEAD     (sizeof(wcb_frame_header) + WCB_FRAME_TAG_SIZE)
+#define WCB_FRAME_MAX_PAYLOAD  (WCB_FRAME_MAX_SIZE - WCB_FRAME_OVERHEAD)
+
+// ESP-NOW v2 (ESP-IDF 5.4, Arduino core 3.2) frames carry up to 1470 bytes.
+// Set WCB_ESPNOW_V2 to 1 to size the transmit and receive buffers for them
+// (about 70 KB more RAM); long commands to WCBs that advertise v2 support then
+// go out in a single frame.  Everything else stays within WCB_FRAME_MAX_SIZE.
+#ifndef WCB_ESPNOW_V2
+#define WCB_ESPNOW_V2          0
+#endif
+#if WCB_ESPNOW_V2 && defined(ESP_NOW_MAX_DATA_LEN_V2)
+#define WCB_FRAME_BUFFER_SIZE  ESP_NOW_MAX_DATA_LEN_V2
+#else
+#define WCB_FRAME_BUFFER_SIZE  WCB_FRAME_MAX_SIZE
+#endif
+#define WCB_FRAME_BUFFER_PAYLOAD  (WCB_FRAME_BUFFER_SIZE - WCB_FRAME_OVERHEAD)
+
+// A decoded frame.  payload points into the buffer that was parsed.
+typedef struct {
+  wcb_frame_header header;
+  const uint8_t *payload;
+} wcb_frame;
+
+// =============== Function Declarations ===============
+void initWCBFrameSequence();
+size_t buildWCBFrame(uint8_t *out, uint8_t type, uint8_t flags, uint8_t target,
+                     const uint8_t *payload, size_t length);
+size_t buildWCBFrameWithSeq(uint8_t *out, uint8_t type, uint8_t flags, uint8_t target, uint16_t seq,
+                            const uint8_t *payload, size_t length);
+size_t buildRelayedWCBFrame(uint8_t *out, const wcb_frame &frame);
+bool isWCBFrame(const uint8_t *data, size_t len);
+bool parseWCBFrame(const uint8_t *data, size_t len, wcb_frame *frame);
+uint16_t wcbFrameTargets(const wcb_frame &frame);
+
+#endif
@@ -0,0 +1,68 @@
+#include "WCB_Groups.h"
+#include "WCB_Frame.h"
+
+WCBGroup wcbGroups[WCB_MAX_GROUPS];
+uint8_t wcbGroupCount = 0;
+
+// Groups are only used and changed from loop()
+
+// The inside of {...}: a comma separated list of WCB numbers or a group name.  Returns 0 if it's neither.
+uint16_t parseWCBTargetSet(const char *set, size_t length) {
+  if (length == 0) return 0;
+
+  if (set[0] >= '0' && set[0] <= '9') {
+    uint16_t targets = 0;
+    for (size_t i = 0; i < length; i += 2) {
+      int wcb = set[i] - '0';
+      if (wcb < 1 || wcb > 9 || (i + 1 < length && set[i + 1] != ',')) return 0;
+      targets |= 1 << wcb;
+    }
+    return targets;
+  }
+
+  for (uint8_t g = 0; g < wcbGroupCount; g++) {
+    if (strlen(wcbGroups[g].name) == length && strncasecmp(wcbGroups[g].name, set, length) == 0) {
+      return wcbGroups[g].targets;
+    }
+  }
+  return 0;
+}
+
+// Adds a group or changes the WCBs of an existing one.  Returns false if the table is full.
+bool setWCBGroup(const char *name, uint16_t targets) {
+  size_t length = strlen(name);
+  if (length == 0 || length > WCB_GROUP_NAME_MAX || (targets & WCB_TARGETS_ALL) == 0) return false;
+
+  WCBGroup *group = nullptr;
+  for (uint8_t g = 0; g < wcbGroupCount && !group; g++) {
+    if (strcasecmp(wcbGroups[g].name, name) == 0) group = &wcbGroups[g];
+  }
+  if (!group) {
+    if (wcbGroupCount == WCB_MAX_GROUPS) return false;
+    group = &wcbGroups[wcbGroupCount++];
+    strcpy(group->name, name);
+  }
+  group->targets = targets & WCB_TARGETS_ALL;
+  return true;
+}
+
+bool removeWCBGroup(const char *name) {
+  for (uint8_t g = 0; g < wcbGroupCount; g++) {
+    if (strcasecmp(wcbGroups[g].name, name) == 0) {
+      memmove(&wcbGroups[g], &wcbGroups[g + 1], (wcbGroupCount - g - 1) * sizeof(WCBGroup));
+      wcbGroupCount--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void printWCBGroups() {
+  for (uint8_t g = 0; g < wcbGroupCount; g++) {
+    Serial.printf("WCB group \"%s\":", wcbGroups[g].name);
+    for (int wcb = 1; wcb <= 9; wcb++) {
+      if (wcbGroups[g].targets & (1 << wcb)) Serial.printf(" WCB%d", wcb);
+    }
+    Serial.println();
+  }
+}
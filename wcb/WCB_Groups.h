@@ -0,0 +1,34 @@
+#ifndef WCB_GROUPS_H
+#define WCB_GROUPS_H
+
+#include <Arduino.h>
+
+// =============== WCB Groups ===============
+// ;W{2,4,7}cmd sends cmd to WCB2, WCB4 and WCB7 in one multicast frame
+// (WCB_FLAG_MULTICAST) instead of three unicasts.  Sets used often can be
+// stored as named groups and addressed the same way:
+//
+//   ?GROUPdome,2,4,7       store the group "dome"
+//   ;W{dome}:S1:PP100      send to every WCB in it
+//
+// Multicast frames aren't acknowledged, so with ?ERELIABLE1 a set still goes
+// out as one reliable unicast per WCB.
+
+#define WCB_MAX_GROUPS        8
+#define WCB_GROUP_NAME_MAX    11      // Characters in a group name
+
+typedef struct {
+  char name[WCB_GROUP_NAME_MAX + 1];
+  uint16_t targets;       // Bit n = WCBn
+} WCBGroup;
+
+extern WCBGroup wcbGroups[WCB_MAX_GROUPS];
+extern uint8_t wcbGroupCount;
+
+// =============== Function Declarations ===============
+uint16_t parseWCBTargetSet(const char *set, size_t length);
+bool setWCBGroup(const char *name, uint16_t targets);
+bool removeWCBGroup(const char *name);
+void printWCBGroups();
+
+#endif
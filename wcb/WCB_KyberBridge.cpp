@@ -0,0 +1,160 @@
+#include "WCB_KyberBridge.h"
+#include "WCB_Frame.h"
+#include "WCB_SerialTx.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+extern bool Kyber_Local;
+extern bool Kyber_Remote;
+extern int Kyber_Peer;
+extern unsigned long baudRates[5];
+extern void sendESPNowRaw(uint8_t target, const uint8_t *data, size_t len);
+
+static TaskHandle_t kyberBridgeTaskHandle = nullptr;
+static volatile uint32_t portEventUs[3];      // micros() of the last UART event, by port
+
+static KyberBridgeStats uplinkStats = {};     // UART -> air
+static KyberBridgeStats downlinkStats = {};   // air -> UART
+static portMUX_TYPE bridgeStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Throughput is reported over the time since the previous ?stats
+static uint32_t lastPrintMs = 0;
+static uint32_t lastPrintUplinkBytes = 0;
+static uint32_t lastPrintDownlinkBytes = 0;
+
+static void recordBridgePacket(KyberBridgeStats &stats, size_t len, uint32_t latencyUs) {
+  portENTER_CRITICAL(&bridgeStatsMux);
+  stats.packets++;
+  stats.bytes += len;
+  stats.latencyTotalUs += latencyUs;
+  if (latencyUs > stats.latencyMaxUs) stats.latencyMaxUs = latencyUs;
+  portEXIT_CRITICAL(&bridgeStatsMux);
+}
+
+// Runs in the UART event task
+static void notifyKyberBridge(int port) {
+  portEventUs[port] = micros();
+  if (kyberBridgeTaskHandle) {
+    xTaskNotify(kyberBridgeTaskHandle, 1UL << port, eSetBits);
+  }
+}
+
+// Forward everything waiting on a bridged port
+static void forwardBridgePort(HardwareSerial &serial, int port) {
+  uint8_t buffer[WCB_FRAME_MAX_PAYLOAD];
+  uint32_t charUs = 10000000UL / baudRates[port - 1];
+
+  // The event fired after the idle gap (or on a full FIFO), so the first byte arrived about this long ago
+  size_t waiting = serial.available();
+  uint32_t firstByteUs = portEventUs[port] - waiting * charUs;
+  if (waiting < KYBER_BRIDGE_FIFO_FULL) {
+    firstByteUs -= KYBER_BRIDGE_IDLE_SYMBOLS * charUs;
+  }
+
+  size_t len;
+  while ((len = serial.read(buffer, sizeof(buffer))) > 0) {
+    if (Kyber_Local && port == 2) {
+      // Kyber to the local Maestro and to the remote ones
+      queueSerialWrite(1, buffer, len, false);
+      sendESPNowRaw(Kyber_Peer, buffer, len);
+      recordBridgePacket(uplinkStats, len, micros() - firstByteUs);
+    } else if (Kyber_Local && port == 1) {
+      // Local Maestro replies to the Kyber
+      queueSerialWrite(2, buffer, len, false);
+    } else if (Kyber_Remote && port == 1) {
+      // Remote Maestro replies to the Kyber board
+      sendESPNowRaw(Kyber_Peer, buffer, len);
+      recordBridgePacket(uplinkStats, len, micros() - firstByteUs);
+    }
+    // Anything still waiting arrived after the event, so it is younger
+    firstByteUs = micros();
+  }
+}
+
+static void kyberBridgeTask(void *pvParameters) {
+  // Pick up anything that arrived before the callbacks were attached
+  uint32_t ports = (1UL << 1) | (1UL << 2);
+
+  while (true) {
+    if (ports & (1UL << 2)) forwardBridgePort(Serial2, 2);
+    if (ports & (1UL << 1)) forwardBridgePort(Serial1, 1);
+
+    ports = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &ports, portMAX_DELAY);
+  }
+}
+
+// Bridged bytes from another WCB (ESP-NOW receive task)
+void kyberBridgeReceive(const uint8_t *data, size_t len, uint32_t receivedAtUs) {
+  bool queued;
+  if (Kyber_Local) {
+    queued = queueSerialWrite(1, data, len, false);
+    queued &= queueSerialWrite(2, data, len, false);
+  } else if (Kyber_Remote) {
+    queued = queueSerialWrite(1, data, len, false);
+  } else {
+    return;
+  }
+
+  if (!queued) {
+    portENTER_CRITICAL(&bridgeStatsMux);
+    downlinkStats.dropped++;
+    portEXIT_CRITICAL(&bridgeStatsMux);
+    return;
+  }
+  recordBridgePacket(downlinkStats, len, micros() - receivedAtUs);
+}
+
+void initKyberBridge() {
+  if (!Kyber_Local && !Kyber_Remote) return;
+
+  xTaskCreatePinnedToCore(kyberBridgeTask, "Kyber Bridge Task", 4096, NULL, 2, &kyberBridgeTaskHandle, 1);
+
+  Serial1.setRxFIFOFull(KYBER_BRIDGE_FIFO_FULL);
+  Serial1.setRxTimeout(KYBER_BRIDGE_IDLE_SYMBOLS);
+  Serial1.onReceive([]() { notifyKyberBridge(1); }, true);
+  if (Kyber_Local) {
+    Serial2.setRxFIFOFull(KYBER_BRIDGE_FIFO_FULL);
+    Serial2.setRxTimeout(KYBER_BRIDGE_IDLE_SYMBOLS);
+    Serial2.onReceive([]() { notifyKyberBridge(2); }, true);
+  }
+  lastPrintMs = millis();
+  if (Kyber_Peer == 0) {
+    Serial.printf("Kyber bridge started (%s), sending to all WCBs\n", Kyber_Local ? "local" : "remote");
+  } else {
+    Serial.printf("Kyber bridge started (%s), sending to WCB%d\n", Kyber_Local ? "local" : "remote", Kyber_Peer);
+  }
+}
+
+static void printBridgeDirection(const char *name, const KyberBridgeStats &stats, uint32_t bytesSinceLast, uint32_t elapsedMs) {
+  Serial.printf("%s: %lu packets, %lu bytes", name, (unsigned long)stats.packets, (unsigned long)stats.bytes);
+  if (elapsedMs > 0) {
+    Serial.printf(", %lu bytes/s", (unsigned long)((uint64_t)bytesSinceLast * 1000 / elapsedMs));
+  }
+  if (stats.packets > 0) {
+    Serial.printf(", latency avg %lu us max %lu us",
+                  (unsigned long)(stats.latencyTotalUs / stats.packets), (unsigned long)stats.latencyMaxUs);
+  }
+  if (stats.dropped > 0) {
+    Serial.printf(", %lu dropped", (unsigned long)stats.dropped);
+  }
+  Serial.println();
+}
+
+void printKyberBridgeStats() {
+  if (!Kyber_Local && !Kyber_Remote) return;
+
+  portENTER_CRITICAL(&bridgeStatsMux);
+  KyberBridgeStats uplink = uplinkStats;
+  KyberBridgeStats downlink = downlinkStats;
+  portEXIT_CRITICAL(&bridgeStatsMux);
+
+  uint32_t now = millis();
+  uint32_t elapsedMs = now - lastPrintMs;
+  Serial.println("--------------- Kyber Bridge ----------------------");
+  printBridgeDirection("UART -> air", uplink, uplink.bytes - lastPrintUplinkBytes, elapsedMs);
+  printBridgeDirection("air -> UART", downlink, downlink.bytes - lastPrintDownlinkBytes, elapsedMs);
+  lastPrintMs = now;
+  lastPrintUplinkBytes = uplink.bytes;
+  lastPrintDownlinkBytes = downlink.bytes;
+}
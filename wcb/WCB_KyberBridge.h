@@ -0,0 +1,36 @@
+#ifndef WCB_KYBERBRIDGE_H
+#define WCB_KYBERBRIDGE_H
+
+#include <Arduino.h>
+
+// =============== Kyber / Maestro Bridge ===============
+// Bytes from the Kyber (Serial2 on the Kyber_Local board) and from the Maestro
+// (Serial1) are forwarded as soon as the UART reports them instead of being
+// polled every few milliseconds.  The UART raises its receive event when the
+// line has been quiet for KYBER_BRIDGE_IDLE_SYMBOLS character times or its FIFO
+// holds KYBER_BRIDGE_FIFO_FULL bytes, so one Kyber/Maestro packet normally
+// becomes one ESP-NOW frame.  Frames go to the paired WCB (?KYBER_PEERx) or to
+// every WCB when no peer is set.
+//
+// Latency is measured per direction:
+//   UART -> air:  estimated arrival of the first byte at the UART until the
+//                 frame is handed to ESP-NOW
+//   air -> UART:  frame received by the radio until it is queued for the port
+
+#define KYBER_BRIDGE_IDLE_SYMBOLS   2       // Quiet character times that end a packet
+#define KYBER_BRIDGE_FIFO_FULL      120     // Bytes in the UART FIFO that flush a long packet early
+
+typedef struct {
+  uint32_t packets;
+  uint32_t bytes;
+  uint64_t latencyTotalUs;
+  uint32_t latencyMaxUs;
+  uint32_t dropped;                 // Packets that didn't fit a serial transmit ring
+} KyberBridgeStats;
+
+// =============== Function Declarations ===============
+void initKyberBridge();
+void kyberBridgeReceive(const uint8_t *data, size_t len, uint32_t receivedAtUs);
+void printKyberBridgeStats();
+
+#endif
@@ -0,0 +1,484 @@
+#include "WCB_Macro.h"
+#include "WCB_CommandPool.h"
+#include "WCB_Trace.h"
+
+extern char CommandCharacter;
+extern char LocalFunctionIdentifier;
+extern char commandDelimiter;
+extern int Default_WCB_Quantity;
+extern bool debugEnabled;
+extern void writeSerialString(int port, const char *stringData);
+extern void sendESPNowMessage(uint8_t target, const char *message);
+extern void handleSingleCommand(const char *cmd, int sourceID);
+extern void enqueueCommand(const char *cmd, size_t length, int sourceID, uint32_t traceId);
+
+// Instructions are an opcode byte and its operands.  Numbers are little endian;
+// text is a 16 bit length and the characters, with parameter n stored as
+// MACRO_TEXT_PARAM and the byte n.  Stored commands are C strings, so a NUL
+// never comes from the text itself and every other byte is copied as it is.
+#define MACRO_OP_END        0
+#define MACRO_OP_RUN        1     // text                       handleSingleCommand() right away
+#define MACRO_OP_QUEUE      2     // text                       enqueueCommand()
+#define MACRO_OP_PORT       3     // port, text                 ;S
+#define MACRO_OP_WCB        4     // wcb, text                  ;W
+#define MACRO_OP_WAIT       5     // value                      ;D
+#define MACRO_OP_REPEAT     6     // value, end                 ;R<n>
+#define MACRO_OP_NEXT       7     //                            ;R
+#define MACRO_OP_SET        8     // variable, operator, value  ;V
+#define MACRO_OP_IF         9     // variable, operator, value, end   ;I ... ;I
+
+// A value is MACRO_VALUE_LITERAL and 4 bytes, or a parameter number 1-9
+#define MACRO_VALUE_LITERAL 0
+#define MACRO_TEXT_PARAM    0
+
+// Only used from loop()
+static int32_t macroVariables[26];
+static MacroStats macroStats = {};
+static char macroText[COMMAND_LARGE_SLOT_SIZE];   // A text operand with its parameters filled in
+
+typedef struct {
+  uint8_t *code;
+  size_t capacity;
+  size_t length;
+  bool overflow;
+  uint8_t depth;
+  struct {
+    char type;              // 'R' or 'I'
+    uint16_t endOperand;    // Where the end of the block gets patched in
+  } blocks[MACRO_MAX_DEPTH];
+} MacroCompiler;
+
+static void emitByte(MacroCompiler &compiler, uint8_t value) {
+  if (compiler.length >= compiler.capacity) {
+    compiler.overflow = true;
+    return;
+  }
+  compiler.code[compiler.length++] = value;
+}
+
+static void emitU16(MacroCompiler &compiler, uint16_t value) {
+  emitByte(compiler, value & 0xFF);
+  emitByte(compiler, value >> 8);
+}
+
+static void patchU16(MacroCompiler &compiler, uint16_t at, uint16_t value) {
+  if (at + 2 > compiler.length) return;
+  compiler.code[at] = value & 0xFF;
+  compiler.code[at + 1] = value >> 8;
+}
+
+// Length of the parameter reference at text ($n or ${n}), its number in *param, or 0 if there is none.
+// $n followed by another digit is text, so Marcduino sounds like $12 stay as they are; ${1}2 is $1 and a 2.
+static size_t parseParam(const char *text, size_t length, uint8_t *param) {
+  if (length >= 4 && text[0] == '$' && text[1] == '{' && text[2] >= '1' && text[2] <= '9' && text[3] == '}') {
+    *param = text[2] - '0';
+    return 4;
+  }
+  if (length >= 2 && text[0] == '$' && text[1] >= '1' && text[1] <= '9' && (length == 2 || !isdigit((unsigned char)text[2]))) {
+    *param = text[1] - '0';
+    return 2;
+  }
+  return 0;
+}
+
+// Text operand, with its parameter references
+static void emitText(MacroCompiler &compiler, const char *text, size_t length) {
+  uint16_t lengthAt = compiler.length;
+  emitU16(compiler, 0);
+  uint16_t start = compiler.length;
+  for (size_t i = 0; i < length; i++) {
+    uint8_t param;
+    size_t paramLength = parseParam(text + i, length - i, &param);
+    if (paramLength > 0) {
+      emitByte(compiler, MACRO_TEXT_PARAM);
+      emitByte(compiler, param);
+      i += paramLength - 1;
+    } else {
+      emitByte(compiler, text[i]);
+    }
+  }
+  patchU16(compiler, lengthAt, compiler.length - start);
+}
+
+// A number, or $1-$9 (${1}-${9}) when params is set
+static bool parseValue(const char *text, size_t length, bool params, bool *isParam, int32_t *value) {
+  uint8_t param;
+  if (params && parseParam(text, length, &param) == length) {
+    *isParam = true;
+    *value = param;
+    return true;
+  }
+  size_t i = (length > 0 && text[0] == '-') ? 1 : 0;
+  if (i == length) return false;
+  int32_t result = 0;
+  for (; i < length; i++) {
+    if (!isdigit((unsigned char)text[i])) return false;
+    result = result * 10 + (text[i] - '0');
+  }
+  *isParam = false;
+  *value = (text[0] == '-') ? -result : result;
+  return true;
+}
+
+static bool emitValue(MacroCompiler &compiler, const char *text, size_t length) {
+  bool isParam;
+  int32_t value;
+  if (!parseValue(text, length, true, &isParam, &value)) return false;
+  if (isParam) {
+    emitByte(compiler, value);
+    return true;
+  }
+  emitByte(compiler, MACRO_VALUE_LITERAL);
+  for (int i = 0; i < 4; i++) emitByte(compiler, (uint32_t)value >> (8 * i));
+  return true;
+}
+
+static bool compileError(const char *step, size_t length, const char *reason) {
+  Serial.printf("Can't compile '%.*s': %s\n", (int)length, step, reason);
+  return false;
+}
+
+// x=5 for ;V and ;I.  operators lists what may follow the variable.
+static bool emitVariableStep(MacroCompiler &compiler, const char *arg, size_t length, const char *operators) {
+  if (length < 3 || !isalpha((unsigned char)arg[0]) || !strchr(operators, arg[1])) return false;
+  emitByte(compiler, tolower((unsigned char)arg[0]) - 'a');
+  emitByte(compiler, arg[1]);
+  return emitValue(compiler, arg + 2, length - 2);
+}
+
+static bool openBlock(MacroCompiler &compiler, char type, const char *step, size_t length) {
+  if (compiler.depth >= MACRO_MAX_DEPTH) return compileError(step, length, "blocks nested too deep");
+  compiler.blocks[compiler.depth].type = type;
+  compiler.blocks[compiler.depth].endOperand = compiler.length;
+  compiler.depth++;
+  emitU16(compiler, 0);
+  return true;
+}
+
+static bool closeBlock(MacroCompiler &compiler, char type, const char *step, size_t length) {
+  if (compiler.depth == 0 || compiler.blocks[compiler.depth - 1].type != type) {
+    return compileError(step, length, "no block to close");
+  }
+  compiler.depth--;
+  if (type == 'R') emitByte(compiler, MACRO_OP_NEXT);
+  patchU16(compiler, compiler.blocks[compiler.depth].endOperand, compiler.length);
+  return true;
+}
+
+static bool compileStep(MacroCompiler &compiler, const char *step, size_t length) {
+  if (step[0] == LocalFunctionIdentifier) {
+    emitByte(compiler, MACRO_OP_QUEUE);
+    emitText(compiler, step, length);
+    return true;
+  }
+
+  const char *arg = step + 2;
+  size_t argLength = length >= 2 ? length - 2 : 0;
+  char letter = (step[0] == CommandCharacter && length >= 2) ? tolower((unsigned char)step[1]) : '\0';
+  switch (letter) {
+    case 'd':
+      emitByte(compiler, MACRO_OP_WAIT);
+      return emitValue(compiler, arg, argLength) || compileError(step, length, "use ;D<ms>");
+
+    case 'r':
+      if (argLength == 0) return closeBlock(compiler, 'R', step, length);
+      emitByte(compiler, MACRO_OP_REPEAT);
+      if (!emitValue(compiler, arg, argLength)) return compileError(step, length, "use ;R<count> ... ;R");
+      return openBlock(compiler, 'R', step, length);
+
+    case 'i':
+      if (argLength == 0) return closeBlock(compiler, 'I', step, length);
+      emitByte(compiler, MACRO_OP_IF);
+      if (!emitVariableStep(compiler, arg, argLength, "=!<>")) return compileError(step, length, "use ;Ix=5 ... ;I");
+      return openBlock(compiler, 'I', step, length);
+
+    case 'v':
+      emitByte(compiler, MACRO_OP_SET);
+      return emitVariableStep(compiler, arg, argLength, "=+-") || compileError(step, length, "use ;Vx=5, ;Vx+1 or ;Vx-1");
+
+    case 's':
+      // Anything but ports 1-5 is left to processSerialMessage() to complain about
+      if (argLength >= 1 && arg[0] >= '1' && arg[0] <= '5') {
+        const char *text = arg + 1;
+        size_t textLength = argLength - 1;
+        while (textLength > 0 && isspace((unsigned char)*text)) { text++; textLength--; }
+        emitByte(compiler, MACRO_OP_PORT);
+        emitByte(compiler, arg[0] - '0');
+        emitText(compiler, text, textLength);
+        return true;
+      }
+      break;
+
+    case 'w':
+      // ;W{...} multicasts go through forwardWCBMessage()
+      if (argLength >= 1 && arg[0] >= '1' && arg[0] <= '9') {
+        emitByte(compiler, MACRO_OP_WCB);
+        emitByte(compiler, arg[0] - '0');
+        emitText(compiler, arg + 1, argLength - 1);
+        return true;
+      }
+      break;
+
+    case 'c':
+      emitByte(compiler, MACRO_OP_QUEUE);
+      emitText(compiler, step, length);
+      return true;
+  }
+
+  emitByte(compiler, MACRO_OP_RUN);
+  emitText(compiler, step, length);
+  return true;
+}
+
+// Compile delimited commands into code.  Prints why and returns false if they don't compile.
+bool compileMacro(const char *text, size_t length, uint8_t *code, size_t capacity, size_t *codeLength) {
+  MacroCompiler compiler = {};
+  compiler.code = code;
+  compiler.capacity = capacity;
+
+  size_t start = 0;
+  while (start <= length) {
+    const char *delim = (const char *)memchr(text + start, commandDelimiter, length - start);
+    size_t end = delim ? (size_t)(delim - text) : length;
+    size_t first = start;
+    size_t last = end;
+    while (first < last && isspace((unsigned char)text[first])) first++;
+    while (last > first && isspace((unsigned char)text[last - 1])) last--;
+    if (last > first && !compileStep(compiler, text + first, last - first)) return false;
+    if (!delim) break;
+    start = end + 1;
+  }
+
+  if (compiler.depth > 0) {
+    Serial.printf("Can't compile: ;%c block not closed\n", compiler.blocks[compiler.depth - 1].type);
+    return false;
+  }
+  emitByte(compiler, MACRO_OP_END);
+  if (compiler.overflow) {
+    Serial.printf("Can't compile: macro longer than %d bytes\n", (int)capacity);
+    return false;
+  }
+  *codeLength = compiler.length;
+  return true;
+}
+
+// Split the recall parameters, "100, 200" -> $1 = 100, $2 = 200
+void beginMacro(MacroState &state, const char *params) {
+  memset(&state, 0, sizeof(state));
+  size_t length = strnlen(params, MACRO_PARAMS_MAX);
+  size_t start = 0;
+  while (start < length && state.paramCount < MACRO_MAX_PARAMS) {
+    const char *comma = (const char *)memchr(params + start, ',', length - start);
+    size_t end = comma ? (size_t)(comma - params) : length;
+    size_t first = start;
+    size_t last = end;
+    while (first < last && isspace((unsigned char)params[first])) first++;
+    while (last > first && isspace((unsigned char)params[last - 1])) last--;
+    state.paramStart[state.paramCount] = first;
+    state.paramLength[state.paramCount] = last - first;
+    state.paramCount++;
+    if (!comma) break;
+    start = end + 1;
+  }
+  macroStats.runs++;
+}
+
+static uint16_t readU16(const uint8_t *code, uint16_t &pc) {
+  uint16_t value = code[pc] | (code[pc + 1] << 8);
+  pc += 2;
+  return value;
+}
+
+static int32_t readValue(const MacroState &state, const uint8_t *code, const char *params, uint16_t &pc) {
+  uint8_t kind = code[pc++];
+  if (kind == MACRO_VALUE_LITERAL) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= (uint32_t)code[pc++] << (8 * i);
+    return (int32_t)value;
+  }
+  if (kind > state.paramCount) return 0;
+  return strtol(params + state.paramStart[kind - 1], nullptr, 10);
+}
+
+// Text operand into macroText, parameters filled in.  Returns its length.
+static size_t readText(const MacroState &state, const uint8_t *code, const char *params, uint16_t &pc) {
+  uint16_t length = readU16(code, pc);
+  size_t out = 0;
+  for (uint16_t i = 0; i < length; i++) {
+    const char *insert = (const char *)&code[pc + i];
+    size_t insertLength = 1;
+    char unset[2];
+    if (code[pc + i] == MACRO_TEXT_PARAM && i + 1 < length) {
+      uint8_t param = code[pc + ++i];
+      if (param <= state.paramCount) {
+        insert = params + state.paramStart[param - 1];
+        insertLength = state.paramLength[param - 1];
+      } else {
+        unset[0] = '$';
+        unset[1] = '0' + param;
+        insert = unset;
+        insertLength = 2;
+      }
+    }
+    if (out + insertLength >= sizeof(macroText)) break;
+    memcpy(macroText + out, insert, insertLength);
+    out += insertLength;
+  }
+  macroText[out] = '\0';
+  pc += length;
+  return out;
+}
+
+static bool compareVariable(int32_t variable, char oper, int32_t value) {
+  switch (oper) {
+    case '=': return variable == value;
+    case '!': return variable != value;
+    case '<': return variable < value;
+    case '>': return variable > value;
+  }
+  return false;
+}
+
+// Runs from state.pc until the macro waits (returns true with *waitMs set) or ends (returns false)
+bool runMacro(MacroState &state, const uint8_t *code, size_t length, const char *params, int sourceID, uint32_t *waitMs) {
+  uint16_t steps = 0;
+  while (state.pc < length) {
+    if (++steps > MACRO_MAX_STEPS) {
+      macroStats.aborted++;
+      Serial.printf("Macro stopped after %d steps without a wait!\n", MACRO_MAX_STEPS);
+      return false;
+    }
+    macroStats.steps++;
+
+    uint8_t op = code[state.pc++];
+    switch (op) {
+      case MACRO_OP_RUN:
+        readText(state, code, params, state.pc);
+        handleSingleCommand(macroText, sourceID);
+        macroStats.emitted++;
+        break;
+
+      case MACRO_OP_QUEUE: {
+        size_t textLength = readText(state, code, params, state.pc);
+        enqueueCommand(macroText, textLength, sourceID, currentTraceId());
+        macroStats.emitted++;
+        break;
+      }
+
+      case MACRO_OP_PORT: {
+        uint8_t port = code[state.pc++];
+        readText(state, code, params, state.pc);
+        writeSerialString(port, macroText);
+        macroStats.emitted++;
+        if (debugEnabled) { Serial.printf("Sent to Serial%d: %s\n", port, macroText); }
+        break;
+      }
+
+      case MACRO_OP_WCB: {
+        uint8_t wcb = code[state.pc++];
+        size_t textLength = readText(state, code, params, state.pc);
+        if (wcb > Default_WCB_Quantity) {
+          Serial.println("Invalid WCB number for unicast.");
+          break;
+        }
+        uint32_t traceId = currentTraceId();
+        char tag[TRACE_TAG_MAX];
+        size_t tagLength = traceId ? formatTraceTag(traceId, tag) : 0;
+        if (tagLength > 0 && tagLength + textLength < sizeof(macroText)) {
+          memmove(macroText + tagLength, macroText, textLength + 1);
+          memcpy(macroText, tag, tagLength);
+          traceEvent(traceId, TRACE_ESPNOW_QUEUED, wcb);
+        }
+        sendESPNowMessage(wcb, macroText);
+        macroStats.emitted++;
+        if (debugEnabled) { Serial.printf("Sent unicast ESP-NOW message to WCB%d: %s\n", wcb, macroText); }
+        break;
+      }
+
+      case MACRO_OP_WAIT: {
+        int32_t ms = readValue(state, code, params, state.pc);
+        if (ms > 0) {
+          *waitMs = ms;
+          return true;
+        }
+        break;
+      }
+
+      case MACRO_OP_REPEAT: {
+        int32_t count = readValue(state, code, params, state.pc);
+        uint16_t end = readU16(code, state.pc);
+        if (count <= 0 || state.depth >= MACRO_MAX_DEPTH) {
+          state.pc = end;
+          break;
+        }
+        state.loops[state.depth].start = state.pc;
+        state.loops[state.depth].remaining = count;
+        state.depth++;
+        break;
+      }
+
+      case MACRO_OP_NEXT:
+        if (state.depth > 0 && --state.loops[state.depth - 1].remaining > 0) {
+          state.pc = state.loops[state.depth - 1].start;
+        } else if (state.depth > 0) {
+          state.depth--;
+        }
+        break;
+
+      case MACRO_OP_SET: {
+        uint8_t variable = code[state.pc++];
+        char oper = code[state.pc++];
+        int32_t value = readValue(state, code, params, state.pc);
+        if (oper == '+') macroVariables[variable] += value;
+        else if (oper == '-') macroVariables[variable] -= value;
+        else macroVariables[variable] = value;
+        break;
+      }
+
+      case MACRO_OP_IF: {
+        uint8_t variable = code[state.pc++];
+        char oper = code[state.pc++];
+        int32_t value = readValue(state, code, params, state.pc);
+        uint16_t end = readU16(code, state.pc);
+        if (!compareVariable(macroVariables[variable], oper, value)) state.pc = end;
+        break;
+      }
+
+      default:    // MACRO_OP_END
+        return false;
+    }
+  }
+  return false;
+}
+
+// ;Vx=5, ;Vx+1 or ;Vx-1 outside a macro.  message starts at the V.
+void setMacroVariable(const char *message) {
+  bool isParam;
+  int32_t value;
+  size_t length = strlen(message);
+  if (length < 4 || !isalpha((unsigned char)message[1]) || !strchr("=+-", message[2]) ||
+      !parseValue(message + 3, length - 3, false, &isParam, &value)) {
+    Serial.println("Invalid variable command.  Use ;Vx=5, ;Vx+1 or ;Vx-1 with a variable a-z.");
+    return;
+  }
+  int32_t &variable = macroVariables[tolower((unsigned char)message[1]) - 'a'];
+  if (message[2] == '+') variable += value;
+  else if (message[2] == '-') variable -= value;
+  else variable = value;
+  if (debugEnabled) { Serial.printf("Variable %c = %ld\n", tolower((unsigned char)message[1]), (long)variable); }
+}
+
+void printMacroStats() {
+  Serial.println("--------------- Macros ----------------------");
+  Serial.print("Variables:");
+  bool any = false;
+  for (int i = 0; i < 26; i++) {
+    if (macroVariables[i] == 0) continue;
+    Serial.printf(" %c=%ld", 'a' + i, (long)macroVariables[i]);
+    any = true;
+  }
+  Serial.println(any ? "" : " all 0");
+  Serial.printf("Runs %lu, steps %lu, commands sent %lu, stopped for too many steps %lu\n",
+                (unsigned long)macroStats.runs, (unsigned long)macroStats.steps,
+                (unsigned long)macroStats.emitted, (unsigned long)macroStats.aborted);
+}
@@ -0,0 +1,66 @@
+#ifndef WCB_MACRO_H
+#define WCB_MACRO_H
+
+#include <Arduino.h>
+
+// =============== Stored Command Macros ===============
+// A stored command is compiled into a small bytecode when it is saved (and
+// when it is loaded at boot), so recalling it never splits, trims or matches
+// its text again.  Besides the commands it sends, a macro can:
+//
+//   ;D<ms>           wait, counted from when the previous wait ended
+//   ;R<n> ... ;R     repeat the steps in between n times
+//   ;Ix=5 ... ;I     only run the steps in between if variable x is 5
+//                    (also x!5, x<5, x>5)
+//   ;Vx=5            set variable x (also x+1, x-1); works as a plain command too
+//   $1 ... $9        parameters given on recall: ;Ckey,100,200
+//   ${1} ... ${9}    the same, where a digit follows: ${1}0 is $1 and a 0
+//
+//   ?CSwag,;R$1^:OP01^;D400^:CL01^;D400^;R
+//   ;Cwag,3          opens and closes the panel three times
+//
+// Variables are a-z, whole numbers, shared by all macros and cleared at boot.
+// Any count, time or value may be a parameter.  A $ and two or more digits is
+// never a parameter, so Marcduino sounds like $12 or $105 always go out as
+// they are; a $n the recall didn't give is sent as $n.  Blocks nest up to
+// MACRO_MAX_DEPTH deep.
+//
+// ;S and ;W steps are written to their port or WCB by the interpreter.  Other
+// commands run right away, in order, except ?commands and ;C recalls, which
+// are queued like any other command so a macro can't change the stored
+// commands under itself or recall itself forever.  Waits hand the macro to the
+// sequencer (WCB_Sequencer.h).
+
+#define MACRO_CODE_MAX          768     // Compiled size limit, also what a waiting sequence keeps a copy of
+#define MACRO_PARAMS_MAX        128     // Parameter text given on recall
+#define MACRO_MAX_PARAMS        9
+#define MACRO_MAX_DEPTH         4       // Nested ;R and ;I blocks
+#define MACRO_MAX_STEPS         256     // Steps run without a wait before a macro is stopped
+
+typedef struct {
+  uint16_t pc;
+  uint8_t depth;                        // Repeats being run
+  struct {
+    uint16_t start;
+    int32_t remaining;
+  } loops[MACRO_MAX_DEPTH];
+  uint8_t paramCount;
+  uint8_t paramStart[MACRO_MAX_PARAMS];   // Into the parameter text
+  uint8_t paramLength[MACRO_MAX_PARAMS];
+} MacroState;
+
+typedef struct {
+  uint32_t runs;
+  uint32_t steps;           // Instructions run
+  uint32_t emitted;         // Commands sent or queued
+  uint32_t aborted;         // Macros stopped for running too many steps without a wait
+} MacroStats;
+
+// =============== Function Declarations ===============
+bool compileMacro(const char *text, size_t length, uint8_t *code, size_t capacity, size_t *codeLength);
+void beginMacro(MacroState &state, const char *params);
+bool runMacro(MacroState &state, const uint8_t *code, size_t length, const char *params, int sourceID, uint32_t *waitMs);
+void setMacroVariable(const char *message);
+void printMacroStats();
+
+#endif
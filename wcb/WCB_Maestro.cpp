@@ -1,8 +1,8 @@
 #include "WCB_Maestro.h"
+#include "WCB_SerialTx.h"
 
 extern bool maestroEnabled;
 extern int WCB_Number;
-extern bool lastReceivedViaESPNOW;
 extern void sendESPNowMessage(uint8_t target, const char *message);
 
 
@@ -11,14 +11,12 @@ void sendMaestroCommand(uint8_t maestroID, uint8_t scriptNumber) {
   // 0xAA, <maestroID>, 0x27, <scriptNumber>
   if (maestroID == WCB_Number || maestroID == 9){
     uint8_t command[] = {0xAA, WCB_Number, 0x27, scriptNumber};
-    Serial1.write(command, sizeof(command));
-    Serial1.flush();
+    queueSerialWrite(1, command, sizeof(command), false);
     Serial.printf("Sent Maestro Command to ID %d, Script %d\n", maestroID, scriptNumber);
   // return;
   } else if (maestroID == 0){
     uint8_t command[] = {0xAA, WCB_Number, 0x27, scriptNumber};
-    Serial1.write(command, sizeof(command));
-    Serial1.flush();
+    queueSerialWrite(1, command, sizeof(command), false);
     Serial.printf("Sent Maestro Command to ID %d, Script %d\n", maestroID, scriptNumber);
     Serial.println("Setup ESPNOW Broadcast");
     String temp_espnowmessage = ";M" + String(9) + String(scriptNumber);
@@ -29,49 +27,41 @@ void sendMaestroCommand(uint8_t maestroID, uint8_t scriptNumber) {
     String temp_espnowmessage = ";M" + String(maestroID) + String(scriptNumber);
     Serial.println(temp_espnowmessage);
     Serial.println("Inside Maestro 1");
-    // lastReceivedViaESPNOW = false;
     sendESPNowMessage(1,temp_espnowmessage.c_str());
   } else if (maestroID == 2 ) {
     String temp_espnowmessage = ";M" + String(maestroID) + String(scriptNumber);
     Serial.println(temp_espnowmessage);
     Serial.println("Inside Maestro 2");
-    // lastReceivedViaESPNOW = false;
     sendESPNowMessage(2,temp_espnowmessage.c_str());
   } else if (maestroID == 3 ) {
     String temp_espnowmessage = ";M" + String(maestroID) + String(scriptNumber);
     Serial.println(temp_espnowmessage);
     Serial.println("Inside Maestro 3");
-    // lastReceivedViaESPNOW = false;
     sendESPNowMessage(3,temp_espnowmessage.c_str());
   } else if (maestroID == 4 ) {
     String temp_espnowmessage = ";M" + String(maestroID) + String(scriptNumber);
     Serial.println(temp_espnowmessage);
     Serial.println("Inside Maestro 4");
-    // lastReceivedViaESPNOW = false;
     sendESPNowMessage(4,temp_espnowmessage.c_str());
   } else if (maestroID == 5 ) {
     String temp_espnowmessage = ";M" + String(maestroID) + String(scriptNumber);
     Serial.println(temp_espnowmessage);
     Serial.println("Inside Maestro 5");
-    // lastReceivedViaESPNOW = false;
     sendESPNowMessage(5,temp_espnowmessage.c_str());
   } else if (maestroID == 6 ) {
     String temp_espnowmessage = ";M" + String(maestroID) + String(scriptNumber);
     Serial.println(temp_espnowmessage);
     Serial.println("Inside Maestro 6");
-    // lastReceivedViaESPNOW = false;
     sendESPNowMessage(6,temp_espnowmessage.c_str());
   } else if (maestroID == 7 ) {
     String temp_espnowmessage = ";M" + String(maestroID) + String(scriptNumber);
     Serial.println(temp_espnowmessage);
     Serial.println("Inside Maestro 7");
-    // lastReceivedViaESPNOW = false;
     sendESPNowMessage(7,temp_espnowmessage.c_str());
   } else if (maestroID == 8 ) {
     String temp_espnowmessage = ";M" + String(maestroID) + String(scriptNumber);
     Serial.println(temp_espnowmessage);
     Serial.println("Inside Maestro 8");
-    // lastReceivedViaESPNOW = false;
     sendESPNowMessage(8,temp_espnowmessage.c_str());
   }
 }
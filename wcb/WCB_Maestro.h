@@ -5,7 +5,6 @@
 // #include <Preferences.h>
 
 extern bool maestroEnabled;
-extern bool lastReceivedViaESPNOW;
 
 void sendMaestroCommand(uint8_t maestroID, uint8_t scriptNumber);
 
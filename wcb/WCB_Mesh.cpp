@@ -0,0 +1,293 @@
+#include "WCB_Mesh.h"
+#include "WCB_TxQueue.h"
+
+extern uint8_t WCBMacAddresses[9][6];
+extern uint8_t broadcastMACAddress[1][6];
+extern int WCB_Number;
+extern bool debugEnabled;
+extern bool espnowLegacyFrames;
+
+typedef struct {
+  uint8_t origin;
+  uint8_t target;
+  uint8_t type;
+  uint8_t ttl;              // ttl we forwarded the frame with
+  uint16_t seq;
+  uint32_t relayedAt;
+} MeshRelayEntry;
+
+static MeshNeighbor meshNeighbors[MESH_MAX_WCBS];
+static MeshStats meshStats = {};
+static uint32_t lastBeaconMs = 0;
+
+// Only the ESP-NOW receive task relays, so the relay cache needs no lock
+static MeshRelayEntry relayCache[MESH_RELAY_CACHE_SIZE];
+static uint8_t nextRelayEntry = 0;
+
+// Neighbour state is updated by the receive task and the Wi-Fi task and read by everyone sending
+static portMUX_TYPE meshMux = portMUX_INITIALIZER_UNLOCKED;
+
+// WCB MACs are 02:oct2:oct3:00:00:N, returns N or 0 if mac isn't one of our WCBs
+int wcbNumberFromMac(const uint8_t *mac) {
+  int number = mac[5];
+  if (number < 1 || number > MESH_MAX_WCBS) return 0;
+  return memcmp(mac, WCBMacAddresses[number - 1], 6) == 0 ? number : 0;
+}
+
+// Cost of the direct link to a neighbour.  Called with meshMux held.
+static uint16_t linkCost(const MeshNeighbor &neighbor, uint32_t now) {
+  if (!neighbor.heard || now - neighbor.lastHeardMs > MESH_LINK_TIMEOUT_MS) return MESH_COST_UNREACHABLE;
+  if (neighbor.delivery < MESH_MIN_DELIVERY) return MESH_COST_UNREACHABLE;
+
+  // MESH_HOP_COST for a link that delivers everything, growing as sends fail
+  uint16_t cost = (MESH_HOP_COST * 256) / neighbor.delivery;
+  if (neighbor.rssi < -85) {
+    cost += MESH_HOP_COST;
+  } else if (neighbor.rssi < -75) {
+    cost += MESH_HOP_COST / 2;
+  }
+  return cost;
+}
+
+static bool advertFresh(const MeshNeighbor &neighbor, uint32_t now) {
+  return neighbor.advertValid && now - neighbor.advertAtMs <= MESH_LINK_TIMEOUT_MS;
+}
+
+// Cheapest route to target.  Returns the next hop (0 = no route).  Called with meshMux held.
+static uint8_t bestRoute(uint8_t target, uint32_t now, uint16_t *costOut) {
+  if (target == WCB_Number) {
+    *costOut = 0;
+    return target;
+  }
+
+  uint16_t best = linkCost(meshNeighbors[target - 1], now);
+  uint8_t hop = (best < MESH_COST_UNREACHABLE) ? target : 0;
+
+  for (int n = 1; n <= MESH_MAX_WCBS; n++) {
+    if (n == target || n == WCB_Number) continue;
+    const MeshNeighbor &neighbor = meshNeighbors[n - 1];
+    uint16_t toNeighbor = linkCost(neighbor, now);
+    if (toNeighbor >= MESH_COST_UNREACHABLE || !advertFresh(neighbor, now)) continue;
+
+    uint8_t advertised = neighbor.advertCost[target - 1];
+    // Split horizon: a route that goes back through us is no route at all
+    if (advertised >= MESH_COST_UNREACHABLE || neighbor.advertNextHop[target - 1] == WCB_Number) continue;
+
+    uint16_t cost = toNeighbor + advertised;
+    if (cost < best) {
+      best = cost;
+      hop = n;
+    }
+  }
+
+  *costOut = best;
+  return hop;
+}
+
+// Any authenticated frame heard directly from a neighbour (ESP-NOW receive task)
+void meshRecordReceive(const uint8_t *mac, int8_t rssi) {
+  int number = wcbNumberFromMac(mac);
+  if (number == 0) return;
+
+  portENTER_CRITICAL(&meshMux);
+  MeshNeighbor &neighbor = meshNeighbors[number - 1];
+  if (!neighbor.heard) {
+    neighbor.heard = true;
+    neighbor.rssi = rssi;
+    neighbor.delivery = 256;
+  } else {
+    neighbor.rssi = (neighbor.rssi * 3 + rssi) / 4;
+    // Hearing them at all says the link works, slowly forgive earlier send failures
+    neighbor.delivery += (256 - neighbor.delivery) / 16;
+  }
+  neighbor.lastHeardMs = millis();
+  portEXIT_CRITICAL(&meshMux);
+}
+
+// Driver send status of a unicast to a neighbour (Wi-Fi task)
+void meshRecordSendStatus(const uint8_t *mac, bool success) {
+  int number = wcbNumberFromMac(mac);
+  if (number == 0) return;
+
+  portENTER_CRITICAL(&meshMux);
+  MeshNeighbor &neighbor = meshNeighbors[number - 1];
+  if (neighbor.heard) {
+    if (success) {
+      neighbor.delivery += (256 - neighbor.delivery) / 8;
+    } else {
+      neighbor.delivery -= neighbor.delivery / 8;
+    }
+  }
+  portEXIT_CRITICAL(&meshMux);
+}
+
+// Beacon payload: cost and next hop for WCB1..WCB9
+void meshHandleBeacon(const uint8_t *mac, const wcb_frame &frame) {
+  int number = wcbNumberFromMac(mac);
+  // Beacons are never relayed, so they must come from the WCB that built them
+  if (number == 0 || number != frame.header.sender || frame.header.length != 2 * MESH_MAX_WCBS) return;
+
+  portENTER_CRITICAL(&meshMux);
+  MeshNeighbor &neighbor = meshNeighbors[number - 1];
+  for (int i = 0; i < MESH_MAX_WCBS; i++) {
+    neighbor.advertCost[i] = frame.payload[2 * i];
+    neighbor.advertNextHop[i] = frame.payload[2 * i + 1];
+  }
+  neighbor.advertValid = true;
+  neighbor.advertAtMs = millis();
+  meshStats.beaconsReceived++;
+  portEXIT_CRITICAL(&meshMux);
+}
+
+// WCB to hand a frame for target to.  Falls back to target itself while nothing better is known.
+uint8_t meshNextHop(uint8_t target) {
+  if (target < 1 || target > MESH_MAX_WCBS) return target;
+  uint16_t cost;
+  portENTER_CRITICAL(&meshMux);
+  uint8_t hop = bestRoute(target, millis(), &cost);
+  portEXIT_CRITICAL(&meshMux);
+  return hop ? hop : target;
+}
+
+// Re-broadcast only helps if the WCB we heard it from has a neighbour it can't reach directly but we can
+static bool broadcastNeedsRelay(int from) {
+  uint32_t now = millis();
+  bool needed = false;
+
+  portENTER_CRITICAL(&meshMux);
+  const MeshNeighbor &sender = meshNeighbors[from - 1];
+  if (advertFresh(sender, now)) {
+    for (int n = 1; n <= MESH_MAX_WCBS && !needed; n++) {
+      if (n == from || n == WCB_Number) continue;
+      needed = sender.advertNextHop[n - 1] != n &&
+               linkCost(meshNeighbors[n - 1], now) < MESH_COST_UNREACHABLE;
+    }
+  }
+  portEXIT_CRITICAL(&meshMux);
+  return needed;
+}
+
+// True if this unicast frame already went through us and came back around a loop
+static bool relayLooped(const wcb_frame_header &header) {
+  uint32_t now = millis();
+  for (int i = 0; i < MESH_RELAY_CACHE_SIZE; i++) {
+    MeshRelayEntry &entry = relayCache[i];
+    if (entry.origin == header.sender && entry.target == header.target && entry.type == header.type &&
+        entry.seq == header.seq && now - entry.relayedAt < MESH_RELAY_CACHE_MS) {
+      // A copy that made more hops after us has a lower ttl; a retransmission from upstream doesn't
+      if (header.ttl <= entry.ttl) return true;
+      entry.ttl = header.ttl - 1;
+      entry.relayedAt = now;
+      return false;
+    }
+  }
+
+  MeshRelayEntry &entry = relayCache[nextRelayEntry];
+  entry.origin = header.sender;
+  entry.target = header.target;
+  entry.type = header.type;
+  entry.seq = header.seq;
+  entry.ttl = header.ttl - 1;
+  entry.relayedAt = now;
+  nextRelayEntry = (nextRelayEntry + 1) % MESH_RELAY_CACHE_SIZE;
+  return false;
+}
+
+// Forward a frame that isn't (only) for us.  mac is the neighbour we received it from.
+void relayWCBFrame(const uint8_t *mac, const wcb_frame &frame) {
+  const wcb_frame_header &header = frame.header;
+  int from = wcbNumberFromMac(mac);
+  if (from == 0) return;
+
+  if (header.ttl <= 1) {
+    meshStats.ttlExpired++;
+    return;
+  }
+
+  const uint8_t *nextMac;
+  if (header.target == 0) {
+    if (!broadcastNeedsRelay(from)) return;
+    nextMac = broadcastMACAddress[0];
+    meshStats.rebroadcast++;
+  } else {
+    if (relayLooped(header)) {
+      meshStats.loops++;
+      return;
+    }
+    uint8_t nextHop = meshNextHop(header.target);
+    if (nextHop == from) {
+      meshStats.noRoute++;
+      return;
+    }
+    nextMac = WCBMacAddresses[nextHop - 1];
+    meshStats.relayed++;
+    if (debugEnabled) {
+      Serial.printf("Relaying frame %u from WCB%d to WCB%d via WCB%d\n", header.seq, header.sender, header.target, nextHop);
+    }
+  }
+
+  uint8_t out[WCB_FRAME_BUFFER_SIZE];
+  size_t outLength = buildRelayedWCBFrame(out, frame);
+  queueESPNowSend(nextMac, out, outLength);
+}
+
+// Called from loop(): broadcast our routes every MESH_BEACON_INTERVAL_MS
+void serviceMesh() {
+  // Boards on the legacy format can't read beacons and we don't route legacy frames
+  if (espnowLegacyFrames) return;
+
+  uint32_t now = millis();
+  if (now - lastBeaconMs < MESH_BEACON_INTERVAL_MS) return;
+  lastBeaconMs = now;
+
+  uint8_t payload[2 * MESH_MAX_WCBS];
+  portENTER_CRITICAL(&meshMux);
+  for (int target = 1; target <= MESH_MAX_WCBS; target++) {
+    uint16_t cost;
+    uint8_t hop = bestRoute(target, now, &cost);
+    payload[2 * (target - 1)] = (hop == 0 || cost >= MESH_COST_UNREACHABLE) ? MESH_COST_UNREACHABLE : cost;
+    payload[2 * (target - 1) + 1] = hop;
+  }
+  meshStats.beaconsSent++;
+  portEXIT_CRITICAL(&meshMux);
+
+  uint8_t frame[WCB_FRAME_MAX_SIZE];
+  size_t frameLength = buildWCBFrame(frame, WCB_FRAME_ROUTE, 0, 0, payload, sizeof(payload));
+  queueESPNowSend(broadcastMACAddress[0], frame, frameLength);
+}
+
+void printMeshStats() {
+  Serial.println("--------------- Mesh Routes ----------------------");
+  uint32_t now = millis();
+  bool any = false;
+  for (int n = 1; n <= MESH_MAX_WCBS; n++) {
+    if (n == WCB_Number) continue;
+    portENTER_CRITICAL(&meshMux);
+    MeshNeighbor neighbor = meshNeighbors[n - 1];
+    uint16_t link = linkCost(neighbor, now);
+    uint16_t cost;
+    uint8_t hop = bestRoute(n, now, &cost);
+    portEXIT_CRITICAL(&meshMux);
+    if (!neighbor.heard && hop == 0) continue;
+    any = true;
+
+    Serial.printf("WCB%d: ", n);
+    if (link < MESH_COST_UNREACHABLE) {
+      Serial.printf("direct rssi %d dBm, delivery %d%%, cost %u", neighbor.rssi, neighbor.delivery * 100 / 256, link);
+    } else {
+      Serial.print("no direct link");
+    }
+    if (hop == 0) {
+      Serial.println(", unreachable");
+    } else {
+      Serial.printf(", route via WCB%d cost %u\n", hop, cost);
+    }
+  }
+  if (!any) {
+    Serial.println("No other WCBs heard yet.");
+  }
+  Serial.printf("Relayed %lu, rebroadcast %lu, ttl expired %lu, loops dropped %lu, no route %lu, beacons sent %lu received %lu\n",
+                (unsigned long)meshStats.relayed, (unsigned long)meshStats.rebroadcast, (unsigned long)meshStats.ttlExpired,
+                (unsigned long)meshStats.loops, (unsigned long)meshStats.noRoute,
+                (unsigned long)meshStats.beaconsSent, (unsigned long)meshStats.beaconsReceived);
+}
@@ -0,0 +1,63 @@
+#ifndef WCB_MESH_H
+#define WCB_MESH_H
+
+#include <Arduino.h>
+#include "WCB_Frame.h"
+
+// =============== Mesh Relaying ===============
+// WCBs that can't hear each other directly (dome vs. feet through the frame)
+// reach each other through a WCB in between.  Every WCB tracks the quality of
+// its direct links (RSSI of frames it hears, success rate of its own sends)
+// and broadcasts a beacon with its cheapest route to every WCB.  From its own
+// links and its neighbours' beacons it picks the next hop for each target
+// (distance vector, routes through ourselves are ignored).
+//
+// A unicast frame for another WCB is forwarded to the next hop with ttl - 1.
+// A relay remembers the ttl it forwarded each frame with, so a copy that comes
+// back around a loop (lower ttl) is dropped while a retransmission from the
+// sender (same or higher ttl) is forwarded again.  Broadcast commands are
+// re-broadcast once, and only when the WCB we heard them from has a neighbour
+// it can't reach directly; the broadcast message cache keeps every WCB from
+// running or relaying a broadcast twice.
+
+#define MESH_MAX_WCBS             9
+#define MESH_BEACON_INTERVAL_MS   2000
+#define MESH_LINK_TIMEOUT_MS      (3 * MESH_BEACON_INTERVAL_MS)   // A neighbour not heard for this long is gone
+#define MESH_HOP_COST             16      // Cost of one perfect hop
+#define MESH_COST_UNREACHABLE     255
+#define MESH_MIN_DELIVERY         32      // Delivery rate (of 256) below which a link isn't used
+#define MESH_RELAY_CACHE_SIZE     16      // Unicast frames remembered for loop detection
+#define MESH_RELAY_CACHE_MS       2000
+
+typedef struct {
+  bool heard;
+  uint32_t lastHeardMs;
+  int8_t rssi;                            // Smoothed RSSI of frames received from this neighbour
+  uint16_t delivery;                      // Smoothed share of our sends it received, 256 = all
+  bool advertValid;
+  uint32_t advertAtMs;
+  uint8_t advertCost[MESH_MAX_WCBS];      // Its route cost to every WCB
+  uint8_t advertNextHop[MESH_MAX_WCBS];   // and the next hop it uses
+} MeshNeighbor;
+
+typedef struct {
+  uint32_t relayed;         // Unicast frames forwarded
+  uint32_t rebroadcast;     // Broadcast commands forwarded
+  uint32_t ttlExpired;      // Frames dropped because they were out of hops
+  uint32_t loops;           // Frames dropped because they came back around a loop
+  uint32_t noRoute;         // Frames dropped because the only route led back to where they came from
+  uint32_t beaconsSent;
+  uint32_t beaconsReceived;
+} MeshStats;
+
+// =============== Function Declarations ===============
+int wcbNumberFromMac(const uint8_t *mac);
+void meshRecordReceive(const uint8_t *mac, int8_t rssi);
+void meshRecordSendStatus(const uint8_t *mac, bool success);
+void meshHandleBeacon(const uint8_t *mac, const wcb_frame &frame);
+uint8_t meshNextHop(uint8_t target);
+void relayWCBFrame(const uint8_t *mac, const wcb_frame &frame);
+void serviceMesh();
+void printMeshStats();
+
+#endif
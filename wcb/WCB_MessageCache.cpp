@@ -0,0 +1,33 @@
+#include "WCB_MessageCache.h"
+
+// Only the ESP-NOW receive task looks messages up, so the cache needs no lock
+static MessageCacheEntry messageCache[MESSAGE_CACHE_SIZE];
+static uint8_t nextCacheEntry = 0;     // Oldest entry, overwritten next
+static MessageCacheStats cacheStats = {};
+
+bool messageAlreadySeen(uint8_t origin, uint16_t seq) {
+  uint32_t now = millis();
+  cacheStats.checked++;
+
+  for (int i = 0; i < MESSAGE_CACHE_SIZE; i++) {
+    const MessageCacheEntry &entry = messageCache[i];
+    if (entry.origin == origin && entry.seq == seq &&
+        now - entry.seenAt < MESSAGE_CACHE_EXPIRY_MS) {
+      cacheStats.duplicates++;
+      return true;
+    }
+  }
+
+  MessageCacheEntry &entry = messageCache[nextCacheEntry];
+  entry.origin = origin;
+  entry.seq = seq;
+  entry.seenAt = now;
+  nextCacheEntry = (nextCacheEntry + 1) % MESSAGE_CACHE_SIZE;
+  return false;
+}
+
+void printMessageCacheStats() {
+  Serial.println("--------------- Broadcast Message Cache ----------------------");
+  Serial.printf("Broadcasts checked: %lu, duplicates dropped: %lu\n",
+                (unsigned long)cacheStats.checked, (unsigned long)cacheStats.duplicates);
+}
@@ -0,0 +1,32 @@
+#ifndef WCB_MESSAGECACHE_H
+#define WCB_MESSAGECACHE_H
+
+#include <Arduino.h>
+
+// =============== Broadcast Message Cache ===============
+// Every compact frame carries the WCB number it came from (origin) and that
+// sender's sequence number.  Together they identify one broadcast no matter
+// how many copies of it arrive.  Each WCB remembers the IDs it has recently
+// seen in a small fixed-size cache, so a broadcast is executed and forwarded
+// exactly once.  Entries expire after MESSAGE_CACHE_EXPIRY_MS so a sender that
+// rebooted and happens to reuse a sequence number is not ignored forever.
+
+#define MESSAGE_CACHE_SIZE        32      // Broadcast IDs remembered
+#define MESSAGE_CACHE_EXPIRY_MS   5000    // How long a broadcast ID is remembered
+
+typedef struct {
+  uint8_t  origin;        // WCB number the message originated from, 0 = unused entry
+  uint16_t seq;           // Origin's sequence number
+  uint32_t seenAt;        // millis() when the message was first seen
+} MessageCacheEntry;
+
+typedef struct {
+  uint32_t checked;       // Broadcasts looked up
+  uint32_t duplicates;    // Broadcasts dropped because they were already seen
+} MessageCacheStats;
+
+// =============== Function Declarations ===============
+bool messageAlreadySeen(uint8_t origin, uint16_t seq);   // Records the ID if it is new
+void printMessageCacheStats();
+
+#endif
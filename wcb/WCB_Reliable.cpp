@@ -0,0 +1,266 @@
+#include "WCB_Reliable.h"
+#include "WCB_Mesh.h"
+#include "WCB_TxQueue.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+extern uint8_t WCBMacAddresses[9][6];
+
+enum ReliableSlotState : uint8_t {
+  SLOT_FREE,
+  SLOT_SENDING,       // Handed to the driver, waiting for the send status
+  SLOT_AWAIT_ACK,     // Driver reported success, waiting for the peer's ACK
+  SLOT_RETRY,         // Send failed, retransmit as soon as possible
+  SLOT_ACKED          // ACK arrived before the send status, freed when the status comes in
+};
+
+typedef struct {
+  ReliableSlotState state;
+  uint8_t target;
+  uint8_t nextHop;          // WCB the frame was last handed to, may be a relay
+  uint8_t retries;
+  uint16_t seq;
+  uint16_t length;
+  uint32_t sendOrder;       // Cookie of the latest attempt, matches its send status to the slot
+  uint32_t firstSentUs;
+  uint32_t lastSentMs;
+  uint8_t frame[WCB_FRAME_BUFFER_SIZE];
+} ReliableSlot;
+
+// Receive side duplicate suppression, one per sender
+typedef struct {
+  bool valid;
+  uint16_t highest;         // Highest sequence number seen
+  uint32_t seen;            // Bit n set = highest - n was seen
+} ReliableDedup;
+
+static ReliableSlot reliableWindow[RELIABLE_WINDOW_SLOTS];
+static uint16_t nextPeerSeq[RELIABLE_MAX_PEERS];
+static uint32_t nextSendOrder = 0;
+static ReliablePeerStats reliablePeerStats[RELIABLE_MAX_PEERS];
+static ReliableDedup reliableDedup[RELIABLE_MAX_PEERS];
+
+// The window is touched by loop(), the ESP-NOW receive task, the Wi-Fi task and the reliable task
+static portMUX_TYPE reliableMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t reliableTaskHandle = nullptr;
+
+static uint32_t reliableTimeoutMs(uint8_t retries) {
+  return (uint32_t)RELIABLE_ACK_TIMEOUT_MS << retries;
+}
+
+// Send status of one of our frames (Wi-Fi task).  cookie is the sendOrder it was queued under,
+// so a status left over from an earlier attempt, or for another frame to the same peer, never lands on a slot.
+static void reliableFrameSent(uint32_t cookie, bool success, int64_t sentAtUs) {
+  bool wake = false;
+  portENTER_CRITICAL(&reliableMux);
+  for (int i = 0; i < RELIABLE_WINDOW_SLOTS; i++) {
+    ReliableSlot &slot = reliableWindow[i];
+    if ((slot.state != SLOT_SENDING && slot.state != SLOT_ACKED) || slot.sendOrder != cookie) continue;
+    if (slot.state == SLOT_ACKED) {
+      slot.state = SLOT_FREE;
+    } else if (success) {
+      slot.state = SLOT_AWAIT_ACK;
+    } else {
+      slot.state = SLOT_RETRY;
+      wake = true;
+    }
+    break;
+  }
+  portEXIT_CRITICAL(&reliableMux);
+
+  if (wake && reliableTaskHandle) {
+    xTaskNotifyGive(reliableTaskHandle);
+  }
+}
+
+// Hand a window slot to the driver.  Called with the slot already marked SLOT_SENDING under sendOrder.
+static void transmitReliableSlot(ReliableSlot &slot, uint32_t sendOrder) {
+  esp_err_t result = queueESPNowSendTimed(WCBMacAddresses[slot.nextHop - 1], slot.frame, slot.length,
+                                          reliableFrameSent, sendOrder);
+  if (result != ESP_OK) {
+    portENTER_CRITICAL(&reliableMux);
+    slot.state = SLOT_RETRY;
+    portEXIT_CRITICAL(&reliableMux);
+  }
+}
+
+bool sendReliableFrame(uint8_t target, uint8_t type, uint8_t flags, const uint8_t *payload, size_t length) {
+  if (target < 1 || target > RELIABLE_MAX_PEERS || length > WCB_FRAME_BUFFER_PAYLOAD) return false;
+  ReliablePeerStats &stats = reliablePeerStats[target - 1];
+  uint8_t nextHop = meshNextHop(target);   // Takes the mesh lock, so never under reliableMux
+
+  portENTER_CRITICAL(&reliableMux);
+  int freeSlot = -1;
+  int inFlight = 0;
+  for (int i = 0; i < RELIABLE_WINDOW_SLOTS; i++) {
+    if (reliableWindow[i].state == SLOT_FREE) {
+      if (freeSlot < 0) freeSlot = i;
+    } else if (reliableWindow[i].target == target) {
+      inFlight++;
+    }
+  }
+  if (freeSlot < 0 || inFlight >= RELIABLE_PEER_WINDOW) {
+    stats.windowFull++;
+    portEXIT_CRITICAL(&reliableMux);
+    return false;
+  }
+  ReliableSlot &slot = reliableWindow[freeSlot];
+  slot.state = SLOT_SENDING;
+  slot.target = target;
+  slot.nextHop = nextHop;
+  slot.retries = 0;
+  slot.seq = nextPeerSeq[target - 1]++;
+  uint32_t sendOrder = slot.sendOrder = nextSendOrder++;
+  slot.firstSentUs = micros();
+  slot.lastSentMs = millis();   // Keeps the retransmit timer off the slot until it has been sent
+  stats.sent++;
+  portEXIT_CRITICAL(&reliableMux);
+
+  // Only a timeout could touch this slot's frame before it is sent, so build it outside the lock
+  slot.length = buildWCBFrameWithSeq(slot.frame, type, flags | WCB_FLAG_RELIABLE, target, slot.seq, payload, length);
+  transmitReliableSlot(slot, sendOrder);
+  return true;
+}
+
+// ACK from the target (ESP-NOW receive task)
+void handleReliableAck(const wcb_frame_header &header) {
+  if (header.sender < 1 || header.sender > RELIABLE_MAX_PEERS) return;
+  ReliablePeerStats &stats = reliablePeerStats[header.sender - 1];
+
+  portENTER_CRITICAL(&reliableMux);
+  for (int i = 0; i < RELIABLE_WINDOW_SLOTS; i++) {
+    ReliableSlot &slot = reliableWindow[i];
+    if (slot.state != SLOT_FREE && slot.state != SLOT_ACKED &&
+        slot.target == header.sender && slot.seq == header.seq) {
+      uint32_t latency = micros() - slot.firstSentUs;
+      stats.delivered++;
+      stats.latencyTotalUs += latency;
+      if (latency > stats.latencyMaxUs) stats.latencyMaxUs = latency;
+      // A send status is still owed for a SENDING slot, keep it so the callback is matched correctly
+      slot.state = (slot.state == SLOT_SENDING) ? SLOT_ACKED : SLOT_FREE;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&reliableMux);
+}
+
+static void sendReliableAck(uint8_t target, uint16_t seq) {
+  uint8_t frame[WCB_FRAME_MAX_SIZE];
+  size_t frameLength = buildWCBFrameWithSeq(frame, WCB_FRAME_ACK, 0, target, seq, nullptr, 0);
+  queueESPNowSend(WCBMacAddresses[meshNextHop(target) - 1], frame, frameLength);
+}
+
+// Acknowledge a reliable frame addressed to us.  Returns false if it is a duplicate that must not be executed again.
+bool acceptReliableFrame(const wcb_frame_header &header) {
+  if (header.sender < 1 || header.sender > RELIABLE_MAX_PEERS) return false;
+
+  // Always ACK, the previous ACK may have been the one that got lost
+  sendReliableAck(header.sender, header.seq);
+
+  ReliableDedup &dedup = reliableDedup[header.sender - 1];
+  int16_t diff = (int16_t)(header.seq - dedup.highest);
+  if (!dedup.valid || diff <= -RELIABLE_DEDUP_WINDOW) {
+    // First frame from this sender, or so far behind that the sender must have restarted
+    dedup.valid = true;
+    dedup.highest = header.seq;
+    dedup.seen = 1;
+    return true;
+  }
+  if (diff > 0) {
+    dedup.seen = (diff >= RELIABLE_DEDUP_WINDOW) ? 1 : ((dedup.seen << diff) | 1);
+    dedup.highest = header.seq;
+    return true;
+  }
+
+  uint32_t bit = 1u << (-diff);
+  if (dedup.seen & bit) {
+    reliablePeerStats[header.sender - 1].duplicates++;
+    return false;
+  }
+  dedup.seen |= bit;
+  return true;
+}
+
+// Retransmits frames whose send failed or whose ACK timed out, gives up after RELIABLE_MAX_RETRIES
+static void reliableTask(void *pvParameters) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(5));
+    uint32_t now = millis();
+
+    for (int i = 0; i < RELIABLE_WINDOW_SLOTS; i++) {
+      ReliableSlot &slot = reliableWindow[i];
+      bool resend = false;
+      bool failed = false;
+      uint16_t seq = 0;
+      uint8_t target = 0;
+      uint32_t sendOrder = 0;
+
+      portENTER_CRITICAL(&reliableMux);
+      if (slot.state == SLOT_ACKED && now - slot.lastSentMs >= reliableTimeoutMs(RELIABLE_MAX_RETRIES)) {
+        // The send status never arrived, stop waiting for it
+        slot.state = SLOT_FREE;
+      }
+      bool due = slot.state == SLOT_RETRY ||
+                 ((slot.state == SLOT_SENDING || slot.state == SLOT_AWAIT_ACK) &&
+                  now - slot.lastSentMs >= reliableTimeoutMs(slot.retries));
+      if (due) {
+        if (slot.retries >= RELIABLE_MAX_RETRIES) {
+          seq = slot.seq;
+          target = slot.target;
+          reliablePeerStats[slot.target - 1].failed++;
+          slot.state = SLOT_FREE;
+          failed = true;
+        } else {
+          slot.retries++;
+          slot.state = SLOT_SENDING;
+          target = slot.target;
+          sendOrder = slot.sendOrder = nextSendOrder++;
+          slot.lastSentMs = now;
+          reliablePeerStats[slot.target - 1].retries++;
+          resend = true;
+        }
+      }
+      portEXIT_CRITICAL(&reliableMux);
+
+      if (resend) {
+        // The route may have changed since the last attempt.  The slot is ours until it is sent, like in sendReliableFrame()
+        slot.nextHop = meshNextHop(target);
+        transmitReliableSlot(slot, sendOrder);
+      } else if (failed) {
+        Serial.printf("Reliable send of seq %u to WCB%d failed after %d retries\n",
+                      seq, target, RELIABLE_MAX_RETRIES);
+      }
+    }
+  }
+}
+
+void initReliableUnicast() {
+  for (int i = 0; i < RELIABLE_MAX_PEERS; i++) {
+    // Random start so a peer doesn't mistake our frames for duplicates after we reboot
+    nextPeerSeq[i] = esp_random();
+  }
+  xTaskCreatePinnedToCore(reliableTask, "Reliable Unicast Task", 3072, NULL, 2, &reliableTaskHandle, 1);
+}
+
+void printReliableStats() {
+  Serial.println("--------------- Reliable Unicast ----------------------");
+  bool any = false;
+  for (int i = 0; i < RELIABLE_MAX_PEERS; i++) {
+    portENTER_CRITICAL(&reliableMux);
+    ReliablePeerStats stats = reliablePeerStats[i];
+    portEXIT_CRITICAL(&reliableMux);
+    if (stats.sent == 0 && stats.duplicates == 0) continue;
+    any = true;
+    Serial.printf("WCB%d: sent %lu, delivered %lu, retries %lu, failed %lu, window full %lu, duplicates in %lu",
+                  i + 1, (unsigned long)stats.sent, (unsigned long)stats.delivered, (unsigned long)stats.retries,
+                  (unsigned long)stats.failed, (unsigned long)stats.windowFull, (unsigned long)stats.duplicates);
+    if (stats.delivered > 0) {
+      Serial.printf(", latency avg %lu us max %lu us",
+                    (unsigned long)(stats.latencyTotalUs / stats.delivered), (unsigned long)stats.latencyMaxUs);
+    }
+    Serial.println();
+  }
+  if (!any) {
+    Serial.println("No reliable traffic yet.");
+  }
+}
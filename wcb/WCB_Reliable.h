@@ -0,0 +1,41 @@
+#ifndef WCB_RELIABLE_H
+#define WCB_RELIABLE_H
+
+#include <Arduino.h>
+#include "WCB_Frame.h"
+
+// =============== Reliable Unicast ===============
+// esp_now_send() returning ESP_OK only means the frame was queued.  In reliable
+// mode every unicast command carries a per-peer sequence number and is kept in
+// a small retransmit window until the target answers with an ACK frame.  A
+// failed send status from the driver triggers an immediate retransmit, a
+// missing ACK a retransmit after a timeout, up to RELIABLE_MAX_RETRIES times.
+// Receivers remember recently seen sequence numbers per sender so a
+// retransmitted command is acknowledged again but only executed once.
+
+#define RELIABLE_WINDOW_SLOTS    8       // Frames awaiting an ACK, shared by all peers
+#define RELIABLE_PEER_WINDOW     4       // Frames awaiting an ACK per peer
+#define RELIABLE_ACK_TIMEOUT_MS  25      // First retransmit timeout, doubled on every retry
+#define RELIABLE_MAX_RETRIES     5
+#define RELIABLE_DEDUP_WINDOW    32      // Sequence numbers remembered per sender
+#define RELIABLE_MAX_PEERS       9
+
+typedef struct {
+  uint32_t sent;              // Reliable frames handed to the window
+  uint32_t delivered;         // Frames acknowledged by the peer
+  uint32_t retries;           // Retransmissions
+  uint32_t failed;            // Frames given up on after RELIABLE_MAX_RETRIES
+  uint32_t windowFull;        // Frames sent best effort because the window was full
+  uint32_t duplicates;        // Duplicate frames received from this peer and suppressed
+  uint64_t latencyTotalUs;    // Sum of send-to-ACK times of delivered frames
+  uint32_t latencyMaxUs;
+} ReliablePeerStats;
+
+// =============== Function Declarations ===============
+void initReliableUnicast();
+bool sendReliableFrame(uint8_t target, uint8_t type, uint8_t flags, const uint8_t *payload, size_t length);
+void handleReliableAck(const wcb_frame_header &header);
+bool acceptReliableFrame(const wcb_frame_header &header);
+void printReliableStats();
+
+#endif
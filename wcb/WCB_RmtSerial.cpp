@@ -0,0 +1,257 @@
+#include "WCB_RmtSerial.h"
+#include <esp_timer.h>
+#include <hal/gpio_ll.h>
+#include <soc/gpio_struct.h>
+
+#define RMT_MAX_DURATION   32767     // Ticks in one half of an RMT symbol
+
+// =============== Decoder ===============
+
+void RmtSerialDecoder::begin(uint32_t baud) {
+  bitQ8 = (1000000UL << 8) / baud;
+  inFrame = false;
+  level = 1;
+  framingErrors = 0;
+}
+
+// Samples the bits of the current byte whose centre lies before time
+int RmtSerialDecoder::sampleUntil(uint32_t time, uint8_t *out) {
+  while (inFrame) {
+    uint32_t sampleAt = frameStart + (((2 * bitIndex + 1) * bitQ8) >> 9);
+    if ((int32_t)(time - sampleAt) <= 0) return 0;
+
+    if (bitIndex == 0) {
+      if (level != 0) {
+        inFrame = false;      // A glitch, not a start bit
+        return 0;
+      }
+    } else if (bitIndex <= 8) {
+      shift = (shift >> 1) | (level ? 0x80 : 0);
+    } else {
+      inFrame = false;
+      if (level) {
+        *out = shift;
+        return 1;
+      }
+      framingErrors++;
+      return 0;
+    }
+    bitIndex++;
+  }
+  return 0;
+}
+
+int RmtSerialDecoder::edge(uint32_t time, uint8_t newLevel, uint8_t *out) {
+  int count = sampleUntil(time, out);
+  level = newLevel;
+  if (!inFrame && level == 0) {
+    inFrame = true;
+    frameStart = time;
+    bitIndex = 0;
+  }
+  return count;
+}
+
+int RmtSerialDecoder::idle(uint32_t now, uint8_t *out) {
+  return sampleUntil(now, out);
+}
+
+// =============== Port ===============
+
+RmtSerial::RmtSerial() {}
+
+void RmtSerial::begin(uint32_t baud, int rxPin, int txPin) {
+  end();
+  if (baud == 0) return;
+  this->baud = baud;
+
+  if (txPin >= 0) {
+    pinMode(txPin, OUTPUT);
+    digitalWrite(txPin, HIGH);
+    if (rmtInit(txPin, RMT_TX_MODE, RMT_MEM_NUM_BLOCKS_1, RMT_SERIAL_TICK_HZ)) {
+      rmtSetEOT(txPin, HIGH);     // Idle high between transmissions
+      this->txPin = txPin;
+    } else {
+      Serial.printf("No RMT channel left for TX pin %d!\n", txPin);
+    }
+  }
+
+  if (rxPin >= 0) {
+    pinMode(rxPin, INPUT_PULLUP);
+    decoder.begin(baud);
+    edgeHead = 0;
+    edgeTail = 0;
+    rxHead = 0;
+    rxTail = 0;
+    this->rxPin = rxPin;
+    attachInterruptArg(rxPin, edgeISR, this, CHANGE);
+  }
+}
+
+void RmtSerial::end() {
+  if (rxPin >= 0) detachInterrupt(rxPin);
+  if (txPin >= 0) rmtDeinit(txPin);
+  rxPin = -1;
+  txPin = -1;
+}
+
+void RmtSerial::onReceive(std::function<void()> handler) {
+  receiveHandler = handler;
+}
+
+// Only stores the edge; decoding happens in the serial task.  The GPIO ISR service runs this even while
+// flash is busy (NVS writes), so it must not call anything in flash: no digitalRead(), the register is read inline.
+void IRAM_ATTR RmtSerial::edgeISR(void *arg) {
+  RmtSerial *serial = (RmtSerial *)arg;
+  uint32_t time = (uint32_t)esp_timer_get_time();
+  uint32_t head = serial->edgeHead;
+  if (head - serial->edgeTail >= RMT_SERIAL_EDGE_RING) {
+    serial->edgeOverruns++;
+    return;
+  }
+  Edge &edge = serial->edges[head & (RMT_SERIAL_EDGE_RING - 1)];
+  edge.time = time;
+  edge.level = gpio_ll_get_level(&GPIO, serial->rxPin);
+  serial->edgeHead = head + 1;
+}
+
+void RmtSerial::storeReceived(const uint8_t *bytes, int count) {
+  for (int i = 0; i < count; i++) {
+    if (rxHead - rxTail >= RMT_SERIAL_RX_BUFFER) {
+      serialStats.rxOverruns++;
+      continue;
+    }
+    rxBuffer[rxHead++ & (RMT_SERIAL_RX_BUFFER - 1)] = bytes[i];
+    serialStats.bytesReceived++;
+  }
+}
+
+void RmtSerial::decodeEdges() {
+  // Taken before looking at the ring so no edge older than now can still be missing
+  uint32_t now = (uint32_t)esp_timer_get_time() - RMT_SERIAL_IDLE_MARGIN_US;
+  uint32_t head = edgeHead;
+  uint8_t byte;
+  while (edgeTail != head) {
+    const Edge &edge = edges[edgeTail & (RMT_SERIAL_EDGE_RING - 1)];
+    storeReceived(&byte, decoder.edge(edge.time, edge.level, &byte));
+    edgeTail++;
+  }
+  storeReceived(&byte, decoder.idle(now, &byte));
+}
+
+void RmtSerial::perform_work() {
+  if (rxPin < 0) return;
+  decodeEdges();
+  if (rxHead != rxTail && receiveHandler) {
+    receiveHandler();
+  }
+}
+
+int RmtSerial::available() {
+  return rxHead - rxTail;
+}
+
+int RmtSerial::read() {
+  if (rxHead == rxTail) return -1;
+  return rxBuffer[rxTail++ & (RMT_SERIAL_RX_BUFFER - 1)];
+}
+
+int RmtSerial::peek() {
+  if (rxHead == rxTail) return -1;
+  return rxBuffer[rxTail & (RMT_SERIAL_RX_BUFFER - 1)];
+}
+
+// Adds a run of one level, split into as many half symbols as the RMT needs to count it
+static void addRun(rmt_data_t *symbols, size_t &halves, uint8_t level, uint32_t ticks) {
+  while (ticks > 0) {
+    uint32_t part = min(ticks, (uint32_t)RMT_MAX_DURATION);
+    rmt_data_t &symbol = symbols[halves / 2];
+    if (halves % 2 == 0) {
+      symbol.level0 = level;
+      symbol.duration0 = part;
+    } else {
+      symbol.level1 = level;
+      symbol.duration1 = part;
+    }
+    halves++;
+    ticks -= part;
+  }
+}
+
+size_t encodeRmtSerial(uint32_t baud, const uint8_t *buffer, size_t size, rmt_data_t *symbols, size_t maxSymbols,
+                       size_t &symbolCount) {
+  const size_t capacity = maxSymbols * 2 - 1;     // One half kept for padding
+  uint32_t ticksPerByte = (uint64_t)10 * RMT_SERIAL_TICK_HZ / baud;
+  size_t worstPerByte = 10 + 2 * (ticksPerByte / RMT_MAX_DURATION + 1);
+
+  // Edges fall on the tick nearest their bit boundary, counted from the start of the chunk
+  auto edgeTicks = [baud](uint32_t bit) { return (uint32_t)(((uint64_t)bit * RMT_SERIAL_TICK_HZ + baud / 2) / baud); };
+
+  size_t halves = 0;
+  size_t taken = 0;
+  uint32_t bit = 0;
+  uint32_t runStart = 0;
+  uint8_t runLevel = 0;
+  while (taken < size && halves + 2 * worstPerByte <= capacity) {
+    uint16_t frame = (buffer[taken++] << 1) | 0x200;     // Start bit 0, data LSB first, stop bit 1
+    for (int i = 0; i < 10; i++, bit++) {
+      uint8_t level = (frame >> i) & 1;
+      if (level != runLevel) {
+        addRun(symbols, halves, runLevel, edgeTicks(bit) - edgeTicks(runStart));
+        runStart = bit;
+        runLevel = level;
+      }
+    }
+  }
+  addRun(symbols, halves, runLevel, edgeTicks(bit) - edgeTicks(runStart));
+  if (halves % 2) {
+    addRun(symbols, halves, 1, 1);
+  }
+  symbolCount = halves / 2;
+  return taken;
+}
+
+int RmtSerial::availableForWrite() {
+  if (txPin >= 0 && !rmtTransmitCompleted(txPin)) return 0;
+  return RMT_SERIAL_TX_CHUNK;
+}
+
+// Starts one chunk if the channel is idle.  Returns the number of bytes taken, 0 while busy.
+size_t RmtSerial::write(const uint8_t *buffer, size_t size) {
+  if (txPin < 0) return size;       // Port not set up, the bytes go nowhere
+  if (size == 0 || !rmtTransmitCompleted(txPin)) return 0;
+
+  size_t symbolCount;
+  size_t taken = encodeRmtSerial(baud, buffer, size, txSymbols, RMT_SERIAL_TX_SYMBOLS, symbolCount);
+  if (!rmtWriteAsync(txPin, txSymbols, symbolCount)) return 0;
+  serialStats.bytesSent += taken;
+  return taken;
+}
+
+// Print's single bytes wait for the channel, like SoftwareSerial did
+size_t RmtSerial::write(uint8_t byte) {
+  while (write(&byte, 1) == 0) {
+    delay(1);
+  }
+  return 1;
+}
+
+void RmtSerial::flush() {
+  while (txPin >= 0 && !rmtTransmitCompleted(txPin)) {
+    delay(1);
+  }
+}
+
+RmtSerialStats RmtSerial::stats() const {
+  RmtSerialStats current = serialStats;
+  current.framingErrors = decoder.framingErrors;
+  current.edgeOverruns = edgeOverruns;
+  return current;
+}
+
+void printRmtSerialStats(int port, const RmtSerial &serial) {
+  RmtSerialStats stats = serial.stats();
+  Serial.printf("Serial%d: sent %lu, received %lu bytes.  Framing errors %lu, lost edges %lu, lost bytes %lu\n",
+                port, (unsigned long)stats.bytesSent, (unsigned long)stats.bytesReceived,
+                (unsigned long)stats.framingErrors, (unsigned long)stats.edgeOverruns, (unsigned long)stats.rxOverruns);
+}
@@ -0,0 +1,124 @@
+#ifndef WCB_RMTSERIAL_H
+#define WCB_RMTSERIAL_H
+
+#include <Arduino.h>
+#include <functional>
+
+// =============== Peripheral-driven Serial3-Serial5 ===============
+// SoftwareSerial bit-bangs every byte with interrupts off, which upsets
+// ESP-NOW and the hardware UARTs above 9600 baud.  RmtSerial keeps the CPU out
+// of the bit timing:
+//
+//  - Transmit: bytes are turned into RMT symbols (one half symbol per run of
+//    equal bits) and the RMT peripheral clocks them out on its own.  Edge times
+//    are taken from the start of the chunk, so rounding never adds up.
+//  - Receive: a GPIO interrupt on every edge only stores a timestamp and the
+//    new level.  The serial task decodes the edges into bytes, sampling each
+//    bit at its centre.  (The RMT receiver can't be used here: its capture
+//    ends after 64 symbols or an idle gap, and a steady stream has neither.)
+//
+// It is a Stream with SoftwareSerial's onReceive()/perform_work() contract, so
+// getSerialStream() hands it out like any other port.  write() never blocks: it
+// takes one chunk while the RMT channel is idle and 0 bytes while it's busy;
+// availableForWrite() says which.  The line is 8N1.
+//
+// The decoder and encoder don't touch hardware; test/ runs them on a PC
+// against simulated waveforms (cmake -S test -B build, then ctest).
+
+#define RMT_SERIAL_TICK_HZ       10000000    // RMT resolution, 0.1 us
+#define RMT_SERIAL_TX_CHUNK      64          // Bytes per RMT transmission
+#define RMT_SERIAL_TX_SYMBOLS    (RMT_SERIAL_TX_CHUNK * 5 + 1)   // Up to 10 runs per byte, two per symbol
+#define RMT_SERIAL_EDGE_RING     256         // Received edges waiting to be decoded, must be a power of two
+#define RMT_SERIAL_RX_BUFFER     256         // Decoded bytes waiting to be read, must be a power of two
+#define RMT_SERIAL_IDLE_MARGIN_US  50        // Edges younger than this may still be on their way from the interrupt
+
+typedef struct {
+  uint32_t bytesSent;
+  uint32_t bytesReceived;
+  uint32_t framingErrors;   // Bytes whose start or stop bit was wrong
+  uint32_t edgeOverruns;    // Edges lost because the serial task fell behind
+  uint32_t rxOverruns;      // Bytes lost because nobody read them
+} RmtSerialStats;
+
+// Turns line edges into 8N1 bytes.  Plain code without any hardware access, so
+// it can be fed recorded or generated waveforms on a PC.  Times are in us.
+class RmtSerialDecoder {
+public:
+  void begin(uint32_t baud);
+  // The line changed to level at time.  Returns 1 if that completed a byte, stored in out.
+  int edge(uint32_t time, uint8_t level, uint8_t *out);
+  // No edge until now; finishes a byte whose last bits are high.  Returns 0 or 1.
+  int idle(uint32_t now, uint8_t *out);
+  uint32_t framingErrors = 0;
+
+private:
+  int sampleUntil(uint32_t time, uint8_t *out);
+  uint32_t bitQ8 = 0;       // Bit time in 1/256 us
+  uint32_t frameStart = 0;
+  bool inFrame = false;
+  uint8_t bitIndex = 0;     // Next bit to sample, 0 = start bit, 9 = stop bit
+  uint8_t level = 1;
+  uint8_t shift = 0;
+};
+
+// Encodes as many 8N1 bytes as fit into maxSymbols RMT symbols of RMT_SERIAL_TICK_HZ ticks.  No hardware
+// access either.  Returns the number of bytes taken and the symbols used in symbolCount.
+size_t encodeRmtSerial(uint32_t baud, const uint8_t *buffer, size_t size, rmt_data_t *symbols, size_t maxSymbols,
+                       size_t &symbolCount);
+
+class RmtSerial : public Stream {
+public:
+  RmtSerial();
+  void begin(uint32_t baud, int rxPin, int txPin);
+  void end();
+
+  void onReceive(std::function<void()> handler);
+  // Decodes what came in and runs the receive handler.  Call often (the serial task does, every ms).
+  void perform_work();
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  int availableForWrite() override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  size_t write(uint8_t byte) override;
+  using Print::write;
+  void flush() override;
+
+  RmtSerialStats stats() const;
+
+private:
+  static void IRAM_ATTR edgeISR(void *arg);
+  void decodeEdges();
+  void storeReceived(const uint8_t *bytes, int count);
+
+  int rxPin = -1;
+  int txPin = -1;
+  uint32_t baud = 0;
+  std::function<void()> receiveHandler;
+  RmtSerialStats serialStats = {};
+
+  // Edge ring, filled by edgeISR and emptied by the serial task
+  struct Edge {
+    uint32_t time;
+    uint8_t level;
+  };
+  Edge edges[RMT_SERIAL_EDGE_RING];
+  volatile uint32_t edgeHead = 0;
+  volatile uint32_t edgeTail = 0;
+  volatile uint32_t edgeOverruns = 0;
+  RmtSerialDecoder decoder;
+
+  // Decoded bytes, only touched by the serial task
+  uint8_t rxBuffer[RMT_SERIAL_RX_BUFFER];
+  uint32_t rxHead = 0;
+  uint32_t rxTail = 0;
+
+  // Symbols of the chunk being sent; the RMT reads them until it's done
+  rmt_data_t txSymbols[RMT_SERIAL_TX_SYMBOLS];
+};
+
+// =============== Function Declarations ===============
+void printRmtSerialStats(int port, const RmtSerial &serial);
+
+#endif
@@ -0,0 +1,130 @@
+#include "WCB_Routing.h"
+
+#define ROUTE_TRIE_NODES    (ROUTE_MAX_RULES * ROUTE_PREFIX_MAX + 1)
+#define ROUTE_NONE          0xFF
+
+// First-child / next-sibling trie, node 0 is the root
+typedef struct {
+  char c;
+  uint8_t route;          // Route ending at this node, or ROUTE_NONE
+  uint8_t child;          // First child, 0 = none
+  uint8_t sibling;        // Next child of the same parent, 0 = none
+} RouteTrieNode;
+
+static_assert(ROUTE_TRIE_NODES <= 256, "Trie node indexes must fit in a byte");
+
+CommandRoute commandRoutes[ROUTE_MAX_RULES];
+uint8_t commandRouteCount = 0;
+
+// Routes are only changed and looked up from loop(), so nothing here needs a lock
+static RouteTrieNode routeTrie[ROUTE_TRIE_NODES];
+static uint16_t routeTrieSize = 1;
+static RoutingStats routingStats = {};
+
+static uint8_t findTrieChild(uint8_t node, char c) {
+  for (uint8_t child = routeTrie[node].child; child != 0; child = routeTrie[child].sibling) {
+    if (routeTrie[child].c == c) return child;
+  }
+  return 0;
+}
+
+void compileCommandRoutes() {
+  routeTrie[0] = {0, ROUTE_NONE, 0, 0};
+  routeTrieSize = 1;
+
+  for (uint8_t r = 0; r < commandRouteCount; r++) {
+    uint8_t node = 0;
+    for (const char *p = commandRoutes[r].prefix; *p; p++) {
+      uint8_t child = findTrieChild(node, *p);
+      if (child == 0) {
+        child = routeTrieSize++;
+        routeTrie[child] = {*p, ROUTE_NONE, 0, routeTrie[node].child};
+        routeTrie[node].child = child;
+      }
+      node = child;
+    }
+    routeTrie[node].route = r;
+  }
+}
+
+// Longest route prefix of cmd, or nullptr if the command should be broadcast
+const CommandRoute *findCommandRoute(const char *cmd) {
+  uint8_t best = ROUTE_NONE;
+  uint8_t node = 0;
+  for (const char *p = cmd; *p; p++) {
+    node = findTrieChild(node, *p);
+    if (node == 0) break;
+    if (routeTrie[node].route != ROUTE_NONE) {
+      best = routeTrie[node].route;
+    }
+  }
+
+  if (best == ROUTE_NONE) {
+    routingStats.broadcast++;
+    return nullptr;
+  }
+  routingStats.routed++;
+  return &commandRoutes[best];
+}
+
+// Adds a route or replaces the targets of an existing one.  Returns false if the table is full.
+bool setCommandRoute(const char *prefix, uint8_t ports, uint16_t wcbs) {
+  size_t length = strlen(prefix);
+  if (length == 0 || length > ROUTE_PREFIX_MAX) return false;
+
+  CommandRoute *route = nullptr;
+  for (uint8_t r = 0; r < commandRouteCount && !route; r++) {
+    if (strcmp(commandRoutes[r].prefix, prefix) == 0) route = &commandRoutes[r];
+  }
+  if (!route) {
+    if (commandRouteCount == ROUTE_MAX_RULES) return false;
+    route = &commandRoutes[commandRouteCount++];
+    strcpy(route->prefix, prefix);
+  }
+  route->ports = ports;
+  route->wcbs = wcbs;
+  compileCommandRoutes();
+  return true;
+}
+
+bool removeCommandRoute(const char *prefix) {
+  for (uint8_t r = 0; r < commandRouteCount; r++) {
+    if (strcmp(commandRoutes[r].prefix, prefix) == 0) {
+      memmove(&commandRoutes[r], &commandRoutes[r + 1], (commandRouteCount - r - 1) * sizeof(CommandRoute));
+      commandRouteCount--;
+      compileCommandRoutes();
+      return true;
+    }
+  }
+  return false;
+}
+
+void clearCommandRoutes() {
+  commandRouteCount = 0;
+  compileCommandRoutes();
+}
+
+void printCommandRoutes() {
+  if (commandRouteCount == 0) {
+    Serial.println("No command routes, unmatched commands are broadcast.");
+    return;
+  }
+  for (uint8_t r = 0; r < commandRouteCount; r++) {
+    const CommandRoute &route = commandRoutes[r];
+    Serial.printf("Route \"%s\" ->", route.prefix);
+    for (int port = 1; port <= 5; port++) {
+      if (route.ports & (1 << port)) Serial.printf(" Serial%d", port);
+    }
+    for (int wcb = 1; wcb <= 9; wcb++) {
+      if (route.wcbs & (1 << wcb)) Serial.printf(" WCB%d", wcb);
+    }
+    Serial.println();
+  }
+}
+
+void printRoutingStats() {
+  Serial.println("--------------- Command Routing ----------------------");
+  Serial.printf("Routes %d/%d, trie nodes %d/%d.  Commands routed %lu, broadcast %lu\n",
+                commandRouteCount, ROUTE_MAX_RULES, routeTrieSize, ROUTE_TRIE_NODES,
+                (unsigned long)routingStats.routed, (unsigned long)routingStats.broadcast);
+}
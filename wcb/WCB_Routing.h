@@ -0,0 +1,47 @@
+#ifndef WCB_ROUTING_H
+#define WCB_ROUTING_H
+
+#include <Arduino.h>
+
+// =============== Command Routing Table ===============
+// Commands without a ? or ; prefix used to go to every serial port with
+// broadcast enabled and to every WCB.  A route sends commands that start with
+// its prefix only to the listed local ports and WCBs instead:
+//
+//   ?ROUTE:PP,S1W2       :PP... goes to Serial1 and WCB2
+//   ?ROUTE$,S3           $... only goes to Serial3
+//
+// The longest matching prefix wins; commands that match no route still go to
+// every local port with broadcast enabled and to the WCBs that subscribe to
+// them (see WCB_Subscribe.h).  Routes are compiled into a prefix trie whenever they change, so
+// finding the route for a command costs one step per character of its prefix.
+// Routes only choose where a command goes; a routed command arriving from
+// another WCB is delivered to this WCB's routed ports and never sent on.
+
+#define ROUTE_MAX_RULES     16
+#define ROUTE_PREFIX_MAX    15      // Characters in a prefix
+
+typedef struct {
+  char prefix[ROUTE_PREFIX_MAX + 1];
+  uint8_t ports;          // Bit n = Serialn
+  uint16_t wcbs;          // Bit n = WCBn
+} CommandRoute;
+
+typedef struct {
+  uint32_t routed;        // Commands that matched a route
+  uint32_t broadcast;     // Commands that matched none
+} RoutingStats;
+
+extern CommandRoute commandRoutes[ROUTE_MAX_RULES];
+extern uint8_t commandRouteCount;
+
+// =============== Function Declarations ===============
+void compileCommandRoutes();
+const CommandRoute *findCommandRoute(const char *cmd);
+bool setCommandRoute(const char *prefix, uint8_t ports, uint16_t wcbs);
+bool removeCommandRoute(const char *prefix);
+void clearCommandRoutes();
+void printCommandRoutes();
+void printRoutingStats();
+
+#endif
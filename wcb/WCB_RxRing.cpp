@@ -0,0 +1,72 @@
+#include "WCB_RxRing.h"
+#include <atomic>
+
+static ESPNowRxEntry rxRing[ESPNOW_RX_RING_SIZE];
+static std::atomic<uint32_t> rxHead(0);     // Next entry the callback writes
+static std::atomic<uint32_t> rxTail(0);     // Next entry the receive task reads
+
+static ESPNowRxStats rxStats = {};
+
+bool espnowRxPush(const uint8_t *srcMac, int8_t rssi, const uint8_t *data, int len) {
+  uint32_t head = rxHead.load(std::memory_order_relaxed);
+  uint32_t tail = rxTail.load(std::memory_order_acquire);
+  if (head - tail >= ESPNOW_RX_RING_SIZE || len <= 0 || len > WCB_FRAME_BUFFER_SIZE) {
+    rxStats.dropped++;
+    return false;
+  }
+
+  ESPNowRxEntry &entry = rxRing[head & (ESPNOW_RX_RING_SIZE - 1)];
+  memcpy(entry.srcMac, srcMac, 6);
+  entry.rssi = rssi;
+  entry.length = len;
+  entry.receivedAt = micros();
+  memcpy(entry.data, data, len);
+
+  // Publish the entry only after it is fully written
+  rxHead.store(head + 1, std::memory_order_release);
+
+  rxStats.received++;
+  uint16_t waiting = head + 1 - tail;
+  if (waiting > rxStats.highWatermark) {
+    rxStats.highWatermark = waiting;
+  }
+  return true;
+}
+
+ESPNowRxEntry *espnowRxPeek() {
+  uint32_t tail = rxTail.load(std::memory_order_relaxed);
+  if (tail == rxHead.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return &rxRing[tail & (ESPNOW_RX_RING_SIZE - 1)];
+}
+
+void espnowRxPop() {
+  rxTail.store(rxTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Only called from the callback, so the producer owns these counters
+void recordESPNowCallbackCycles(uint32_t cycles) {
+  rxStats.callbackCount++;
+  rxStats.callbackCyclesTotal += cycles;
+  if (cycles > rxStats.callbackCyclesMax) {
+    rxStats.callbackCyclesMax = cycles;
+  }
+}
+
+void printESPNowRxStats() {
+  ESPNowRxStats stats = rxStats;
+  uint32_t waiting = rxHead.load() - rxTail.load();
+  uint32_t cpuMHz = ESP.getCpuFreqMHz();
+
+  Serial.println("--------------- ESP-NOW Receive ----------------------");
+  Serial.printf("Frames received: %lu, dropped: %lu, waiting: %lu/%d, high watermark: %u\n",
+                (unsigned long)stats.received, (unsigned long)stats.dropped,
+                (unsigned long)waiting, ESPNOW_RX_RING_SIZE, stats.highWatermark);
+  if (stats.callbackCount > 0 && cpuMHz > 0) {
+    Serial.printf("Receive callback: avg %lu ns, max %lu ns over %lu calls\n",
+                  (unsigned long)(stats.callbackCyclesTotal * 1000 / stats.callbackCount / cpuMHz),
+                  (unsigned long)((uint64_t)stats.callbackCyclesMax * 1000 / cpuMHz),
+                  (unsigned long)stats.callbackCount);
+  }
+}
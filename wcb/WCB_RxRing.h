@@ -0,0 +1,40 @@
+#ifndef WCB_RXRING_H
+#define WCB_RXRING_H
+
+#include <Arduino.h>
+#include "WCB_Frame.h"
+
+// =============== ESP-NOW Receive Ring ===============
+// The ESP-NOW receive callback runs in the Wi-Fi task.  It only copies the raw
+// frame into this preallocated single-producer/single-consumer ring and wakes
+// the ESP-NOW receive task, which does authentication, filtering, logging and
+// dispatch.  No locks are taken: the callback only moves the head, the task
+// only moves the tail.
+
+#define ESPNOW_RX_RING_SIZE   16      // Must be a power of two
+
+typedef struct {
+  uint8_t  srcMac[6];
+  int8_t   rssi;
+  uint16_t length;
+  uint32_t receivedAt;                // micros() when the callback ran
+  uint8_t  data[WCB_FRAME_BUFFER_SIZE];
+} ESPNowRxEntry;
+
+typedef struct {
+  uint32_t received;                  // Frames copied into the ring
+  uint32_t dropped;                   // Frames dropped because the ring was full or oversized
+  uint16_t highWatermark;             // Most frames ever waiting at once
+  uint32_t callbackCount;             // Callback invocations timed
+  uint64_t callbackCyclesTotal;       // Sum of CPU cycles spent in the callback
+  uint32_t callbackCyclesMax;         // Longest callback in CPU cycles
+} ESPNowRxStats;
+
+// =============== Function Declarations ===============
+bool espnowRxPush(const uint8_t *srcMac, int8_t rssi, const uint8_t *data, int len);   // Producer (Wi-Fi task)
+ESPNowRxEntry *espnowRxPeek();                                                         // Consumer, nullptr when empty
+void espnowRxPop();                                                                    // Consumer
+void recordESPNowCallbackCycles(uint32_t cycles);
+void printESPNowRxStats();
+
+#endif
@@ -0,0 +1,187 @@
+#include "WCB_Sequencer.h"
+#include "WCB_Macro.h"
+
+extern bool debugEnabled;
+
+typedef struct {
+  bool active;
+  char name[SEQUENCE_NAME_MAX + 1];
+  uint8_t sourceID;
+  uint16_t length;          // Code length
+  MacroState state;
+  uint32_t dueMs;
+  int8_t next;              // Next sequence in the same wheel slot, -1 = none
+  // Own copies, so a waiting sequence never holds a command pool slot the queue may need
+  uint8_t code[MACRO_CODE_MAX];
+  char params[MACRO_PARAMS_MAX + 1];
+} Sequence;
+
+// Sequences are only started, stepped and stopped from loop()
+static Sequence sequences[SEQUENCE_MAX];
+static int8_t wheel[SEQUENCE_WHEEL_SLOTS];
+static bool wheelReady = false;
+static uint32_t wheelTick = 0;        // Next millisecond whose slot hasn't been looked at
+static uint8_t activeSequences = 0;
+static SequencerStats sequencerStats = {};
+
+static void initWheel() {
+  for (int i = 0; i < SEQUENCE_WHEEL_SLOTS; i++) wheel[i] = -1;
+  wheelReady = true;
+}
+
+static void wheelInsert(int8_t index) {
+  int8_t &head = wheel[sequences[index].dueMs & (SEQUENCE_WHEEL_SLOTS - 1)];
+  sequences[index].next = head;
+  head = index;
+}
+
+static void wheelRemove(int8_t index) {
+  int8_t *link = &wheel[sequences[index].dueMs & (SEQUENCE_WHEEL_SLOTS - 1)];
+  while (*link != -1) {
+    if (*link == index) {
+      *link = sequences[index].next;
+      return;
+    }
+    link = &sequences[*link].next;
+  }
+}
+
+static void finishSequence(int8_t index) {
+  Sequence &sequence = sequences[index];
+  sequence.active = false;
+  activeSequences--;
+}
+
+// Runs the macro until its next wait (the sequence goes into the wheel) or the end (it's done)
+static void runSequence(int8_t index) {
+  Sequence &sequence = sequences[index];
+
+  uint32_t waitMs;
+  if (runMacro(sequence.state, sequence.code, sequence.length, sequence.params, sequence.sourceID, &waitMs)) {
+    sequence.dueMs += waitMs;
+    wheelInsert(index);
+    return;
+  }
+
+  sequencerStats.completed++;
+  if (debugEnabled) { Serial.printf("Sequence '%s' finished\n", sequence.name); }
+  finishSequence(index);
+}
+
+static int8_t findSequence(const char *name) {
+  for (int8_t i = 0; i < SEQUENCE_MAX; i++) {
+    if (sequences[i].active && strcmp(sequences[i].name, name) == 0) return i;
+  }
+  return -1;
+}
+
+// Runs the macro name, stopping a running copy of it first.  Only a macro that waits takes a
+// sequence place; returns false if it had to wait and no place was free.
+bool startSequence(const char *name, const uint8_t *code, size_t length, const char *params, int sourceID) {
+  if (!wheelReady) initWheel();
+  stopSequence(name);
+
+  MacroState state;
+  beginMacro(state, params);
+  uint32_t startedMs = millis();
+  uint32_t waitMs;
+  if (!runMacro(state, code, length, params, sourceID, &waitMs)) return true;
+
+  int8_t index = -1;
+  for (int8_t i = 0; i < SEQUENCE_MAX && index < 0; i++) {
+    if (!sequences[i].active) index = i;
+  }
+  if (index < 0 || length > MACRO_CODE_MAX) {
+    Serial.printf("Can't continue sequence '%s', too many sequences running!\n", name);
+    return false;
+  }
+
+  // The stored command may change while we wait, so the sequence keeps its own copy
+  Sequence &sequence = sequences[index];
+  strncpy(sequence.name, name, SEQUENCE_NAME_MAX);
+  sequence.name[SEQUENCE_NAME_MAX] = '\0';
+  sequence.sourceID = sourceID;
+  memcpy(sequence.code, code, length);
+  strncpy(sequence.params, params, MACRO_PARAMS_MAX);
+  sequence.params[MACRO_PARAMS_MAX] = '\0';
+  sequence.length = length;
+  sequence.state = state;
+  sequence.dueMs = startedMs + waitMs;
+  sequence.active = true;
+  if (activeSequences++ == 0) {
+    wheelTick = startedMs;
+  }
+  sequencerStats.started++;
+  wheelInsert(index);
+  return true;
+}
+
+bool stopSequence(const char *name) {
+  int8_t index = findSequence(name);
+  if (index < 0) return false;
+  wheelRemove(index);
+  sequencerStats.cancelled++;
+  finishSequence(index);
+  return true;
+}
+
+void stopAllSequences() {
+  for (int8_t i = 0; i < SEQUENCE_MAX; i++) {
+    if (!sequences[i].active) continue;
+    wheelRemove(i);
+    sequencerStats.cancelled++;
+    finishSequence(i);
+  }
+}
+
+// Runs the sequences due in one wheel slot
+static void serviceWheelSlot(uint32_t slot, uint32_t now) {
+  // Collected first; a sequence that runs may go straight back into this slot
+  int8_t due[SEQUENCE_MAX];
+  int dueCount = 0;
+  int8_t *link = &wheel[slot];
+  while (*link != -1) {
+    Sequence &sequence = sequences[*link];
+    if ((int32_t)(now - sequence.dueMs) >= 0) {
+      due[dueCount++] = *link;
+      *link = sequence.next;
+    } else {
+      link = &sequence.next;
+    }
+  }
+
+  for (int i = 0; i < dueCount; i++) {
+    uint32_t late = now - sequences[due[i]].dueMs;
+    if (late > sequencerStats.maxLateMs) sequencerStats.maxLateMs = late;
+    runSequence(due[i]);
+  }
+}
+
+// Called from loop(): look at the slot of every millisecond since the last call
+void serviceSequencer() {
+  if (activeSequences == 0) return;
+  uint32_t now = millis();
+  uint32_t ticks = now - wheelTick + 1;
+  if (ticks > SEQUENCE_WHEEL_SLOTS) {
+    // Away for a whole turn of the wheel, every slot may hold something due
+    ticks = SEQUENCE_WHEEL_SLOTS;
+  }
+  for (uint32_t tick = now + 1 - ticks; tick != now + 1; tick++) {
+    serviceWheelSlot(tick & (SEQUENCE_WHEEL_SLOTS - 1), now);
+  }
+  wheelTick = now + 1;
+}
+
+void printSequencer() {
+  Serial.println("--------------- Sequences ----------------------");
+  uint32_t now = millis();
+  for (int8_t i = 0; i < SEQUENCE_MAX; i++) {
+    const Sequence &sequence = sequences[i];
+    if (!sequence.active) continue;
+    Serial.printf("'%s': step at %u of %u bytes, next in %ld ms\n", sequence.name, sequence.state.pc, sequence.length,
+                  (long)(int32_t)(sequence.dueMs - now));
+  }
+  Serial.printf("Started %lu, completed %lu, cancelled %lu, latest step %lu ms late\n",
+                (unsigned long)sequencerStats.started, (unsigned long)sequencerStats.completed,
+                (unsigned long)sequencerStats.cancelled, (unsigned long)sequencerStats.maxLateMs);
+}
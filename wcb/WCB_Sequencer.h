@@ -0,0 +1,39 @@
+#ifndef WCB_SEQUENCER_H
+#define WCB_SEQUENCER_H
+
+#include <Arduino.h>
+
+// =============== Timed Sequences ===============
+// A stored command can wait between its commands with ;D<ms> steps:
+//
+//   ?CSpanel,:OP01^;D350^$12^;D1200^:CL01
+//   ;Cpanel        opens the panel, 350 ms later starts the sound, 1.2 s later closes it
+//
+// Recalling it runs its compiled macro (WCB_Macro.h) straight away; at the
+// first wait it becomes a sequence named after its key, with its own copy of
+// the code and parameters.  Up to SEQUENCE_MAX sequences run at once;
+// recalling a running one starts it over, and ?SEQ_STOPpanel (or ?SEQ_CLEAR
+// for all) cancels it.  Nothing ever waits: each sequence sleeps in a hashed
+// timer wheel with one slot per millisecond, and loop() only looks at the
+// slots of the milliseconds that went by.  Delays count from when the previous
+// step was due, so a late step doesn't push the rest of the sequence back.
+
+#define SEQUENCE_MAX            8
+#define SEQUENCE_WHEEL_SLOTS    64      // 1 ms each, must be a power of two
+#define SEQUENCE_NAME_MAX       15      // Same as a stored command key
+
+typedef struct {
+  uint32_t started;
+  uint32_t completed;
+  uint32_t cancelled;       // Stopped by ?SEQ_STOP or restarted
+  uint32_t maxLateMs;       // Longest a step ran after it was due
+} SequencerStats;
+
+// =============== Function Declarations ===============
+bool startSequence(const char *name, const uint8_t *code, size_t length, const char *params, int sourceID);
+bool stopSequence(const char *name);
+void stopAllSequences();
+void serviceSequencer();
+void printSequencer();
+
+#endif
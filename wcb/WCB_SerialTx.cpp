@@ -0,0 +1,326 @@
+#include "WCB_SerialTx.h"
+#include "WCB_Trace.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+extern Stream &getSerialStream(int port);
+
+typedef struct {
+  uint8_t key;            // Index into the port's coalescing keys
+  uint8_t length;         // Excluding the '\r' added when it moves into the ring
+  uint8_t data[SERIAL_COALESCE_CMD_MAX];
+} HeldCommand;
+
+// A traced write, done once the ring's tail reaches end
+typedef struct {
+  uint32_t traceId;
+  uint32_t end;
+} TraceMark;
+
+typedef struct {
+  uint8_t buffer[SERIAL_TX_RING_SIZE];
+  uint32_t head;          // Next byte written by producers
+  uint32_t tail;          // Next byte sent by the TX task
+  HeldCommand held[SERIAL_COALESCE_HELD];   // Oldest first, all written after the ring's bytes
+  uint8_t heldCount;
+  TraceMark traceMarks[SERIAL_TX_TRACE_MARKS];    // Oldest first
+  uint8_t traceMarkCount;
+  SerialTxStats stats;
+  portMUX_TYPE mux;       // Producers run in loop(), the ESP-NOW task and the serial task
+} SerialTxRing;
+
+static SerialTxRing txRings[SERIAL_TX_PORTS];
+
+// Guarded by the port's ring mux, so a key can't change under a write to that port
+char serialCoalesceKeys[SERIAL_TX_PORTS][SERIAL_COALESCE_KEYS][SERIAL_COALESCE_KEY_MAX + 1];
+static TaskHandle_t serialTxTaskHandle = nullptr;
+
+// Copy a write into the ring.  Called with ring.mux held after checking that it fits.
+static void appendToRing(SerialTxRing &ring, const uint8_t *data, size_t len, bool appendCR) {
+  size_t total = len + (appendCR ? 1 : 0);
+  uint32_t used = ring.head - ring.tail;
+  for (size_t i = 0; i < len; i++) {
+    ring.buffer[(ring.head + i) & (SERIAL_TX_RING_SIZE - 1)] = data[i];
+  }
+  if (appendCR) {
+    ring.buffer[(ring.head + len) & (SERIAL_TX_RING_SIZE - 1)] = '\r';
+  }
+  ring.head += total;
+  ring.stats.bytesQueued += total;
+  if (used + total > ring.stats.highWatermark) {
+    ring.stats.highWatermark = used + total;
+  }
+}
+
+// Move held commands into the ring, oldest first.  Called with ring.mux held.  Returns false if some didn't fit.
+static bool releaseHeldCommands(SerialTxRing &ring) {
+  uint8_t moved = 0;
+  while (moved < ring.heldCount) {
+    const HeldCommand &held = ring.held[moved];
+    if (held.length + 1u > SERIAL_TX_RING_SIZE - (ring.head - ring.tail)) break;
+    appendToRing(ring, held.data, held.length, true);
+    moved++;
+  }
+  if (moved > 0) {
+    memmove(ring.held, ring.held + moved, (ring.heldCount - moved) * sizeof(HeldCommand));
+    ring.heldCount -= moved;
+  }
+  return ring.heldCount == 0;
+}
+
+// Longest coalescing key of the port the command starts with, or -1.  Called with ring.mux held.
+static int coalesceKeyFor(int port, const uint8_t *data, size_t len) {
+  int best = -1;
+  size_t bestLength = 0;
+  for (int k = 0; k < SERIAL_COALESCE_KEYS; k++) {
+    const char *key = serialCoalesceKeys[port - 1][k];
+    size_t keyLength = strlen(key);
+    if (keyLength > bestLength && keyLength <= len && memcmp(data, key, keyLength) == 0) {
+      best = k;
+      bestLength = keyLength;
+    }
+  }
+  return best;
+}
+
+// Hold a keyed command back while the port is busy.  Called with ring.mux held.  Returns false to write it now.
+static bool holdCommand(SerialTxRing &ring, uint8_t key, const uint8_t *data, size_t len) {
+  if (ring.head == ring.tail && ring.heldCount == 0) return false;   // Idle port, nothing to gain
+
+  HeldCommand *slot = nullptr;
+  for (int i = 0; i < ring.heldCount; i++) {
+    if (ring.held[i].key == key) {
+      slot = &ring.held[i];
+      ring.stats.superseded++;
+      break;
+    }
+  }
+  if (!slot) {
+    if (ring.heldCount == SERIAL_COALESCE_HELD) return false;
+    slot = &ring.held[ring.heldCount++];
+    slot->key = key;
+  }
+  memcpy(slot->data, data, len);
+  slot->length = len;
+  return true;
+}
+
+// Queue a write, waiting for room if wait is set and the port is still sending.  Returns false if it was dropped.
+static bool queueSerialTx(int port, const uint8_t *data, size_t len, bool appendCR, uint32_t traceId, bool wait) {
+  if (port < 1 || port > SERIAL_TX_PORTS) return false;
+  SerialTxRing &ring = txRings[port - 1];
+  size_t total = len + (appendCR ? 1 : 0);
+  wait = wait && total <= SERIAL_TX_RING_SIZE && serialTxTaskHandle && xTaskGetCurrentTaskHandle() != serialTxTaskHandle;
+
+  portENTER_CRITICAL(&ring.mux);
+  int key = (appendCR && len <= SERIAL_COALESCE_CMD_MAX) ? coalesceKeyFor(port, data, len) : -1;
+  if (key < 0 || !holdCommand(ring, key, data, len)) {
+    // Anything else goes behind the held commands, so they move into the ring first
+    uint32_t lastTail = ring.tail;
+    TickType_t lastProgress = xTaskGetTickCount();
+    while (!releaseHeldCommands(ring) || total > SERIAL_TX_RING_SIZE - (ring.head - ring.tail)) {
+      if (ring.tail != lastTail) {
+        lastTail = ring.tail;
+        lastProgress = xTaskGetTickCount();
+      }
+      if (!wait || xTaskGetTickCount() - lastProgress >= pdMS_TO_TICKS(SERIAL_TX_STALL_MS)) {
+        ring.stats.dropped++;
+        portEXIT_CRITICAL(&ring.mux);
+        return false;
+      }
+      // Like the blocking write this replaced, wait for the TX task to make room
+      portEXIT_CRITICAL(&ring.mux);
+      xTaskNotifyGive(serialTxTaskHandle);
+      vTaskDelay(1);
+      portENTER_CRITICAL(&ring.mux);
+    }
+    appendToRing(ring, data, len, appendCR);
+    if (traceId != 0 && ring.traceMarkCount < SERIAL_TX_TRACE_MARKS) {
+      ring.traceMarks[ring.traceMarkCount].traceId = traceId;
+      ring.traceMarks[ring.traceMarkCount].end = ring.head;
+      ring.traceMarkCount++;
+    }
+  }
+  portEXIT_CRITICAL(&ring.mux);
+
+  if (serialTxTaskHandle) {
+    xTaskNotifyGive(serialTxTaskHandle);
+  }
+  return true;
+}
+
+// Queue len bytes (plus an optional '\r') for port 1-5.  The whole write is dropped if it doesn't fit.
+bool queueSerialWrite(int port, const uint8_t *data, size_t len, bool appendCR) {
+  return queueSerialTx(port, data, len, appendCR, 0, false);
+}
+
+// Queue a command, waiting for room while the port drains, and record TRACE_PORT_SENT for traceId once the write
+// has gone to the driver.  Held commands aren't followed.
+bool queueSerialWriteTraced(int port, const uint8_t *data, size_t len, bool appendCR, uint32_t traceId) {
+  return queueSerialTx(port, data, len, appendCR, traceId, true);
+}
+
+size_t serialTxPending(int port) {
+  if (port < 1 || port > SERIAL_TX_PORTS) return 0;
+  SerialTxRing &ring = txRings[port - 1];
+  portENTER_CRITICAL(&ring.mux);
+  size_t pending = ring.head - ring.tail;
+  portEXIT_CRITICAL(&ring.mux);
+  return pending;
+}
+
+// Bytes that can still be queued for a port without being dropped
+size_t serialTxFree(int port) {
+  if (port < 1 || port > SERIAL_TX_PORTS) return 0;
+  return SERIAL_TX_RING_SIZE - serialTxPending(port);
+}
+
+#define SERIAL_TX_DRAINED   0     // Ring empty
+#define SERIAL_TX_BUSY      1     // The driver takes no more for now
+#define SERIAL_TX_MORE      2     // SERIAL_TX_PASS_BYTES written, more waiting
+
+// Hand as much of one port's ring to its driver as it will take, up to SERIAL_TX_PASS_BYTES
+static uint8_t drainSerialTxRing(int port) {
+  SerialTxRing &ring = txRings[port - 1];
+  Stream &serial = getSerialStream(port);
+  size_t budget = SERIAL_TX_PASS_BYTES;
+
+  while (true) {
+    portENTER_CRITICAL(&ring.mux);
+    if (ring.head == ring.tail && ring.heldCount > 0) {
+      // The port caught up, send the latest of each held command
+      releaseHeldCommands(ring);
+    }
+    uint32_t tail = ring.tail;
+    uint32_t pending = ring.head - tail;
+    portEXIT_CRITICAL(&ring.mux);
+    if (pending == 0) return SERIAL_TX_DRAINED;
+    if (budget == 0) return SERIAL_TX_MORE;
+
+    // Contiguous run up to the end of the buffer
+    uint32_t offset = tail & (SERIAL_TX_RING_SIZE - 1);
+    size_t chunk = min((uint32_t)(SERIAL_TX_RING_SIZE - offset), pending);
+    int room = serial.availableForWrite();
+    if (room <= 0) return SERIAL_TX_BUSY;
+    chunk = min(chunk, min((size_t)room, budget));
+
+    size_t written = serial.write(ring.buffer + offset, chunk);
+
+    portENTER_CRITICAL(&ring.mux);
+    ring.tail += written;
+    ring.stats.bytesWritten += written;
+    uint32_t sent[SERIAL_TX_TRACE_MARKS];
+    uint8_t sentCount = 0;
+    while (sentCount < ring.traceMarkCount && (int32_t)(ring.tail - ring.traceMarks[sentCount].end) >= 0) {
+      sent[sentCount] = ring.traceMarks[sentCount].traceId;
+      sentCount++;
+    }
+    if (sentCount > 0) {
+      memmove(ring.traceMarks, ring.traceMarks + sentCount, (ring.traceMarkCount - sentCount) * sizeof(TraceMark));
+      ring.traceMarkCount -= sentCount;
+    }
+    portEXIT_CRITICAL(&ring.mux);
+
+    for (uint8_t i = 0; i < sentCount; i++) {
+      traceEvent(sent[i], TRACE_PORT_SENT, port);
+    }
+
+    budget -= written;
+    if (written < chunk) return SERIAL_TX_BUSY;
+  }
+}
+
+static void serialTxTask(void *pvParameters) {
+  bool backlog = false;
+  while (true) {
+    // Sleep until something is queued, or poll each tick while a driver is full
+    ulTaskNotifyTake(pdTRUE, backlog ? 1 : portMAX_DELAY);
+    bool more;
+    do {
+      // Ports take turns, SERIAL_TX_PASS_BYTES at a time
+      more = false;
+      backlog = false;
+      for (int port = 1; port <= SERIAL_TX_PORTS; port++) {
+        uint8_t state = drainSerialTxRing(port);
+        if (state == SERIAL_TX_MORE) more = true;
+        if (state == SERIAL_TX_BUSY) backlog = true;
+      }
+    } while (more);
+  }
+}
+
+void initSerialTx() {
+  for (int i = 0; i < SERIAL_TX_PORTS; i++) {
+    txRings[i].head = 0;
+    txRings[i].tail = 0;
+    txRings[i].heldCount = 0;
+    txRings[i].traceMarkCount = 0;
+    txRings[i].stats = {};
+    txRings[i].mux = portMUX_INITIALIZER_UNLOCKED;
+  }
+  xTaskCreatePinnedToCore(serialTxTask, "Serial TX Task", 4096, NULL, 1, &serialTxTaskHandle, 1);
+}
+
+// Returns false if the key is invalid or the port already has SERIAL_COALESCE_KEYS keys
+bool addSerialCoalesceKey(int port, const char *key) {
+  size_t length = strlen(key);
+  if (port < 1 || port > SERIAL_TX_PORTS || length == 0 || length > SERIAL_COALESCE_KEY_MAX) return false;
+  SerialTxRing &ring = txRings[port - 1];
+
+  bool stored = false;
+  portENTER_CRITICAL(&ring.mux);
+  for (int k = 0; k < SERIAL_COALESCE_KEYS && !stored; k++) {
+    stored = strcmp(serialCoalesceKeys[port - 1][k], key) == 0;
+  }
+  for (int k = 0; k < SERIAL_COALESCE_KEYS && !stored; k++) {
+    if (serialCoalesceKeys[port - 1][k][0] == '\0') {
+      strcpy(serialCoalesceKeys[port - 1][k], key);
+      stored = true;
+    }
+  }
+  portEXIT_CRITICAL(&ring.mux);
+  return stored;
+}
+
+// Commands already held still go out normally
+void clearSerialCoalesceKeys(int port) {
+  if (port < 1 || port > SERIAL_TX_PORTS) return;
+  SerialTxRing &ring = txRings[port - 1];
+  portENTER_CRITICAL(&ring.mux);
+  for (int k = 0; k < SERIAL_COALESCE_KEYS; k++) {
+    serialCoalesceKeys[port - 1][k][0] = '\0';
+  }
+  portEXIT_CRITICAL(&ring.mux);
+}
+
+void printSerialCoalesceKeys() {
+  for (int port = 1; port <= SERIAL_TX_PORTS; port++) {
+    bool any = false;
+    for (int k = 0; k < SERIAL_COALESCE_KEYS; k++) {
+      const char *key = serialCoalesceKeys[port - 1][k];
+      if (key[0] == '\0') continue;
+      if (any) {
+        Serial.printf(", \"%s\"", key);
+      } else {
+        Serial.printf("Serial%d coalescing keys: \"%s\"", port, key);
+        any = true;
+      }
+    }
+    if (any) Serial.println();
+  }
+}
+
+void printSerialTxStats() {
+  Serial.println("--------------- Serial Transmit ----------------------");
+  for (int port = 1; port <= SERIAL_TX_PORTS; port++) {
+    SerialTxRing &ring = txRings[port - 1];
+    portENTER_CRITICAL(&ring.mux);
+    SerialTxStats stats = ring.stats;
+    uint32_t pending = ring.head - ring.tail;
+    portEXIT_CRITICAL(&ring.mux);
+    Serial.printf("Serial%d: %lu queued, %lu written, %lu pending, high watermark %u/%d, %lu dropped, %lu superseded\n",
+                  port, (unsigned long)stats.bytesQueued, (unsigned long)stats.bytesWritten,
+                  (unsigned long)pending, stats.highWatermark, SERIAL_TX_RING_SIZE,
+                  (unsigned long)stats.dropped, (unsigned long)stats.superseded);
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef WCB_SERIALTX_H
+#define WCB_SERIALTX_H
+
+#include <Arduino.h>
+
+// =============== Buffered Serial Transmit ===============
+// Writes to Serial1-Serial5 are appended to a per-port ring buffer and drained
+// by the Serial TX task in bulk write(buf, len) calls.  The command loop never
+// waits for a slow port to drain: every port is only handed as many bytes as
+// its driver (UART FIFO or RMT channel) can take without blocking, and at most
+// SERIAL_TX_PASS_BYTES per pass over the ports, so one port's write never
+// holds up the others.
+//
+// Commands that start with one of a port's coalescing keys (e.g. "3P" for PSI
+// brightness, ?SCOALESCE3,3P) are held back while the port is still busy.  A
+// newer command with the same key replaces the held one in place, so after a
+// stall only the latest value goes out instead of seconds of stale ones.  Held
+// commands move into the ring, in order, once it has drained, or before any
+// other write to the port so commands never overtake each other.
+//
+// When a port's ring is full, queueSerialWriteTraced() waits for it to drain,
+// as the blocking write it replaced did, so a macro fanning out commands to a
+// slow port loses none.  The write is only dropped once the port has sent
+// nothing for SERIAL_TX_STALL_MS.  queueSerialWrite() never waits: raw
+// streams such as tunnels drop the write and send it again.
+
+#define SERIAL_TX_PORTS             5
+#define SERIAL_TX_RING_SIZE         512     // Bytes per port, must be a power of two
+#define SERIAL_TX_PASS_BYTES        64      // Bytes one port may write before the next port's turn
+#define SERIAL_TX_STALL_MS          100     // A waiting write is dropped once the port has sent nothing for this long
+
+#define SERIAL_COALESCE_KEYS        4       // Keys per port
+#define SERIAL_COALESCE_KEY_MAX     15      // Characters in a key
+#define SERIAL_COALESCE_HELD        4       // Commands held back per port
+#define SERIAL_COALESCE_CMD_MAX     64      // Longer commands are never held back
+#define SERIAL_TX_TRACE_MARKS       4       // Traced writes per port waiting to go out (see WCB_Trace.h)
+
+typedef struct {
+  uint32_t bytesQueued;     // Bytes accepted into the ring
+  uint32_t bytesWritten;    // Bytes handed to the serial driver
+  uint32_t dropped;         // Writes rejected because the ring was full and the port stalled
+  uint16_t highWatermark;   // Most bytes ever waiting in the ring
+  uint32_t superseded;      // Held commands replaced by a newer one with the same key
+} SerialTxStats;
+
+extern char serialCoalesceKeys[SERIAL_TX_PORTS][SERIAL_COALESCE_KEYS][SERIAL_COALESCE_KEY_MAX + 1];
+
+// =============== Function Declarations ===============
+void initSerialTx();
+bool queueSerialWrite(int port, const uint8_t *data, size_t len, bool appendCR);
+bool queueSerialWriteTraced(int port, const uint8_t *data, size_t len, bool appendCR, uint32_t traceId);
+size_t serialTxPending(int port);
+size_t serialTxFree(int port);
+bool addSerialCoalesceKey(int port, const char *key);
+void clearSerialCoalesceKeys(int port);
+void printSerialCoalesceKeys();
+void printSerialTxStats();
+
+#endif
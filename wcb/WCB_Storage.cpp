@@ -1,5 +1,13 @@
 #include <sys/_types.h>
 #include "WCB_Storage.h"
+#include "WCB_Tunnel.h"
+#include "WCB_CommandLanes.h"
+#include "WCB_SerialTx.h"
+#include "WCB_Routing.h"
+#include "WCB_Groups.h"
+#include "WCB_Sequencer.h"
+#include "WCB_Macro.h"
+#include "WCB_Dispatch.h"
 #include <Preferences.h>
 // #include "wcb_pin_map.h"
 
@@ -15,7 +23,6 @@ extern int WCB_Number;
 extern uint8_t umac_oct2;
 extern uint8_t umac_oct3;
 extern char espnowPassword[40];
-extern String storedCommands[MAX_STORED_COMMANDS];
 extern int wcb_hw_version;
 extern char espnowPassword[40];
 extern void updatePinMap();
@@ -234,6 +241,51 @@ void setESPNowPassword(const char* newPassword) {
     espnowPassword[sizeof(espnowPassword) - 1] = '\0';
 }
 
+// Load the ESP-NOW transmit frame format from preferences
+void loadESPNowFrameFormat() {
+    preferences.begin("espnow_config", true);
+    espnowLegacyFrames = preferences.getBool("legacy_frames", false);
+    preferences.end();
+}
+
+// Save the ESP-NOW transmit frame format to preferences
+void saveESPNowFrameFormat(bool legacy) {
+    preferences.begin("espnow_config", false);
+    preferences.putBool("legacy_frames", legacy);
+    preferences.end();
+    espnowLegacyFrames = legacy;
+}
+
+// Load the reliable unicast setting from preferences
+void loadESPNowReliable() {
+    preferences.begin("espnow_config", true);
+    espnowReliable = preferences.getBool("reliable", false);
+    preferences.end();
+}
+
+// Save the reliable unicast setting to preferences
+void saveESPNowReliable(bool reliable) {
+    preferences.begin("espnow_config", false);
+    preferences.putBool("reliable", reliable);
+    preferences.end();
+    espnowReliable = reliable;
+}
+
+// Load the command coalescing window from preferences
+void loadESPNowCoalesceWindow() {
+    preferences.begin("espnow_config", true);
+    espnowCoalesceMs = preferences.getUChar("coalesce_ms", espnowCoalesceMs);
+    preferences.end();
+}
+
+// Save the command coalescing window to preferences
+void saveESPNowCoalesceWindow(uint8_t windowMs) {
+    preferences.begin("espnow_config", false);
+    preferences.putUChar("coalesce_ms", windowMs);
+    preferences.end();
+    espnowCoalesceMs = windowMs;
+}
+
 // Load function identifiers from preferences
 void loadLocalFunctionIdentifierAndCommandCharacter() {
     preferences.begin("command_config", true);
@@ -273,115 +325,352 @@ void setCommandDelimiter(char c) {
     preferences.putString("delimiter", String(c));
     preferences.end();
     commandDelimiter = c;
+    recompileStoredCommands();
 }
 
-// Load stored commands from preferences
-void loadStoredCommandsFromPreferences() {
-    preferences.begin("stored_commands", true);
-    for (int i = 0; i < MAX_STORED_COMMANDS; i++) {
-        char storedCommandBuffer[200] = {0};
-        String key = "CMD" + String(i + 1);
-        preferences.getString(key.c_str(), storedCommandBuffer, sizeof(storedCommandBuffer));
-        storedCommands[i] = String(storedCommandBuffer);
+// ==================== Stored Command Cache ====================
+// Stored commands are loaded from NVS once at boot into a compact RAM cache:
+// values live back to back in one arena and keys are found through a small
+// open-addressing hash index, so ;Ckey recall never touches flash.  Each value
+// is followed by its compiled macro (WCB_Macro.h), which is what a recall runs.
+// Changes are marked dirty and written back to NVS in one batch once things go
+// quiet.  NVS keeps the text: it is what gets listed and edited, and the code
+// is rebuilt from it whenever the command characters change.
+
+static StoredCommandEntry storedCommandEntries[MAX_STORED_COMMANDS];   // Dense, in the order keys were first stored
+static uint8_t storedCommandIndex[STORED_COMMAND_INDEX_SIZE];          // Hash slot -> entry, STORED_COMMAND_EMPTY if free
+static char storedCommandArena[STORED_COMMAND_ARENA_SIZE];
+static uint16_t storedCommandCount = 0;
+static uint16_t storedCommandArenaUsed = 0;
+static bool storedCommandKeyListDirty = false;
+static unsigned long storedCommandLastChange = 0;
+static StoredCommandStats storedCommandStats = {};
+static uint8_t storedCommandCode[MACRO_CODE_MAX];     // Compiler output before it goes into the arena
+
+static uint32_t hashStoredCommandKey(const char *key) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*key) {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619u;
     }
-    preferences.end();
+    return hash;
+}
+
+// Returns the hash slot holding key, or the empty slot where it would go
+static int findStoredCommandSlot(const char *key) {
+    uint32_t slot = hashStoredCommandKey(key) & (STORED_COMMAND_INDEX_SIZE - 1);
+    while (storedCommandIndex[slot] != STORED_COMMAND_EMPTY) {
+        if (strcmp(storedCommandEntries[storedCommandIndex[slot]].key, key) == 0) {
+            return slot;
+        }
+        slot = (slot + 1) & (STORED_COMMAND_INDEX_SIZE - 1);
+    }
+    return slot;
+}
+
+static StoredCommandEntry *findStoredCommand(const char *key) {
+    int slot = findStoredCommandSlot(key);
+    if (storedCommandIndex[slot] == STORED_COMMAND_EMPTY) return nullptr;
+    return &storedCommandEntries[storedCommandIndex[slot]];
+}
+
+// Squeeze out the space left behind by overwritten values, and the value of skip (being replaced)
+static void compactStoredCommandArena(const StoredCommandEntry *skip) {
+    // Entries ordered by where their value sits in the arena
+    uint8_t order[MAX_STORED_COMMANDS];
+    for (uint16_t i = 0; i < storedCommandCount; i++) {
+        uint16_t j = i;
+        while (j > 0 && storedCommandEntries[order[j - 1]].offset > storedCommandEntries[i].offset) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    uint16_t writePos = 0;
+    for (uint16_t i = 0; i < storedCommandCount; i++) {
+        StoredCommandEntry &entry = storedCommandEntries[order[i]];
+        if (&entry == skip) continue;
+        uint16_t size = entry.length + 1 + entry.codeLength;
+        memmove(storedCommandArena + writePos, storedCommandArena + entry.offset, size);
+        entry.offset = writePos;
+        writePos += size;
+    }
+    storedCommandArenaUsed = writePos;
+}
+
+// Copy a value and its code into the arena.  Returns false if they don't fit even after compacting.
+static bool storeStoredCommandValue(StoredCommandEntry &entry, const char *value, size_t length,
+                                    const uint8_t *code, size_t codeLength) {
+    size_t size = length + 1 + codeLength;
+    if (storedCommandArenaUsed + size > STORED_COMMAND_ARENA_SIZE) {
+        // The old value of an entry already in the cache makes room too.  Checked before
+        // compacting, so a value that doesn't fit leaves the old one untouched.
+        bool replacing = &entry < storedCommandEntries + storedCommandCount;
+        size_t live = 0;
+        for (uint16_t i = 0; i < storedCommandCount; i++) {
+            const StoredCommandEntry &other = storedCommandEntries[i];
+            if (&other != &entry || !replacing) live += other.length + 1 + other.codeLength;
+        }
+        if (live + size > STORED_COMMAND_ARENA_SIZE) {
+            return false;
+        }
+        compactStoredCommandArena(replacing ? &entry : nullptr);
+    }
+    memcpy(storedCommandArena + storedCommandArenaUsed, value, length);
+    storedCommandArena[storedCommandArenaUsed + length] = '\0';
+    memcpy(storedCommandArena + storedCommandArenaUsed + length + 1, code, codeLength);
+    entry.offset = storedCommandArenaUsed;
+    entry.length = length;
+    entry.codeLength = codeLength;
+    storedCommandArenaUsed += size;
+    return true;
+}
+
+// Insert or replace a cache entry.  Returns the entry, or nullptr if the cache is full.
+static StoredCommandEntry *putStoredCommand(const char *key, const char *value, size_t length,
+                                            const uint8_t *code, size_t codeLength) {
+    int slot = findStoredCommandSlot(key);
+    if (storedCommandIndex[slot] != STORED_COMMAND_EMPTY) {
+        StoredCommandEntry *entry = &storedCommandEntries[storedCommandIndex[slot]];
+        return storeStoredCommandValue(*entry, value, length, code, codeLength) ? entry : nullptr;
+    }
+
+    if (storedCommandCount >= MAX_STORED_COMMANDS) return nullptr;
+    StoredCommandEntry *entry = &storedCommandEntries[storedCommandCount];
+    if (!storeStoredCommandValue(*entry, value, length, code, codeLength)) return nullptr;
+    strncpy(entry->key, key, sizeof(entry->key) - 1);
+    entry->key[sizeof(entry->key) - 1] = '\0';
+    entry->dirty = false;
+    storedCommandIndex[slot] = storedCommandCount++;
+    storedCommandKeyListDirty = true;
+    return entry;
+}
 
+static void resetStoredCommandCache() {
+    memset(storedCommandIndex, STORED_COMMAND_EMPTY, sizeof(storedCommandIndex));
+    storedCommandCount = 0;
+    storedCommandArenaUsed = 0;
+    storedCommandKeyListDirty = false;
 }
-// Recall a Stored Command
-void recallCommandSlot(const String &key, int sourceID) {
+
+// Load stored commands from preferences into the RAM cache
+void loadStoredCommandsFromPreferences() {
+    resetStoredCommandCache();
+
     preferences.begin("stored_cmds", true);
-    String recalledCommand = preferences.getString(key.c_str(), "");
-    preferences.end();
+    String keyList = preferences.getString("key_list", "");
+    int startIdx = 0;
+    bool skippedKeys = false;
+    bool cacheFull = false;
+    while (true) {
+        int commaIndex = keyList.indexOf(',', startIdx);
+        if (commaIndex == -1) break;
 
-    if (recalledCommand.isEmpty()) {
-        Serial.printf("No command stored under key: '%s'\n", key.c_str());
-        return;
+        String key = keyList.substring(startIdx, commaIndex);
+        key.trim();
+        startIdx = commaIndex + 1;
+        if (key.length() == 0 || key.length() > STORED_COMMAND_KEY_MAX || findStoredCommand(key.c_str())) {
+            skippedKeys = true;
+            continue;
+        }
+
+        String value = preferences.getString(key.c_str(), "");
+        if (value.length() == 0) {
+            skippedKeys = true;
+            continue;
+        }
+        // Kept without code if it doesn't compile, so it can still be listed and fixed
+        size_t codeLength = 0;
+        if (!compileMacro(value.c_str(), value.length(), storedCommandCode, sizeof(storedCommandCode), &codeLength)) {
+            Serial.printf("Stored command '%s' can't be recalled until it is stored again\n", key.c_str());
+        }
+        if (!putStoredCommand(key.c_str(), value.c_str(), value.length(), storedCommandCode, codeLength)) {
+            Serial.printf("Stored command cache full, '%s' not loaded\n", key.c_str());
+            cacheFull = true;
+            break;
+        }
     }
+    preferences.end();
 
-    Serial.printf("Recalling command for key '%s': %s\n", key.c_str(), recalledCommand.c_str());
+    // Write back a key list rebuilt from the cache to drop duplicate or dangling keys, unless
+    // that would also drop the keys that didn't fit the cache
+    storedCommandKeyListDirty = skippedKeys && !cacheFull;
+    Serial.printf("Loaded %d stored commands (%d of %d bytes)\n", storedCommandCount, storedCommandArenaUsed, STORED_COMMAND_ARENA_SIZE);
+}
 
-    // Enqueue for execution
-    parseCommandsAndEnqueue(recalledCommand, sourceID);
+// Recall a Stored Command.  key may be followed by parameters: key,100,200
+void recallCommandSlot(const char *key, size_t length, int sourceID) {
+    const char *comma = (const char *)memchr(key, ',', length);
+    const char *nameText = key;
+    size_t nameLength = comma ? comma - key : length;
+    const char *paramsText = comma ? comma + 1 : "";
+    size_t paramsLength = comma ? key + length - paramsText : 0;
+    trimCommandText(nameText, nameLength);
+
+    // Longer names can't have been stored
+    char name[STORED_COMMAND_KEY_MAX + 1] = "";
+    StoredCommandEntry *entry = nullptr;
+    if (nameLength <= STORED_COMMAND_KEY_MAX) {
+        memcpy(name, nameText, nameLength);
+        name[nameLength] = '\0';
+        entry = findStoredCommand(name);
+    }
+    if (!entry) {
+        storedCommandStats.misses++;
+        Serial.printf("No command stored under key: '%.*s'\n", (int)nameLength, nameText);
+        return;
+    }
+    if (entry->codeLength == 0) {
+        Serial.printf("Stored command '%s' didn't compile, store it again\n", name);
+        return;
+    }
+    if (paramsLength > MACRO_PARAMS_MAX) {
+        Serial.printf("Parameters too long, at most %d characters\n", MACRO_PARAMS_MAX);
+        return;
+    }
+    storedCommandStats.hits++;
+    char params[MACRO_PARAMS_MAX + 1];
+    memcpy(params, paramsText, paramsLength);
+    params[paramsLength] = '\0';
+
+    const char *recalledCommand = storedCommandArena + entry->offset;
+    Serial.printf("Recalling command for key '%s': %s\n", name, recalledCommand);
+    startSequence(name, (const uint8_t *)recalledCommand + entry->length + 1, entry->codeLength,
+                  params, sourceID);
 }
 
 // Save stored commands to preferences
-void saveStoredCommandsToPreferences(const String &message) {
-int commaIndex = message.indexOf(','); // Find first `,`
-    if (commaIndex == -1 || commaIndex == 0) {
+void saveStoredCommandsToPreferences(const char *message, size_t length) {
+    const char *comma = (const char *)memchr(message, ',', length);
+    if (!comma || comma == message) {
         Serial.println("Invalid format. Use ?Ckey,value");
         return;
     }
 
-    String key = message.substring(0, commaIndex);
-    String value = message.substring(commaIndex + 1);
-    key.trim();
-    value.trim();
+    const char *keyText = message;
+    size_t keyLength = comma - message;
+    const char *value = comma + 1;
+    size_t valueLength = message + length - value;
+    trimCommandText(keyText, keyLength);
+    trimCommandText(value, valueLength);
 
-    if (key.length() == 0 || value.length() == 0) {
+    if (keyLength == 0 || valueLength == 0) {
         Serial.println("Key or value cannot be empty.");
         return;
     }
+    if (keyLength > STORED_COMMAND_KEY_MAX) {
+        Serial.printf("Key too long. Keys can be at most %d characters.\n", STORED_COMMAND_KEY_MAX);
+        return;
+    }
+    char key[STORED_COMMAND_KEY_MAX + 1];
+    memcpy(key, keyText, keyLength);
+    key[keyLength] = '\0';
 
-    // Open Preferences in read-write mode
-    preferences.begin("stored_cmds", false);
-    
-    // Save the command
-    preferences.putString(key.c_str(), value);
+    size_t codeLength;
+    if (!compileMacro(value, valueLength, storedCommandCode, sizeof(storedCommandCode), &codeLength)) {
+        Serial.println("Not stored.");
+        return;
+    }
+    StoredCommandEntry *entry = putStoredCommand(key, value, valueLength, storedCommandCode, codeLength);
+    if (!entry) {
+        Serial.println("Stored command cache is full!");
+        return;
+    }
 
-    // Retrieve the existing key list
-    String existingKeys = preferences.getString("key_list", "");
-    
-    // Add new key only if it's not already present
-    if (existingKeys.indexOf("," + key + ",") == -1) {
-        existingKeys += key + ",";
-        preferences.putString("key_list", existingKeys);
+    // Written to NVS by serviceStoredCommandWriteBack()
+    entry->dirty = true;
+    storedCommandLastChange = millis();
+
+    Serial.printf("Stored: Key='%s', Value='%.*s'\n", key, (int)valueLength, value);
+}
+
+// Compile every stored command again, after the command character, local function identifier or delimiter changed
+void recompileStoredCommands() {
+    for (uint16_t i = 0; i < storedCommandCount; i++) {
+        StoredCommandEntry &entry = storedCommandEntries[i];
+        // Copied first, storing it again may compact the arena under it
+        String value(storedCommandArena + entry.offset);
+        size_t codeLength = 0;
+        if (!compileMacro(value.c_str(), value.length(), storedCommandCode, sizeof(storedCommandCode), &codeLength)) {
+            Serial.printf("Stored command '%s' can't be recalled until it is stored again\n", entry.key);
+        }
+        if (!storeStoredCommandValue(entry, value.c_str(), value.length(), storedCommandCode, codeLength)) {
+            Serial.printf("Stored command cache is full, '%s' can't be recalled until it is stored again\n", entry.key);
+            entry.codeLength = 0;
+        }
     }
+}
 
+// Write every dirty entry and the key list to NVS in one session
+void flushStoredCommands() {
+    bool anyDirty = storedCommandKeyListDirty;
+    for (uint16_t i = 0; i < storedCommandCount && !anyDirty; i++) {
+        anyDirty = storedCommandEntries[i].dirty;
+    }
+    if (!anyDirty) return;
+
+    preferences.begin("stored_cmds", false);
+    for (uint16_t i = 0; i < storedCommandCount; i++) {
+        StoredCommandEntry &entry = storedCommandEntries[i];
+        if (!entry.dirty) continue;
+        preferences.putString(entry.key, storedCommandArena + entry.offset);
+        entry.dirty = false;
+        storedCommandStats.nvsWrites++;
+    }
+    if (storedCommandKeyListDirty) {
+        String keyList;
+        for (uint16_t i = 0; i < storedCommandCount; i++) {
+            keyList += storedCommandEntries[i].key;
+            keyList += ',';
+        }
+        preferences.putString("key_list", keyList);
+        storedCommandKeyListDirty = false;
+    }
     preferences.end();
+    storedCommandStats.writeBacks++;
+}
 
-    Serial.printf("Stored: Key='%s', Value='%s'\n", key.c_str(), value.c_str());
+// Called from loop(): flush once no stored command has changed for STORED_COMMAND_WRITEBACK_MS
+void serviceStoredCommandWriteBack() {
+    if (millis() - storedCommandLastChange < STORED_COMMAND_WRITEBACK_MS) return;
+    flushStoredCommands();
 }
 
 void listStoredCommands() {
-    preferences.begin("stored_cmds", true); // Open in read mode
-    String keyList = preferences.getString("key_list", ""); // Retrieve stored keys
-    preferences.end();
-
-    if (keyList.length() == 0) {
+    if (storedCommandCount == 0) {
         Serial.println("No stored commands.");
         return;
     }
 
     Serial.println("\n--- Stored Commands ---");
-    int startIdx = 0;
-    while (true) {
-        int commaIndex = keyList.indexOf(',', startIdx);
-        if (commaIndex == -1) break;
-
-        String key = keyList.substring(startIdx, commaIndex);
-        key.trim();
-        
-        if (key.length() > 0) {
-            preferences.begin("stored_cmds", true);
-            String value = preferences.getString(key.c_str(), "");
-            preferences.end();
-            Serial.printf("Key: '%s' -> Value: '%s'\n", key.c_str(), value.c_str());
-        }
-
-        startIdx = commaIndex + 1;
+    for (uint16_t i = 0; i < storedCommandCount; i++) {
+        const StoredCommandEntry &entry = storedCommandEntries[i];
+        Serial.printf("Key: '%s' -> Value: '%s'\n", entry.key, storedCommandArena + entry.offset);
     }
     Serial.println("--- End of Stored Commands ---\n");
 }
 
+void printStoredCommandStats() {
+    uint16_t dirty = 0;
+    for (uint16_t i = 0; i < storedCommandCount; i++) {
+        if (storedCommandEntries[i].dirty) dirty++;
+    }
+    Serial.println("--------------- Stored Commands ----------------------");
+    Serial.printf("Entries: %d/%d, arena %d/%d bytes, %d waiting for write-back\n",
+                  storedCommandCount, MAX_STORED_COMMANDS, storedCommandArenaUsed, STORED_COMMAND_ARENA_SIZE, dirty);
+    Serial.printf("Recalls: %lu hits, %lu misses.  NVS: %lu values written in %lu write-backs\n",
+                  (unsigned long)storedCommandStats.hits, (unsigned long)storedCommandStats.misses,
+                  (unsigned long)storedCommandStats.nvsWrites, (unsigned long)storedCommandStats.writeBacks);
+}
+
 // Clear all stored commands
 void clearAllStoredCommands() {
   preferences.begin("stored_cmds", false);
     preferences.clear();
     preferences.end();   
-    // for (int i = 0; i < MAX_STORED_COMMANDS; i++) {
-    //     storedCommands[i] = "";
-    // }
-    // saveStoredCommandsToPreferences();
+    resetStoredCommandCache();
 }
 
 // Erase all NVS preferences
@@ -422,6 +711,26 @@ void eraseNVSFlash() {
     preferences.clear();
     preferences.end();
 
+    preferences.begin("tunnels", false);
+    preferences.clear();
+    preferences.end();
+
+    preferences.begin("cmd_priority", false);
+    preferences.clear();
+    preferences.end();
+
+    preferences.begin("serial_coalesce", false);
+    preferences.clear();
+    preferences.end();
+
+    preferences.begin("routes", false);
+    preferences.clear();
+    preferences.end();
+
+    preferences.begin("wcb_groups", false);
+    preferences.clear();
+    preferences.end();
+
     Serial.println("NVS cleared. Restarting...");
     delay(2000);
     ESP.restart();
@@ -453,6 +762,7 @@ void storeKyberSettings(const String &message){
 void loadKyberSettings(){
   preferences.begin("kyber_settings", true);
   Kyber_Location = preferences.getString("K_Location", "");
+  Kyber_Peer = preferences.getInt("K_Peer", 0);
   preferences.end();
 
   if (Kyber_Location == "local"){
@@ -481,6 +791,169 @@ void printKyberSettings(){
             temp = "Not used";
   }
   // Serial.printf("Kyber is %s\n", temp);
+  if (Kyber_Peer == 0) {
+      Serial.println("Kyber bridge peer: all WCBs");
+  } else {
+      Serial.printf("Kyber bridge peer: WCB%d\n", Kyber_Peer);
+  }
+};
+
+// Serial tunnel bindings, stored as port << 8 | WCB per channel
+void loadTunnelBindings(){
+  preferences.begin("tunnels", true);
+  for (int i = 0; i < TUNNEL_CHANNELS; i++) {
+    char key[8];
+    snprintf(key, sizeof(key), "ch%d", i + 1);
+    uint16_t packed = preferences.getUShort(key, 0);
+    tunnelBindings[i].port = packed >> 8;
+    tunnelBindings[i].wcb = packed & 0xFF;
+  }
+  preferences.end();
+};
+
+void saveTunnelBinding(int channel){
+  char key[8];
+  snprintf(key, sizeof(key), "ch%d", channel);
+  const TunnelBinding &binding = tunnelBindings[channel - 1];
+  preferences.begin("tunnels", false);
+  if (binding.port == 0) {
+    preferences.remove(key);
+  } else {
+    preferences.putUShort(key, (binding.port << 8) | binding.wcb);
+  }
+  preferences.end();
+};
+
+// Serial coalescing keys, one newline separated string per port
+void loadSerialCoalesceKeys(){
+  preferences.begin("serial_coalesce", true);
+  for (int port = 1; port <= 5; port++) {
+    char name[4];
+    snprintf(name, sizeof(name), "p%d", port);
+    String keys = preferences.getString(name, "");
+    int start = 0;
+    while (start < (int)keys.length()) {
+      int end = keys.indexOf('\n', start);
+      if (end < 0) end = keys.length();
+      addSerialCoalesceKey(port, keys.substring(start, end).c_str());
+      start = end + 1;
+    }
+  }
+  preferences.end();
+};
+
+void saveSerialCoalesceKeys(int port){
+  String keys;
+  for (int k = 0; k < SERIAL_COALESCE_KEYS; k++) {
+    const char *key = serialCoalesceKeys[port - 1][k];
+    if (key[0] == '\0') continue;
+    if (keys.length() > 0) keys += '\n';
+    keys += key;
+  }
+  char name[4];
+  snprintf(name, sizeof(name), "p%d", port);
+  preferences.begin("serial_coalesce", false);
+  if (keys.length() == 0) {
+    preferences.remove(name);
+  } else {
+    preferences.putString(name, keys);
+  }
+  preferences.end();
+};
+
+// Command routes, stored as one blob of CommandRoute records
+void loadCommandRoutes(){
+  preferences.begin("routes", true);
+  size_t length = preferences.getBytesLength("table");
+  commandRouteCount = 0;
+  if (length > 0 && length % sizeof(CommandRoute) == 0 && length <= sizeof(commandRoutes)) {
+    preferences.getBytes("table", commandRoutes, length);
+    commandRouteCount = length / sizeof(CommandRoute);
+  }
+  preferences.end();
+  for (int i = 0; i < commandRouteCount; i++) {
+    commandRoutes[i].prefix[ROUTE_PREFIX_MAX] = '\0';
+  }
+  compileCommandRoutes();
+};
+
+void saveCommandRoutes(){
+  preferences.begin("routes", false);
+  if (commandRouteCount == 0) {
+    preferences.remove("table");
+  } else {
+    preferences.putBytes("table", commandRoutes, commandRouteCount * sizeof(CommandRoute));
+  }
+  preferences.end();
+};
+
+// WCB groups, stored as one blob of WCBGroup records
+void loadWCBGroups(){
+  preferences.begin("wcb_groups", true);
+  size_t length = preferences.getBytesLength("table");
+  wcbGroupCount = 0;
+  if (length > 0 && length % sizeof(WCBGroup) == 0 && length <= sizeof(wcbGroups)) {
+    preferences.getBytes("table", wcbGroups, length);
+    wcbGroupCount = length / sizeof(WCBGroup);
+  }
+  preferences.end();
+  for (int i = 0; i < wcbGroupCount; i++) {
+    wcbGroups[i].name[WCB_GROUP_NAME_MAX] = '\0';
+  }
+};
+
+void saveWCBGroups(){
+  preferences.begin("wcb_groups", false);
+  if (wcbGroupCount == 0) {
+    preferences.remove("table");
+  } else {
+    preferences.putBytes("table", wcbGroups, wcbGroupCount * sizeof(WCBGroup));
+  }
+  preferences.end();
+};
+
+// Command priority classes: one byte per port, prefixes stored as "<class letter><prefix>"
+void loadCommandPriorities(){
+  preferences.begin("cmd_priority", true);
+  uint8_t ports[COMMAND_LANE_SOURCES];
+  if (preferences.getBytes("ports", ports, sizeof(ports)) == sizeof(ports)) {
+    for (int i = 0; i < COMMAND_LANE_SOURCES; i++) {
+      if (ports[i] < COMMAND_PRIORITY_CLASSES) portCommandPriority[i] = ports[i];
+    }
+  }
+  clearCommandPriorityPrefixes();
+  int count = preferences.getUChar("prefixes", 0);
+  for (int i = 0; i < count && i < COMMAND_PRIORITY_PREFIXES; i++) {
+    char key[8];
+    snprintf(key, sizeof(key), "p%d", i);
+    String rule = preferences.getString(key, "");
+    int priority = rule.length() > 1 ? commandPriorityFromChar(rule.charAt(0)) : -1;
+    if (priority >= 0) {
+      setCommandPriorityPrefix(rule.c_str() + 1, priority);
+    }
+  }
+  preferences.end();
+};
+
+void saveCommandPriorities(){
+  preferences.begin("cmd_priority", false);
+  preferences.putBytes("ports", portCommandPriority, sizeof(portCommandPriority));
+  preferences.putUChar("prefixes", commandPriorityPrefixCount);
+  for (int i = 0; i < commandPriorityPrefixCount; i++) {
+    char key[8];
+    snprintf(key, sizeof(key), "p%d", i);
+    String rule = String(commandPriorityChar(commandPriorityPrefixes[i].priority)) + commandPriorityPrefixes[i].prefix;
+    preferences.putString(key, rule);
+  }
+  preferences.end();
+};
+
+// WCB the Kyber bridge sends to, 0 = broadcast to all WCBs
+void storeKyberPeer(int peer){
+  Kyber_Peer = peer;
+  preferences.begin("kyber_settings", false);
+  preferences.putInt("K_Peer", Kyber_Peer);
+  preferences.end();
 };
 
 
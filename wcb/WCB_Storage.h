@@ -14,6 +14,9 @@ extern uint8_t umac_oct3;
 extern int WCB_Number;
 extern int Default_WCB_Quantity;
 extern char espnowPassword[40];
+extern bool espnowLegacyFrames;
+extern bool espnowReliable;
+extern uint8_t espnowCoalesceMs;
 extern bool debugEnabled;
 extern bool serialBroadcastEnabled[5];
 extern unsigned long baudRates[5];
@@ -23,13 +26,35 @@ extern int storedBaudRate[6];
 extern bool Kyber_Remote;
 extern bool Kyber_Local;
 extern String Kyber_Location;
+extern int Kyber_Peer;
 
 
 // For stored commands
-#define MAX_STORED_COMMANDS 50
-extern String storedCommands[MAX_STORED_COMMANDS];
+#define MAX_STORED_COMMANDS          50
+#define STORED_COMMAND_KEY_MAX       15        // NVS key length limit
+#define STORED_COMMAND_INDEX_SIZE    64        // Hash slots, power of two and larger than MAX_STORED_COMMANDS
+#define STORED_COMMAND_ARENA_SIZE    12288     // Bytes shared by all stored command values and their code
+#define STORED_COMMAND_WRITEBACK_MS  2000      // Quiet time before changes are written to NVS
+#define STORED_COMMAND_EMPTY         0xFF
+
+typedef struct {
+  char key[STORED_COMMAND_KEY_MAX + 1];
+  uint16_t offset;      // Start of the value in the arena
+  uint16_t length;      // Value length, excluding the null terminator
+  uint16_t codeLength;  // Compiled macro after the terminator, 0 if it didn't compile
+  bool dirty;           // Changed in RAM, not yet written to NVS
+} StoredCommandEntry;
+
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t nvsWrites;
+  uint32_t writeBacks;
+} StoredCommandStats;
+
 extern void enqueueCommand(const String &cmd, int sourceID);  // Declare it as an external function
 extern void parseCommandsAndEnqueue(const String &data, int sourceID);
+extern void enqueueDelimitedCommands(const char *data, size_t length, int sourceID);
 
 // =============== Function Declarations ===============
 void saveHWversion(int wcb_hw_version_f);
@@ -49,16 +74,36 @@ void printBaudRates();
 void recallBaudRatefromSerial(int ser);
 void setBaudRateForSerial(int ser);
 
-void recallCommandSlot(const String &key, int sourceID);
+void recallCommandSlot(const char *key, size_t length, int sourceID);
 void loadStoredCommandsFromPreferences();
-void saveStoredCommandsToPreferences(const String &message);
+void saveStoredCommandsToPreferences(const char *message, size_t length);
+void recompileStoredCommands();
 void listStoredCommands();
+void flushStoredCommands();
+void serviceStoredCommandWriteBack();
+void printStoredCommandStats();
 
 void clearAllStoredCommands();
 
 void storeKyberSettings(const String &message);
 void loadKyberSettings();
 void printKyberSettings();
+void storeKyberPeer(int peer);
+
+void loadTunnelBindings();
+void saveTunnelBinding(int channel);
+
+void loadSerialCoalesceKeys();
+void saveSerialCoalesceKeys(int port);
+
+void loadCommandRoutes();
+void saveCommandRoutes();
+
+void loadWCBGroups();
+void saveWCBGroups();
+
+void loadCommandPriorities();
+void saveCommandPriorities();
 
 void saveBroadcastSettingsToPreferences();
 void loadBroadcastSettingsFromPreferences();
@@ -68,6 +113,12 @@ void saveLocalFunctionIdentifierAndCommandCharacter();
 
 void loadESPNowPasswordFromPreferences();
 void setESPNowPassword(const char *password);
+void loadESPNowFrameFormat();
+void saveESPNowFrameFormat(bool legacy);
+void loadESPNowReliable();
+void saveESPNowReliable(bool reliable);
+void loadESPNowCoalesceWindow();
+void saveESPNowCoalesceWindow(uint8_t windowMs);
 
 void setCommandDelimiter(char delimiter);
 void loadCommandDelimiter();
@@ -0,0 +1,196 @@
+#include "WCB_Subscribe.h"
+#include "WCB_Routing.h"
+#include "WCB_Tunnel.h"
+#include "WCB_TxQueue.h"
+
+extern uint8_t broadcastMACAddress[1][6];
+extern int WCB_Number;
+extern int Default_WCB_Quantity;
+extern bool espnowLegacyFrames;
+extern bool debugEnabled;
+extern bool serialBroadcastEnabled[5];
+extern bool Kyber_Local;
+extern bool Kyber_Remote;
+extern void sendESPNowMessage(uint8_t target, const char *message);
+extern void sendESPNowMulticast(uint16_t targets, const char *message);
+
+typedef struct {
+  bool valid;
+  uint32_t heardAtMs;
+  uint8_t flags;
+  uint8_t count;
+  char prefixes[SUBSCRIBE_MAX_PREFIXES][SUBSCRIBE_PREFIX_MAX + 1];
+} Subscription;
+
+static Subscription subscriptions[9];     // WCB1-WCB9
+static SubscribeStats subscribeStats = {};
+
+// Our own advertisement, only touched from loop()
+static uint8_t lastAdvert[WCB_FRAME_MAX_PAYLOAD];
+static size_t lastAdvertLength = 0;
+static uint32_t lastBeaconMs = 0;
+static uint32_t lastCheckMs = 0;
+
+// Advertisements arrive in the ESP-NOW receive task and are read from loop()
+static portMUX_TYPE subscribeMux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool wantsCommand(const Subscription &sub, const char *cmd) {
+  if (sub.flags & SUBSCRIBE_FLAG_CATCH_ALL) return true;
+  for (int i = 0; i < sub.count; i++) {
+    if (strncmp(cmd, sub.prefixes[i], strlen(sub.prefixes[i])) == 0) return true;
+  }
+  return false;
+}
+
+// Send a command that matched no local route to the WCBs that want it.  message is what goes out, cmd or cmd with a tag.
+void publishCommand(const char *cmd, const char *message) {
+  uint32_t now = millis();
+  uint16_t interested = 0;
+  uint16_t others = 0;
+  bool complete = true;
+
+  portENTER_CRITICAL(&subscribeMux);
+  for (int wcb = 1; wcb <= Default_WCB_Quantity && wcb <= 9; wcb++) {
+    if (wcb == WCB_Number) continue;
+    others |= 1 << wcb;
+    const Subscription &sub = subscriptions[wcb - 1];
+    if (!sub.valid || now - sub.heardAtMs > SUBSCRIBE_TIMEOUT_MS) {
+      complete = false;
+    } else if (wantsCommand(sub, cmd)) {
+      interested |= 1 << wcb;
+    }
+  }
+  portEXIT_CRITICAL(&subscribeMux);
+
+  if (!complete || interested == others) {
+    subscribeStats.broadcast++;
+    sendESPNowMessage(0, message);
+    if (debugEnabled) { Serial.printf("Broadcasted via ESP-NOW: %s\n", message); }
+    return;
+  }
+  if (interested == 0) {
+    subscribeStats.suppressed++;
+    if (debugEnabled) { Serial.printf("No WCB subscribes to: %s\n", cmd); }
+    return;
+  }
+  subscribeStats.targeted++;
+  sendESPNowMulticast(interested, message);
+  if (debugEnabled) { Serial.printf("Sent via ESP-NOW to subscriber mask 0x%03X: %s\n", interested, message); }
+}
+
+// SUBSCRIBE frame from another WCB (ESP-NOW receive task)
+void handleSubscribeBeacon(const wcb_frame &frame) {
+  uint8_t sender = frame.header.sender;
+  if (sender < 1 || sender > 9 || frame.header.length < 2) return;
+
+  Subscription received = {};
+  received.valid = true;
+  received.heardAtMs = millis();
+  received.flags = frame.payload[0];
+  uint8_t count = frame.payload[1];
+  size_t offset = 2;
+  for (int i = 0; i < count; i++) {
+    if (offset >= frame.header.length) return;
+    size_t length = frame.payload[offset++];
+    if (length == 0 || length > SUBSCRIBE_PREFIX_MAX || offset + length > frame.header.length) return;
+    if (received.count < SUBSCRIBE_MAX_PREFIXES) {
+      memcpy(received.prefixes[received.count], frame.payload + offset, length);
+      received.prefixes[received.count][length] = '\0';
+      received.count++;
+    }
+    offset += length;
+  }
+
+  portENTER_CRITICAL(&subscribeMux);
+  subscriptions[sender - 1] = received;
+  subscribeStats.beaconsReceived++;
+  portEXIT_CRITICAL(&subscribeMux);
+}
+
+// Whether WCBx advertised that it takes ESP-NOW v2 frames
+bool wcbAcceptsLargeFrames(uint8_t wcb) {
+  if (wcb < 1 || wcb > 9) return false;
+  uint32_t now = millis();
+  portENTER_CRITICAL(&subscribeMux);
+  const Subscription &sub = subscriptions[wcb - 1];
+  bool large = sub.valid && now - sub.heardAtMs <= SUBSCRIBE_TIMEOUT_MS && (sub.flags & SUBSCRIBE_FLAG_ESPNOW_V2);
+  portEXIT_CRITICAL(&subscribeMux);
+  return large;
+}
+
+// Prefixes of routes with local ports, and whether any port still takes broadcasts
+static size_t buildAdvert(uint8_t *payload) {
+  uint8_t flags = (WCB_FRAME_BUFFER_SIZE > WCB_FRAME_MAX_SIZE) ? SUBSCRIBE_FLAG_ESPNOW_V2 : 0;
+  for (int port = 1; port <= 5; port++) {
+    bool reserved = (port == 1 && Kyber_Remote) || (port <= 2 && Kyber_Local) || isTunnelPort(port);
+    if (!reserved && serialBroadcastEnabled[port - 1]) {
+      flags |= SUBSCRIBE_FLAG_CATCH_ALL;
+    }
+  }
+
+  uint8_t count = 0;
+  size_t length = 2;
+  for (int r = 0; r < commandRouteCount && count < SUBSCRIBE_MAX_PREFIXES; r++) {
+    if (commandRoutes[r].ports == 0) continue;
+    size_t prefixLength = strlen(commandRoutes[r].prefix);
+    if (length + 1 + prefixLength > WCB_FRAME_MAX_PAYLOAD) break;
+    payload[length++] = prefixLength;
+    memcpy(payload + length, commandRoutes[r].prefix, prefixLength);
+    length += prefixLength;
+    count++;
+  }
+  payload[0] = flags;
+  payload[1] = count;
+  return length;
+}
+
+// Called from loop(): beacon periodically, and as soon as our advertisement changes
+void serviceSubscriptions() {
+  // Boards on the legacy format can't read beacons
+  if (espnowLegacyFrames) return;
+
+  uint32_t now = millis();
+  if (now - lastCheckMs < SUBSCRIBE_CHECK_MS) return;
+  lastCheckMs = now;
+
+  uint8_t payload[WCB_FRAME_MAX_PAYLOAD];
+  size_t length = buildAdvert(payload);
+  bool changed = length != lastAdvertLength || memcmp(payload, lastAdvert, length) != 0;
+  if (!changed && now - lastBeaconMs < SUBSCRIBE_BEACON_MS) return;
+
+  memcpy(lastAdvert, payload, length);
+  lastAdvertLength = length;
+  lastBeaconMs = now;
+
+  uint8_t frame[WCB_FRAME_MAX_SIZE];
+  size_t frameLength = buildWCBFrame(frame, WCB_FRAME_SUBSCRIBE, 0, 0, payload, length);
+  queueESPNowSend(broadcastMACAddress[0], frame, frameLength);
+  subscribeStats.beaconsSent++;
+}
+
+void printSubscriptions() {
+  Serial.println("--------------- Subscriptions ----------------------");
+  uint32_t now = millis();
+  for (int wcb = 1; wcb <= Default_WCB_Quantity && wcb <= 9; wcb++) {
+    if (wcb == WCB_Number) continue;
+    portENTER_CRITICAL(&subscribeMux);
+    Subscription sub = subscriptions[wcb - 1];
+    portEXIT_CRITICAL(&subscribeMux);
+
+    if (!sub.valid || now - sub.heardAtMs > SUBSCRIBE_TIMEOUT_MS) {
+      Serial.printf("WCB%d: no advertisement, commands are broadcast\n", wcb);
+      continue;
+    }
+    Serial.printf("WCB%d:%s", wcb, (sub.flags & SUBSCRIBE_FLAG_CATCH_ALL) ? " all unrouted commands," : "");
+    for (int i = 0; i < sub.count; i++) {
+      Serial.printf(" \"%s\"", sub.prefixes[i]);
+    }
+    Serial.println();
+  }
+  portENTER_CRITICAL(&subscribeMux);
+  SubscribeStats stats = subscribeStats;
+  portEXIT_CRITICAL(&subscribeMux);
+  Serial.printf("Commands sent to subscribers %lu, to nobody %lu, broadcast %lu.  Beacons sent %lu, received %lu\n",
+                (unsigned long)stats.targeted, (unsigned long)stats.suppressed, (unsigned long)stats.broadcast,
+                (unsigned long)stats.beaconsSent, (unsigned long)stats.beaconsReceived);
+}
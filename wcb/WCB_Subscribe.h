@@ -0,0 +1,49 @@
+#ifndef WCB_SUBSCRIBE_H
+#define WCB_SUBSCRIBE_H
+
+#include <Arduino.h>
+#include "WCB_Frame.h"
+
+// =============== Prefix Subscriptions ===============
+// Every WCB advertises which commands its ports consume in a SUBSCRIBE beacon:
+// the prefixes of its routes that have local ports (see WCB_Routing.h), plus a
+// catch-all flag while any of its ports still takes broadcasts.  Beacons go out
+// every SUBSCRIBE_BEACON_MS, and right away when the advertisement changes, and
+// are relayed through the mesh like broadcast commands.
+//
+//   | flags (1) | count (1) | length (1) | prefix ... | length (1) | prefix ... |
+//
+// A command that matches no local route is then only sent to the WCBs that
+// want it, in one multicast frame.  It is still broadcast while any WCB's
+// advertisement is missing or stale (boards on older firmware never send one),
+// or when every other WCB wants it anyway.  A board that doesn't want a command
+// never hears it.
+//
+// The flags also tell whether a WCB can receive ESP-NOW v2 frames, so long
+// commands only go to it in one frame when it can.
+
+#define SUBSCRIBE_BEACON_MS        5000
+#define SUBSCRIBE_CHECK_MS         250                         // How often the local advertisement is rebuilt
+#define SUBSCRIBE_TIMEOUT_MS       (3 * SUBSCRIBE_BEACON_MS)   // Advertisements older than this are ignored
+#define SUBSCRIBE_MAX_PREFIXES     16                          // Prefixes kept per WCB
+#define SUBSCRIBE_PREFIX_MAX       15
+
+#define SUBSCRIBE_FLAG_CATCH_ALL   0x01    // Some port takes every command that matches no route
+#define SUBSCRIBE_FLAG_ESPNOW_V2   0x02    // Built with WCB_ESPNOW_V2, takes frames up to WCB_FRAME_BUFFER_SIZE
+
+typedef struct {
+  uint32_t beaconsSent;
+  uint32_t beaconsReceived;
+  uint32_t targeted;          // Commands sent only to the interested WCBs
+  uint32_t suppressed;        // Commands no other WCB wanted
+  uint32_t broadcast;         // Commands broadcast because advertisements were missing or everyone wanted them
+} SubscribeStats;
+
+// =============== Function Declarations ===============
+void publishCommand(const char *cmd, const char *message);
+void handleSubscribeBeacon(const wcb_frame &frame);
+bool wcbAcceptsLargeFrames(uint8_t wcb);
+void serviceSubscriptions();
+void printSubscriptions();
+
+#endif
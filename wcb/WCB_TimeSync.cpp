@@ -0,0 +1,293 @@
+#include "WCB_TimeSync.h"
+#include "WCB_CommandPool.h"
+#include "WCB_TxQueue.h"
+#include <esp_timer.h>
+
+extern uint8_t broadcastMACAddress[1][6];
+extern int WCB_Number;
+extern bool espnowLegacyFrames;
+extern bool debugEnabled;
+extern void runScheduledCommand(const char *cmd, int sourceID);
+
+// network time = local time + offset + drift since refLocal
+typedef struct {
+  int64_t refLocal;
+  int64_t refOffset;
+  float driftPpm;
+} NetworkClock;
+
+static NetworkClock networkClock = {};
+static bool clockSynced = false;
+static uint8_t outlierCount = 0;
+
+// The master we follow, the WCB we hear its time from (itself or a relay) and the last beacon we got from that
+static uint8_t masterWCB = 0;
+static uint8_t timeSource = 0;
+static uint8_t sourceHops = 0;
+static uint32_t sourceHeardMs = 0;
+static bool lastBeaconValid = false;
+static uint8_t lastBeaconId = 0;
+static int64_t lastBeaconRxLocal = 0;
+
+// Our own beacons while we are master
+static uint8_t nextBeaconId = 0;
+static uint8_t pendingBeaconId = 0;
+static bool sentBeaconValid = false;
+static uint8_t sentBeaconId = 0;
+static int64_t sentBeaconNetworkUs = 0;
+static uint32_t lastBeaconMs = 0;
+
+static TimeSyncStats timeStats = {};
+
+// Beacons arrive in the ESP-NOW receive task, send times in the Wi-Fi task, everything else runs in loop()
+static portMUX_TYPE timeMux = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct {
+  bool used;
+  uint8_t slot;
+  uint8_t sourceID;
+  int64_t atUs;
+} ScheduledCommand;
+
+// Only used from loop()
+static ScheduledCommand scheduledCommands[TIME_MAX_SCHEDULED];
+
+// Called with timeMux held
+static int64_t clockOffsetAt(int64_t local) {
+  return networkClock.refOffset + (int64_t)((float)(local - networkClock.refLocal) * networkClock.driftPpm / 1000000.0f);
+}
+
+// Called with timeMux held
+static bool isTimeMaster(uint32_t nowMs) {
+  if (nowMs < TIME_MASTER_TIMEOUT_MS) return false;     // Listen for a running master first
+  return !(masterWCB != 0 && masterWCB < WCB_Number && nowMs - sourceHeardMs < TIME_MASTER_TIMEOUT_MS);
+}
+
+int64_t networkTimeUs() {
+  int64_t local = esp_timer_get_time();
+  portENTER_CRITICAL(&timeMux);
+  int64_t network = local + clockOffsetAt(local);
+  portEXIT_CRITICAL(&timeMux);
+  return network;
+}
+
+// Network time at an earlier (or later) esp_timer time
+int64_t networkTimeAt(int64_t localUs) {
+  portENTER_CRITICAL(&timeMux);
+  int64_t network = localUs + clockOffsetAt(localUs);
+  portEXIT_CRITICAL(&timeMux);
+  return network;
+}
+
+bool networkTimeSynced() {
+  uint32_t nowMs = millis();
+  portENTER_CRITICAL(&timeMux);
+  bool synced = isTimeMaster(nowMs) || (clockSynced && nowMs - sourceHeardMs < TIME_MASTER_TIMEOUT_MS);
+  portEXIT_CRITICAL(&timeMux);
+  return synced;
+}
+
+// One offset sample: at local time local the master's clock read local + offset.  Called with timeMux held.
+static void applyTimeSample(int64_t local, int64_t offset) {
+  timeStats.samples++;
+  int64_t predicted = clockOffsetAt(local);
+  int64_t error = offset - predicted;
+
+  if (clockSynced && llabs(error) > TIME_STEP_US && ++outlierCount < TIME_MAX_OUTLIERS) {
+    timeStats.outliers++;
+    return;
+  }
+  if (!clockSynced || llabs(error) > TIME_STEP_US) {
+    networkClock.refLocal = local;
+    networkClock.refOffset = offset;
+    clockSynced = true;
+    outlierCount = 0;
+    timeStats.steps++;
+    return;
+  }
+
+  // Take half the error now and let the drift absorb the rest over the next samples
+  float elapsed = (float)(local - networkClock.refLocal);
+  if (elapsed > 0) {
+    float drift = networkClock.driftPpm + (float)error * 1000000.0f / elapsed / 8;
+    networkClock.driftPpm = constrain(drift, -TIME_MAX_DRIFT_PPM, TIME_MAX_DRIFT_PPM);
+  }
+  networkClock.refOffset = predicted + error / 2;
+  networkClock.refLocal = local;
+  outlierCount = 0;
+}
+
+// TIME frame from another WCB (ESP-NOW receive task).  receivedAt is micros() in the receive callback.
+void handleTimeBeacon(const wcb_frame &frame, uint32_t receivedAt) {
+  uint8_t sender = frame.header.sender;
+  if (frame.header.target != 0 || frame.header.length != sizeof(wcb_time_beacon) || sender < 1 || sender > 9) return;
+  wcb_time_beacon beacon;
+  memcpy(&beacon, frame.payload, sizeof(beacon));
+
+  int64_t now = esp_timer_get_time();
+  int64_t rxLocal = now - (uint32_t)((uint32_t)now - receivedAt);
+  uint32_t nowMs = millis();
+
+  portENTER_CRITICAL(&timeMux);
+  timeStats.beaconsReceived++;
+  // Our own time coming back, a relay that follows us, a worse master than us, or a loop counting up
+  if (beacon.master < 1 || beacon.master > 9 || beacon.master == WCB_Number || beacon.source == WCB_Number ||
+      beacon.hops >= TIME_MAX_HOPS || (isTimeMaster(nowMs) && beacon.master > WCB_Number)) {
+    portEXIT_CRITICAL(&timeMux);
+    return;
+  }
+  // Follow the lowest numbered master we hear, over the fewest hops
+  bool sourceAlive = timeSource != 0 && nowMs - sourceHeardMs < TIME_MASTER_TIMEOUT_MS;
+  if (!sourceAlive || beacon.master < masterWCB || (beacon.master == masterWCB && beacon.hops < sourceHops)) {
+    timeSource = sender;
+    lastBeaconValid = false;
+  } else if (sender != timeSource) {
+    portEXIT_CRITICAL(&timeMux);
+    return;
+  }
+  masterWCB = beacon.master;
+  sourceHops = beacon.hops;
+  sourceHeardMs = nowMs;
+
+  if (lastBeaconValid && beacon.id == (uint8_t)(lastBeaconId + 1) && beacon.previousSentUs != 0) {
+    applyTimeSample(lastBeaconRxLocal, beacon.previousSentUs - lastBeaconRxLocal);
+  }
+  lastBeaconValid = true;
+  lastBeaconId = beacon.id;
+  lastBeaconRxLocal = rxLocal;
+  portEXIT_CRITICAL(&timeMux);
+}
+
+// Send callback of our beacon (Wi-Fi task)
+static void timeBeaconSent(uint32_t cookie, bool success, int64_t sentAtUs) {
+  if (!success) return;
+  portENTER_CRITICAL(&timeMux);
+  sentBeaconNetworkUs = sentAtUs + clockOffsetAt(sentAtUs);
+  sentBeaconId = pendingBeaconId;
+  sentBeaconValid = true;
+  portEXIT_CRITICAL(&timeMux);
+}
+
+// Our clock, as master or as a relay of the master we follow
+static void sendTimeBeacon(bool master) {
+  wcb_time_beacon beacon;
+  portENTER_CRITICAL(&timeMux);
+  beacon.master = master ? WCB_Number : masterWCB;
+  beacon.hops = master ? 0 : sourceHops + 1;
+  beacon.source = master ? 0 : timeSource;
+  beacon.id = nextBeaconId;
+  beacon.previousSentUs = (sentBeaconValid && sentBeaconId == (uint8_t)(nextBeaconId - 1)) ? sentBeaconNetworkUs : 0;
+  pendingBeaconId = nextBeaconId++;
+  timeStats.beaconsSent++;
+  portEXIT_CRITICAL(&timeMux);
+
+  uint8_t frame[WCB_FRAME_MAX_SIZE];
+  size_t frameLength = buildWCBFrame(frame, WCB_FRAME_TIME, 0, 0, (const uint8_t *)&beacon, sizeof(beacon));
+  queueESPNowSendTimed(broadcastMACAddress[0], frame, frameLength, timeBeaconSent, 0);
+}
+
+// Waits in a pool slot until networkTimeUs() reaches atUs, then runs through runScheduledCommand()
+bool scheduleCommandAt(int64_t atUs, const char *cmd, size_t length, int sourceID) {
+  for (int i = 0; i < TIME_MAX_SCHEDULED; i++) {
+    ScheduledCommand &scheduled = scheduledCommands[i];
+    if (scheduled.used) continue;
+
+    scheduled.slot = allocateCommandSlot(length, false);
+    if (scheduled.slot == COMMAND_SLOT_NONE) break;
+    char *data = commandSlotData(scheduled.slot);
+    memcpy(data, cmd, length);
+    data[length] = '\0';
+    scheduled.sourceID = sourceID;
+    scheduled.atUs = atUs;
+    scheduled.used = true;
+    if (atUs < networkTimeUs()) timeStats.late++;
+    return true;
+  }
+  timeStats.dropped++;
+  return false;
+}
+
+// ?TIME_CLEAR: drop every command waiting for its time
+void clearScheduledCommands() {
+  int cleared = 0;
+  for (int i = 0; i < TIME_MAX_SCHEDULED; i++) {
+    ScheduledCommand &scheduled = scheduledCommands[i];
+    if (!scheduled.used) continue;
+    scheduled.used = false;
+    releaseCommandSlot(scheduled.slot);
+    cleared++;
+  }
+  Serial.printf("Cleared %d scheduled command(s)\n", cleared);
+}
+
+void countUnsyncedTimedCommand() {
+  timeStats.unsynced++;
+}
+
+void countRefusedTimedCommand() {
+  timeStats.refused++;
+}
+
+// Called from loop(): beacon while we are master or relay its time and run the commands that are due, earliest first
+void serviceTimeSync() {
+  uint32_t nowMs = millis();
+  if (!espnowLegacyFrames && nowMs - lastBeaconMs >= TIME_BEACON_MS) {
+    portENTER_CRITICAL(&timeMux);
+    bool master = isTimeMaster(nowMs);
+    bool relay = !master && clockSynced && nowMs - sourceHeardMs < TIME_MASTER_TIMEOUT_MS &&
+                 sourceHops + 1 < TIME_MAX_HOPS;
+    portEXIT_CRITICAL(&timeMux);
+    if (master || relay) {
+      lastBeaconMs = nowMs;
+      sendTimeBeacon(master);
+    }
+  }
+
+  while (true) {
+    int64_t now = networkTimeUs();
+    ScheduledCommand *due = nullptr;
+    for (int i = 0; i < TIME_MAX_SCHEDULED; i++) {
+      ScheduledCommand &scheduled = scheduledCommands[i];
+      if (scheduled.used && scheduled.atUs <= now && (!due || scheduled.atUs < due->atUs)) due = &scheduled;
+    }
+    if (!due) return;
+
+    due->used = false;
+    timeStats.scheduled++;
+    if (debugEnabled) { Serial.printf("Running command scheduled for %lld ms, %lld us late\n", due->atUs / 1000, now - due->atUs); }
+    runScheduledCommand(commandSlotData(due->slot), due->sourceID);
+    releaseCommandSlot(due->slot);
+  }
+}
+
+void printTimeSync() {
+  uint32_t nowMs = millis();
+  int64_t network = networkTimeUs();
+  portENTER_CRITICAL(&timeMux);
+  bool master = isTimeMaster(nowMs);
+  uint8_t following = masterWCB;
+  uint8_t source = timeSource;
+  uint8_t hops = sourceHops;
+  bool synced = clockSynced && nowMs - sourceHeardMs < TIME_MASTER_TIMEOUT_MS;
+  NetworkClock clock = networkClock;
+  TimeSyncStats stats = timeStats;
+  portEXIT_CRITICAL(&timeMux);
+
+  Serial.println("--------------- Network Time ----------------------");
+  if (master) {
+    Serial.printf("Time master, network time %lld ms\n", network / 1000);
+  } else if (synced) {
+    Serial.printf("Following WCB%d", following);
+    if (source != following) Serial.printf(" via WCB%d (%u hops)", source, hops + 1);
+    Serial.printf(", network time %lld ms, offset %lld us, drift %.1f ppm\n", network / 1000, clock.refOffset,
+                  clock.driftPpm);
+  } else {
+    Serial.printf("Not synchronized, network time %lld ms\n", network / 1000);
+  }
+  Serial.printf("Beacons sent %lu, received %lu.  Samples %lu, steps %lu, outliers %lu\n",
+                (unsigned long)stats.beaconsSent, (unsigned long)stats.beaconsReceived, (unsigned long)stats.samples,
+                (unsigned long)stats.steps, (unsigned long)stats.outliers);
+  Serial.printf("Scheduled commands run %lu (%lu late), dropped %lu, run unsynchronized %lu, refused %lu\n",
+                (unsigned long)stats.scheduled, (unsigned long)stats.late, (unsigned long)stats.dropped,
+                (unsigned long)stats.unsynced, (unsigned long)stats.refused);
+}
@@ -0,0 +1,85 @@
+#ifndef WCB_TIMESYNC_H
+#define WCB_TIMESYNC_H
+
+#include <Arduino.h>
+#include "WCB_Frame.h"
+
+// =============== Network Time ===============
+// The WCBs share a network clock so an effect spread over several boards can
+// fire at the same moment instead of whenever each copy gets through its
+// queues.  The lowest numbered WCB that is up is the time master and
+// broadcasts a TIME beacon every TIME_BEACON_MS.  Each beacon carries the
+// network time the previous beacon left the sender's radio (taken in its send
+// callback), and the others note when they received it, so every beacon pair
+// gives one offset sample without queueing delays in it:
+//
+//   | id (1) | master (1) | hops (1) | source (1) | network time beacon id - 1 was sent, us (8) |
+//
+// Offset and drift follow the samples like a PLL; a jump bigger than
+// TIME_STEP_US is only taken after TIME_MAX_OUTLIERS samples agree.  A WCB
+// waits TIME_MASTER_TIMEOUT_MS after boot before it may become master and
+// takes over the clock it followed until then, so the network time doesn't
+// jump when WCB1 reboots.
+//
+// Beacons aren't forwarded by the mesh, a relayed copy would arrive late by
+// however long it queued.  Instead every synchronized WCB sends beacons of its
+// own clock, one hop further from the master, and a WCB follows whichever
+// sender it hears with the lowest master, then the fewest hops.  So WCBs out
+// of the master's range follow a WCB in between.  source is the WCB the sender
+// follows; nobody follows a WCB that follows them, and beacons of
+// TIME_MAX_HOPS hops are ignored, so a loop left behind by a vanished master
+// dies out.
+//
+//   ;T250,:PP100         run :PP100 250 ms from now on every WCB it goes to
+//   ;T@81234567,:PP100   run it at network time 81234567 ms
+//   ?TIME_CLEAR          drop the commands waiting on this WCB
+//
+// The first form is turned into the second before the command leaves this
+// WCB, unless this WCB isn't synchronized: then the other WCBs get the delay
+// as it is.  A ;T@ that arrives while this WCB isn't synchronized runs right
+// away, there is no telling when it is due.  Times more than
+// TIME_MAX_HORIZON_MS ahead are refused.
+
+#define TIME_BEACON_MS            1000
+#define TIME_MASTER_TIMEOUT_MS    (3 * TIME_BEACON_MS + 500)    // A master not heard for this long is gone
+#define TIME_STEP_US              2000      // Larger errors are stepped instead of slewed
+#define TIME_MAX_OUTLIERS         3         // Samples in a row that must agree on a step
+#define TIME_MAX_DRIFT_PPM        200.0f
+#define TIME_MAX_SCHEDULED        8         // Commands waiting for their time
+#define TIME_MAX_HORIZON_MS       60000     // Furthest ahead a command may be scheduled
+#define TIME_MAX_HOPS             4         // Beacons this many relays from the master are ignored
+
+typedef struct __attribute__((packed)) {
+  uint8_t id;
+  uint8_t master;             // Time master the sender follows, itself if it is master
+  uint8_t hops;               // WCBs between the master and the sender, 0 from the master
+  uint8_t source;             // WCB the sender takes its time from, 0 from the master
+  int64_t previousSentUs;     // Network time beacon id - 1 was sent, 0 if unknown
+} wcb_time_beacon;
+
+typedef struct {
+  uint32_t beaconsSent;       // Including the ones relaying the master's time
+  uint32_t beaconsReceived;
+  uint32_t samples;           // Offset samples taken
+  uint32_t steps;             // Times the clock jumped instead of slewing
+  uint32_t outliers;          // Samples ignored as too far off
+  uint32_t scheduled;         // Commands run at a network time
+  uint32_t late;              // Of those, commands that arrived after their time
+  uint32_t dropped;           // Commands that found no free place to wait
+  uint32_t unsynced;          // ;T@ commands run right away because the clock wasn't synchronized
+  uint32_t refused;           // Commands refused for being more than TIME_MAX_HORIZON_MS ahead
+} TimeSyncStats;
+
+// =============== Function Declarations ===============
+int64_t networkTimeUs();
+int64_t networkTimeAt(int64_t localUs);
+bool networkTimeSynced();
+void handleTimeBeacon(const wcb_frame &frame, uint32_t receivedAt);
+void serviceTimeSync();
+bool scheduleCommandAt(int64_t atUs, const char *cmd, size_t length, int sourceID);
+void clearScheduledCommands();
+void countUnsyncedTimedCommand();
+void countRefusedTimedCommand();
+void printTimeSync();
+
+#endif
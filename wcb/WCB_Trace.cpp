@@ -0,0 +1,122 @@
+#include "WCB_Trace.h"
+#include "WCB_TimeSync.h"
+#include <esp_timer.h>
+
+extern int WCB_Number;
+extern char CommandCharacter;
+
+bool traceEnabled = false;
+
+static const char *const traceStageNames[TRACE_STAGES] = {
+  "serial_rx", "queued", "run", "port_queued", "port_sent",
+  "espnow_queued", "espnow_submitted", "espnow_sent", "espnow_rx",
+};
+
+static TraceRecord traceRing[TRACE_RING_SIZE];
+static uint32_t traceHead = 0;          // Total records written, the oldest are overwritten
+static uint32_t nextTraceCounter = 0;
+
+// Records come from loop(), the serial tasks, the ESP-NOW tasks and the Wi-Fi task
+static portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+
+// The command loop() is running, see currentTraceId()
+static uint32_t loopTraceId = 0;
+static TaskHandle_t loopTraceTask = nullptr;
+
+// New trace for a line that started arriving on a serial port at startedUs (esp_timer).  0 while tracing is off.
+uint32_t startTrace(int sourceID, int64_t startedUs) {
+  if (!traceEnabled) return 0;
+  portENTER_CRITICAL(&traceMux);
+  uint32_t counter = ++nextTraceCounter & 0xFFFFFF;
+  if (counter == 0) counter = ++nextTraceCounter & 0xFFFFFF;
+  portEXIT_CRITICAL(&traceMux);
+  uint32_t traceId = ((uint32_t)WCB_Number << 24) | counter;
+  traceEventAt(traceId, TRACE_SERIAL_RX, sourceID, startedUs);
+  return traceId;
+}
+
+void traceEvent(uint32_t traceId, uint8_t stage, uint8_t detail) {
+  if (traceId == 0 || !traceEnabled) return;
+  traceEventAt(traceId, stage, detail, esp_timer_get_time());
+}
+
+// Same, for a stage that happened at localUs (esp_timer)
+void traceEventAt(uint32_t traceId, uint8_t stage, uint8_t detail, int64_t localUs) {
+  if (traceId == 0 || !traceEnabled) return;
+  TraceRecord record;
+  record.atUs = networkTimeAt(localUs);
+  record.traceId = traceId;
+  record.stage = stage;
+  record.detail = detail;
+  portENTER_CRITICAL(&traceMux);
+  traceRing[traceHead++ & (TRACE_RING_SIZE - 1)] = record;
+  portEXIT_CRITICAL(&traceMux);
+}
+
+// Called from loop() around each command it runs
+void setCurrentTraceId(uint32_t traceId) {
+  loopTraceTask = xTaskGetCurrentTaskHandle();
+  loopTraceId = traceId;
+}
+
+// Trace of the command loop() is running.  Always 0 in other tasks, whatever they send isn't part of it.
+uint32_t currentTraceId() {
+  if (loopTraceId == 0 || xTaskGetCurrentTaskHandle() != loopTraceTask) return 0;
+  return loopTraceId;
+}
+
+// ;#2-417, into out (TRACE_TAG_MAX bytes).  Returns its length.
+size_t formatTraceTag(uint32_t traceId, char *out) {
+  return snprintf(out, TRACE_TAG_MAX, "%c#%lu-%lu,", CommandCharacter, (unsigned long)(traceId >> 24),
+                  (unsigned long)(traceId & 0xFFFFFF));
+}
+
+// Length of the trace tag cmd starts with (its ID in *traceId), or 0 if it has none
+size_t parseTraceTag(const char *cmd, size_t length, uint32_t *traceId) {
+  if (length < 6 || cmd[0] != CommandCharacter || cmd[1] != '#' || !isdigit((unsigned char)cmd[2]) || cmd[3] != '-') {
+    return 0;
+  }
+  uint32_t counter = 0;
+  size_t i = 4;
+  while (i < length && isdigit((unsigned char)cmd[i])) {
+    counter = counter * 10 + (cmd[i] - '0');
+    i++;
+  }
+  if (i == 4 || i >= length || cmd[i] != ',') return 0;
+  *traceId = ((uint32_t)(cmd[2] - '0') << 24) | (counter & 0xFFFFFF);
+  return i + 1;
+}
+
+// The ring, oldest first, as a Chrome trace
+void dumpTrace() {
+  portENTER_CRITICAL(&traceMux);
+  uint32_t head = traceHead;
+  portEXIT_CRITICAL(&traceMux);
+  uint32_t count = min(head, (uint32_t)TRACE_RING_SIZE);
+
+  Serial.printf("{\"otherData\":{\"wcb\":%d,\"synced\":%s,\"records\":%lu},\"traceEvents\":[\n", WCB_Number,
+                networkTimeSynced() ? "true" : "false", (unsigned long)count);
+  bool first = true;
+  for (uint32_t i = head - count; i != head; i++) {
+    portENTER_CRITICAL(&traceMux);
+    TraceRecord record = traceRing[i & (TRACE_RING_SIZE - 1)];
+    bool overwritten = traceHead - i > TRACE_RING_SIZE;
+    portEXIT_CRITICAL(&traceMux);
+    if (overwritten || record.stage >= TRACE_STAGES) continue;
+
+    Serial.printf("%s{\"name\":\"%s\",\"cat\":\"wcb\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%lu,"
+                  "\"args\":{\"trace\":\"%lu-%lu\",\"detail\":%u}}",
+                  first ? "" : ",\n", traceStageNames[record.stage], record.atUs, WCB_Number,
+                  (unsigned long)record.traceId, (unsigned long)(record.traceId >> 24),
+                  (unsigned long)(record.traceId & 0xFFFFFF), record.detail);
+    first = false;
+  }
+  Serial.println();
+  Serial.println("]}");
+}
+
+void clearTrace() {
+  portENTER_CRITICAL(&traceMux);
+  traceHead = 0;
+  portEXIT_CRITICAL(&traceMux);
+}
@@ -0,0 +1,59 @@
+#ifndef WCB_TRACE_H
+#define WCB_TRACE_H
+
+#include <Arduino.h>
+
+// =============== Command Latency Tracing ===============
+// With ?TRACE1 every line read from a serial port gets a trace ID, origin WCB
+// and a counter, and each stage the command passes through is recorded in a
+// ring of TRACE_RING_SIZE records.  Commands sent on to other WCBs carry the
+// ID in a tag in front of the command, ;#2-417,:OP01, which the receiving WCB
+// strips (whether or not it traces) before it queues the command under the
+// same ID, so the ID follows the command across hops.
+//
+// Times are esp_timer microseconds, not cycle counts: the two cores count
+// cycles separately and the counter wraps every 18 s.  Each time is stored as
+// network time (WCB_TimeSync.h), so the records of different WCBs can be put
+// on one timeline as they are.  ?TRACE_DUMP prints the ring as a Chrome trace
+// (JSON, one instant event per record, pid = WCB, tid = trace ID); merge the
+// traceEvents of every WCB's dump and open it in Perfetto or chrome://tracing.
+//
+// Only turn tracing on once every WCB runs firmware that knows the tag.
+
+#define TRACE_RING_SIZE         256     // Records kept, must be a power of two
+
+// Stages, in the order a command normally passes them
+#define TRACE_SERIAL_RX         0       // Serial task read the line's first byte     detail: port
+#define TRACE_QUEUED            1       // Put in a command lane                      detail: source ID
+#define TRACE_RUN               2       // loop() took it out of its lane
+#define TRACE_PORT_QUEUED       3       // Written to a port's transmit ring          detail: port
+#define TRACE_PORT_SENT         4       // Serial TX task handed its last byte to the driver   detail: port
+#define TRACE_ESPNOW_QUEUED     5       // Given to the ESP-NOW send path             detail: target WCB, 0 = several
+#define TRACE_ESPNOW_SUBMITTED  6       // Frame accepted by esp_now_send()
+#define TRACE_ESPNOW_SENT       7       // Send callback of the frame                 detail: 1 = delivered
+#define TRACE_ESPNOW_RX         8       // Receive callback on this WCB               detail: sender WCB
+#define TRACE_STAGES            9
+
+#define TRACE_TAG_MAX           16      // ";#9-16777215," and a terminator
+
+typedef struct {
+  int64_t atUs;             // Network time
+  uint32_t traceId;         // Origin WCB << 24 | counter
+  uint8_t stage;
+  uint8_t detail;
+} TraceRecord;
+
+extern bool traceEnabled;
+
+// =============== Function Declarations ===============
+uint32_t startTrace(int sourceID, int64_t startedUs);
+void traceEvent(uint32_t traceId, uint8_t stage, uint8_t detail);
+void traceEventAt(uint32_t traceId, uint8_t stage, uint8_t detail, int64_t localUs);
+void setCurrentTraceId(uint32_t traceId);
+uint32_t currentTraceId();
+size_t formatTraceTag(uint32_t traceId, char *out);
+size_t parseTraceTag(const char *cmd, size_t length, uint32_t *traceId);
+void dumpTrace();
+void clearTrace();
+
+#endif
@@ -0,0 +1,327 @@
+#include "WCB_Tunnel.h"
+#include "WCB_SerialTx.h"
+#include "WCB_Mesh.h"
+#include "WCB_TxQueue.h"
+
+extern uint8_t WCBMacAddresses[9][6];
+extern Stream &getSerialStream(int port);
+
+TunnelBinding tunnelBindings[TUNNEL_CHANNELS];
+
+typedef struct {
+  // Sending side, offsets count bytes since the channel was bound
+  uint8_t buffer[TUNNEL_BUFFER_SIZE];
+  uint32_t writeOffset;       // End of the bytes read from the port
+  uint32_t sendOffset;        // Next byte to send
+  uint32_t ackOffset;         // First byte not yet acknowledged
+  uint16_t credit;            // Bytes the peer can take beyond ackOffset
+  uint16_t session;
+  uint32_t sessionStart;      // Offset of the session's byte 0
+  uint32_t binding;           // Counts bindings, so a bind while the port is being read is noticed
+  uint32_t lastProgressMs;    // Last send from an idle channel or ACK that moved ackOffset
+  bool stalled;
+
+  // Receiving side
+  bool peerKnown;
+  uint16_t peerSession;
+  uint32_t expectedOffset;
+
+  TunnelStats stats;
+} TunnelChannel;
+
+static TunnelChannel tunnelChannels[TUNNEL_CHANNELS];
+
+// Offsets and credit are shared by the serial task (sending) and the ESP-NOW receive task (ACKs)
+static portMUX_TYPE tunnelMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void resetTunnelChannel(int index) {
+  portENTER_CRITICAL(&tunnelMux);
+  TunnelChannel &channel = tunnelChannels[index];
+  channel.writeOffset = 0;
+  channel.sendOffset = 0;
+  channel.ackOffset = 0;
+  channel.credit = TUNNEL_INITIAL_CREDIT;
+  channel.session = esp_random();
+  channel.sessionStart = 0;
+  channel.binding++;
+  channel.stalled = false;
+  channel.peerKnown = false;
+  channel.stats = {};
+  portEXIT_CRITICAL(&tunnelMux);
+}
+
+void initTunnels() {
+  for (int i = 0; i < TUNNEL_CHANNELS; i++) {
+    resetTunnelChannel(i);
+  }
+}
+
+// channel 1-TUNNEL_CHANNELS, port 1-5, wcb 1-9.  The caller checks that the port is free to use.
+bool bindTunnel(int channel, int port, int wcb) {
+  if (channel < 1 || channel > TUNNEL_CHANNELS || port < 1 || port > 5 || wcb < 1 || wcb > 9) return false;
+  for (int i = 0; i < TUNNEL_CHANNELS; i++) {
+    if (i != channel - 1 && tunnelBindings[i].port == port) return false;
+  }
+
+  // The port stops being read for commands before the channel starts reading it
+  resetTunnelChannel(channel - 1);
+  portENTER_CRITICAL(&tunnelMux);
+  tunnelBindings[channel - 1].port = port;
+  tunnelBindings[channel - 1].wcb = wcb;
+  portEXIT_CRITICAL(&tunnelMux);
+  return true;
+}
+
+void clearTunnel(int channel) {
+  if (channel < 1 || channel > TUNNEL_CHANNELS) return;
+  portENTER_CRITICAL(&tunnelMux);
+  tunnelBindings[channel - 1].port = 0;
+  tunnelBindings[channel - 1].wcb = 0;
+  portEXIT_CRITICAL(&tunnelMux);
+}
+
+bool isTunnelPort(int port) {
+  for (int i = 0; i < TUNNEL_CHANNELS; i++) {
+    if (port != 0 && tunnelBindings[i].port == port) return true;
+  }
+  return false;
+}
+
+static void sendTunnelFrame(uint8_t wcb, const wcb_tunnel_header &header, const uint8_t *data, size_t len) {
+  uint8_t payload[WCB_FRAME_MAX_PAYLOAD];
+  memcpy(payload, &header, sizeof(header));
+  if (len > 0) {
+    memcpy(payload + sizeof(header), data, len);
+  }
+
+  uint8_t frame[WCB_FRAME_MAX_SIZE];
+  size_t frameLength = buildWCBFrame(frame, WCB_FRAME_TUNNEL, 0, wcb, payload, sizeof(header) + len);
+  queueESPNowSend(WCBMacAddresses[meshNextHop(wcb) - 1], frame, frameLength);
+}
+
+// Read the port, retransmit on timeout and send as much as the peer's credit allows
+static void serviceTunnelChannel(int index, uint32_t now) {
+  TunnelChannel &channel = tunnelChannels[index];
+  const TunnelBinding binding = tunnelBindings[index];
+  Stream &serial = getSerialStream(binding.port);
+
+  // Only this task writes the buffer, the ACK handler just moves ackOffset forward
+  portENTER_CRITICAL(&tunnelMux);
+  uint32_t bindingCount = channel.binding;
+  uint32_t writeOffset = channel.writeOffset;
+  uint32_t room = TUNNEL_BUFFER_SIZE - (writeOffset - channel.ackOffset);
+  portEXIT_CRITICAL(&tunnelMux);
+  while (room > 0 && serial.available()) {
+    channel.buffer[writeOffset++ & (TUNNEL_BUFFER_SIZE - 1)] = serial.read();
+    room--;
+  }
+
+  bool probe = false;
+  portENTER_CRITICAL(&tunnelMux);
+  if (channel.binding != bindingCount) {
+    // The channel was bound again while we were reading
+    portEXIT_CRITICAL(&tunnelMux);
+    return;
+  }
+  channel.writeOffset = writeOffset;
+  bool waiting = channel.sendOffset != channel.ackOffset ||
+                 (channel.stalled && channel.writeOffset != channel.sendOffset);
+  if (waiting && now - channel.lastProgressMs >= TUNNEL_RETRANSMIT_MS) {
+    // Go back to the first unacknowledged byte; one frame may go out even without credit to learn the peer's window
+    channel.sendOffset = channel.ackOffset;
+    channel.lastProgressMs = now;
+    channel.stats.retransmits++;
+    probe = true;
+  }
+  portEXIT_CRITICAL(&tunnelMux);
+
+  while (true) {
+    wcb_tunnel_header header;
+    uint8_t data[TUNNEL_MAX_DATA];
+    size_t len;
+
+    portENTER_CRITICAL(&tunnelMux);
+    uint32_t pending = channel.writeOffset - channel.sendOffset;
+    uint32_t inFlight = channel.sendOffset - channel.ackOffset;
+    uint32_t allowed = (channel.credit > inFlight) ? channel.credit - inFlight : 0;
+    if (allowed == 0 && probe) {
+      allowed = TUNNEL_MAX_DATA;
+      probe = false;
+    }
+    if (pending > 0 && allowed == 0 && !channel.stalled) {
+      channel.stalled = true;
+      channel.stats.stalls++;
+    }
+    len = min(pending, min(allowed, (uint32_t)TUNNEL_MAX_DATA));
+    if (len == 0) {
+      portEXIT_CRITICAL(&tunnelMux);
+      break;
+    }
+    header.channel = index + 1;
+    header.kind = TUNNEL_DATA;
+    header.session = channel.session;
+    header.offset = channel.sendOffset - channel.sessionStart;
+    header.credit = 0;
+    if (channel.sendOffset == channel.ackOffset) {
+      channel.lastProgressMs = now;   // Start the retransmit timer
+    }
+    uint32_t offset = channel.sendOffset;
+    channel.sendOffset += len;
+    portEXIT_CRITICAL(&tunnelMux);
+
+    // Bytes from ackOffset on are never overwritten, so they can be copied outside the lock
+    for (size_t i = 0; i < len; i++) {
+      data[i] = channel.buffer[(offset + i) & (TUNNEL_BUFFER_SIZE - 1)];
+    }
+    sendTunnelFrame(binding.wcb, header, data, len);
+  }
+}
+
+// Called from the serial task on every pass
+void serviceTunnels() {
+  uint32_t now = millis();
+  for (int i = 0; i < TUNNEL_CHANNELS; i++) {
+    if (tunnelBindings[i].port != 0) {
+      serviceTunnelChannel(i, now);
+    }
+  }
+}
+
+static void handleTunnelData(int index, uint8_t sender, const wcb_tunnel_header &header,
+                             const uint8_t *data, size_t len) {
+  TunnelChannel &channel = tunnelChannels[index];
+  int port = tunnelBindings[index].port;
+
+  wcb_tunnel_header reply;
+  reply.channel = index + 1;
+  reply.session = header.session;
+  reply.offset = 0;
+  reply.credit = 0;
+
+  if (!channel.peerKnown || header.session != channel.peerSession) {
+    if (header.offset != 0) {
+      // Picking the stream up here would silently lose what came before; have the sender start over
+      channel.stats.outOfOrder++;
+      reply.kind = TUNNEL_RESET;
+      sendTunnelFrame(sender, reply, nullptr, 0);
+      return;
+    }
+    // New session: the peer (re)bound the channel or restarted the session
+    channel.peerKnown = true;
+    channel.peerSession = header.session;
+    channel.expectedOffset = 0;
+  }
+
+  if (header.offset == channel.expectedOffset) {
+    // A write that doesn't fit is dropped here and sent again by the peer
+    if (queueSerialWrite(port, data, len, false)) {
+      channel.expectedOffset += len;
+      channel.stats.bytesReceived += len;
+    }
+  } else {
+    channel.stats.outOfOrder++;
+  }
+
+  // Acknowledge every DATA frame, also duplicates, in case our last ACK was lost
+  reply.kind = TUNNEL_ACK;
+  reply.offset = channel.expectedOffset;
+  reply.credit = min(serialTxFree(port), (size_t)UINT16_MAX);
+  sendTunnelFrame(sender, reply, nullptr, 0);
+}
+
+static void handleTunnelAck(int index, const wcb_tunnel_header &header) {
+  TunnelChannel &channel = tunnelChannels[index];
+
+  portENTER_CRITICAL(&tunnelMux);
+  if (header.session == channel.session) {
+    uint32_t advance = channel.sessionStart + header.offset - channel.ackOffset;
+    // Ignore ACKs for bytes we never read, and stale ones from before the last ACK
+    if (advance <= channel.writeOffset - channel.ackOffset) {
+      if (advance > 0) {
+        channel.ackOffset += advance;
+        channel.lastProgressMs = millis();
+        channel.stats.bytesSent += advance;
+        if ((int32_t)(channel.sendOffset - channel.ackOffset) < 0) {
+          channel.sendOffset = channel.ackOffset;
+        }
+      }
+      channel.credit = header.credit;
+      if (channel.credit > 0) {
+        channel.stalled = false;
+      }
+    }
+  }
+  portEXIT_CRITICAL(&tunnelMux);
+}
+
+// The peer doesn't know our session: start a new one at the first byte it hasn't acknowledged
+static void handleTunnelReset(int index, const wcb_tunnel_header &header) {
+  TunnelChannel &channel = tunnelChannels[index];
+
+  portENTER_CRITICAL(&tunnelMux);
+  // RESETs for frames still in flight from the old session are ignored once we moved on
+  if (header.session == channel.session) {
+    channel.session = esp_random();
+    channel.sessionStart = channel.ackOffset;
+    channel.sendOffset = channel.ackOffset;
+    channel.lastProgressMs = millis();
+    channel.stats.resets++;
+  }
+  portEXIT_CRITICAL(&tunnelMux);
+}
+
+// TUNNEL frame for us (ESP-NOW receive task)
+void handleTunnelFrame(const wcb_frame &frame) {
+  if (frame.header.length < sizeof(wcb_tunnel_header)) return;
+  wcb_tunnel_header header;
+  memcpy(&header, frame.payload, sizeof(header));
+
+  if (header.channel < 1 || header.channel > TUNNEL_CHANNELS) return;
+  int index = header.channel - 1;
+  // Only the WCB at the other end of the channel may use it
+  if (tunnelBindings[index].port == 0 || tunnelBindings[index].wcb != frame.header.sender) return;
+
+  if (header.kind == TUNNEL_DATA) {
+    handleTunnelData(index, frame.header.sender, header, frame.payload + sizeof(header),
+                     frame.header.length - sizeof(header));
+  } else if (header.kind == TUNNEL_ACK) {
+    handleTunnelAck(index, header);
+  } else if (header.kind == TUNNEL_RESET) {
+    handleTunnelReset(index, header);
+  }
+}
+
+void printTunnelSettings() {
+  bool any = false;
+  for (int i = 0; i < TUNNEL_CHANNELS; i++) {
+    if (tunnelBindings[i].port == 0) continue;
+    any = true;
+    Serial.printf("Tunnel %d: Serial%d <-> WCB%d\n", i + 1, tunnelBindings[i].port, tunnelBindings[i].wcb);
+  }
+  if (!any) {
+    Serial.println("No serial tunnels configured.");
+  }
+}
+
+void printTunnelStats() {
+  Serial.println("--------------- Serial Tunnels ----------------------");
+  bool any = false;
+  for (int i = 0; i < TUNNEL_CHANNELS; i++) {
+    if (tunnelBindings[i].port == 0) continue;
+    any = true;
+    portENTER_CRITICAL(&tunnelMux);
+    TunnelStats stats = tunnelChannels[i].stats;
+    uint32_t unacked = tunnelChannels[i].writeOffset - tunnelChannels[i].ackOffset;
+    uint16_t credit = tunnelChannels[i].credit;
+    portEXIT_CRITICAL(&tunnelMux);
+    Serial.printf("Tunnel %d (Serial%d <-> WCB%d): sent %lu, received %lu bytes, %lu waiting, credit %u, "
+                  "retransmits %lu, out of order %lu, stalls %lu, session resets %lu\n",
+                  i + 1, tunnelBindings[i].port, tunnelBindings[i].wcb,
+                  (unsigned long)stats.bytesSent, (unsigned long)stats.bytesReceived, (unsigned long)unacked, credit,
+                  (unsigned long)stats.retransmits, (unsigned long)stats.outOfOrder, (unsigned long)stats.stalls,
+                  (unsigned long)stats.resets);
+  }
+  if (!any) {
+    Serial.println("No serial tunnels configured.");
+  }
+}
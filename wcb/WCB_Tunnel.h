@@ -0,0 +1,79 @@
+#ifndef WCB_TUNNEL_H
+#define WCB_TUNNEL_H
+
+#include <Arduino.h>
+#include "WCB_Frame.h"
+
+// =============== Serial Tunnels ===============
+// A tunnel joins a local serial port to a port on another WCB as a
+// transparent, binary-safe byte stream, e.g. to run a Roboteq or Maestro
+// configuration session across the droid.  Both ends bind their own port to
+// the same channel with each other's WCB number:
+//
+//   WCB1: ?TUNNEL1,3,2     channel 1 = local Serial3 <-> WCB2
+//   WCB2: ?TUNNEL1,5,1     channel 1 = local Serial5 <-> WCB1
+//
+// A tunnelled port is no longer parsed for commands or sent broadcasts.
+// TUNNEL frames carry a small tunnel header after the frame header:
+//
+//   | channel | kind | session (2) | offset (4) | credit (2) | data ... |
+//
+// DATA frames carry the stream offset of their first byte; the receiver only
+// takes the next expected offset, so bytes are written in order exactly once.
+// Offsets count from the start of the session, and a receiver only takes up a
+// new session with its byte 0.  DATA of a session the receiver doesn't know,
+// past byte 0 (the receiver rebooted or was bound again mid-stream), is
+// answered with RESET; the sender then starts a new session whose byte 0 is
+// its first unacknowledged byte.
+// ACK frames return the next expected offset and how many more bytes the
+// receiving port's transmit ring can take (credit).  The sender never has
+// more than credit bytes unacknowledged and goes back to the last
+// acknowledged byte if no ACK arrives in time.  While it can't send, it stops
+// reading its port, so the backlog stays in the UART's receive buffer.
+
+#define TUNNEL_CHANNELS           4
+#define TUNNEL_BUFFER_SIZE        1024    // Bytes read from the port but not yet acknowledged, power of two
+#define TUNNEL_INITIAL_CREDIT     256     // Assumed until the peer's first ACK
+#define TUNNEL_RETRANSMIT_MS      50
+
+#define TUNNEL_DATA               1
+#define TUNNEL_ACK                2
+#define TUNNEL_RESET              3
+
+typedef struct __attribute__((packed)) {
+  uint8_t  channel;
+  uint8_t  kind;          // TUNNEL_DATA, TUNNEL_ACK or TUNNEL_RESET
+  uint16_t session;       // Picked by the data sender for each session, echoed in ACKs and RESETs
+  uint32_t offset;        // DATA: session offset of the first byte, ACK: next offset expected
+  uint16_t credit;        // ACK: bytes the receiver can take beyond offset
+} wcb_tunnel_header;
+
+#define TUNNEL_MAX_DATA   (WCB_FRAME_MAX_PAYLOAD - sizeof(wcb_tunnel_header))
+
+typedef struct {
+  uint8_t port;           // Local Serial1-5, 0 = channel unused
+  uint8_t wcb;            // WCB at the other end
+} TunnelBinding;
+
+typedef struct {
+  uint32_t bytesSent;         // Bytes acknowledged by the peer
+  uint32_t bytesReceived;     // Bytes written to the local port
+  uint32_t retransmits;
+  uint32_t outOfOrder;        // DATA frames dropped because they weren't the next expected
+  uint32_t resets;            // Sessions restarted because the peer didn't know ours
+  uint32_t stalls;            // Times the peer's credit ran out
+} TunnelStats;
+
+extern TunnelBinding tunnelBindings[TUNNEL_CHANNELS];
+
+// =============== Function Declarations ===============
+void initTunnels();
+bool bindTunnel(int channel, int port, int wcb);
+void clearTunnel(int channel);
+bool isTunnelPort(int port);
+void serviceTunnels();
+void handleTunnelFrame(const wcb_frame &frame);
+void printTunnelSettings();
+void printTunnelStats();
+
+#endif
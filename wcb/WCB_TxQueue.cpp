@@ -0,0 +1,231 @@
+#include "WCB_TxQueue.h"
+#include "WCB_Trace.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+typedef struct {
+  uint8_t mac[6];
+  uint16_t length;
+  ESPNowSentCallback onSent;
+  uint32_t cookie;
+  uint32_t traceId;
+  uint8_t data[WCB_FRAME_BUFFER_SIZE];
+} ESPNowTxEntry;
+
+// A frame handed to the driver, waiting for its send status
+typedef struct {
+  uint8_t mac[6];
+  ESPNowSentCallback onSent;
+  uint32_t cookie;
+  uint32_t traceId;
+  uint32_t generation;      // txGeneration when it was submitted, older ones were given up on at a stall
+} ESPNowInFlight;
+
+// Frames in flight plus the ones given up on at the last stall, whose completion may still come
+#define ESPNOW_TX_TRACKED   (2 * ESPNOW_TX_MAX_IN_FLIGHT)
+
+static ESPNowTxEntry txQueue[ESPNOW_TX_QUEUE_SIZE];
+static uint32_t txHead = 0;           // Next entry a sender fills
+static uint32_t txTail = 0;           // Next entry handed to the driver
+static ESPNowInFlight trackedFrames[ESPNOW_TX_TRACKED];   // Oldest first
+static uint8_t trackedFirst = 0;
+static uint8_t tracked = 0;
+static uint8_t inFlight = 0;            // Tracked frames of the current generation
+static uint32_t txGeneration = 0;       // Moves on at every stall
+static uint32_t lastActivityMs = 0;     // Last submit or completion
+static ESPNowTxStats txStats = {};
+
+// Frames are queued from every task that sends; the driver side runs in the TX task and the Wi-Fi task
+static portMUX_TYPE txQueueMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t espnowTxTaskHandle = nullptr;
+
+// Drop-in replacement for esp_now_send().  Returns ESP_ERR_ESPNOW_NO_MEM if the queue is full.
+esp_err_t queueESPNowSend(const uint8_t *mac, const uint8_t *data, size_t len) {
+  return queueESPNowSendTimed(mac, data, len, nullptr, 0);
+}
+
+// Same, and onSent runs in the Wi-Fi task with this frame's send status and the time it completed
+esp_err_t queueESPNowSendTimed(const uint8_t *mac, const uint8_t *data, size_t len, ESPNowSentCallback onSent, uint32_t cookie) {
+  if (len == 0 || len > WCB_FRAME_BUFFER_SIZE) return ESP_ERR_ESPNOW_ARG;
+  uint32_t traceId = currentTraceId();
+
+  portENTER_CRITICAL(&txQueueMux);
+  uint32_t waiting = txHead - txTail;
+  if (waiting >= ESPNOW_TX_QUEUE_SIZE) {
+    txStats.dropped++;
+    portEXIT_CRITICAL(&txQueueMux);
+    return ESP_ERR_ESPNOW_NO_MEM;
+  }
+  ESPNowTxEntry &entry = txQueue[txHead & (ESPNOW_TX_QUEUE_SIZE - 1)];
+  memcpy(entry.mac, mac, 6);
+  entry.length = len;
+  entry.onSent = onSent;
+  entry.cookie = cookie;
+  entry.traceId = traceId;
+  memcpy(entry.data, data, len);
+  txHead++;
+  txStats.queued++;
+  if (waiting + 1 > txStats.highWatermark) {
+    txStats.highWatermark = waiting + 1;
+  }
+  portEXIT_CRITICAL(&txQueueMux);
+
+  if (espnowTxTaskHandle) {
+    xTaskNotifyGive(espnowTxTaskHandle);
+  }
+  return ESP_OK;
+}
+
+static void dropOldestTracked() {
+  trackedFirst = (trackedFirst + 1) % ESPNOW_TX_TRACKED;
+  tracked--;
+}
+
+// Send status for a frame handed to the driver (Wi-Fi task)
+void espnowTxComplete(const uint8_t *mac, bool success) {
+  int64_t completedAt = esp_timer_get_time();
+  ESPNowSentCallback onSent = nullptr;
+  uint32_t cookie = 0;
+  uint32_t traceId = 0;
+  portENTER_CRITICAL(&txQueueMux);
+  // Completions come in submit order, so a frame given up on that isn't the one completing now never will
+  while (tracked > 0 && trackedFrames[trackedFirst].generation != txGeneration &&
+         memcmp(trackedFrames[trackedFirst].mac, mac, 6) != 0) {
+    dropOldestTracked();
+  }
+  if (tracked > 0) {
+    const ESPNowInFlight &frame = trackedFrames[trackedFirst];
+    if (frame.generation == txGeneration) {
+      onSent = frame.onSent;
+      cookie = frame.cookie;
+      traceId = frame.traceId;
+      inFlight--;
+    } else {
+      // Its sender was already told it failed, and the status must not land on a newer frame
+      txStats.lateCompletions++;
+    }
+    dropOldestTracked();
+  }
+  lastActivityMs = millis();
+  if (!success) txStats.sendFailures++;
+  portEXIT_CRITICAL(&txQueueMux);
+
+  if (onSent) {
+    onSent(cookie, success, completedAt);
+  }
+  traceEventAt(traceId, TRACE_ESPNOW_SENT, success, completedAt);
+
+  if (espnowTxTaskHandle) {
+    xTaskNotifyGive(espnowTxTaskHandle);
+  }
+}
+
+// Hand queued frames to the driver while there is room in flight
+static void submitQueuedFrames() {
+  while (true) {
+    portENTER_CRITICAL(&txQueueMux);
+    if (txHead == txTail || inFlight >= ESPNOW_TX_MAX_IN_FLIGHT) {
+      portEXIT_CRITICAL(&txQueueMux);
+      return;
+    }
+    // Senders only write at txHead, so the entry at txTail stays put until we move past it
+    ESPNowTxEntry &entry = txQueue[txTail & (ESPNOW_TX_QUEUE_SIZE - 1)];
+    // Recorded before the send, its completion can come in before esp_now_send() returns
+    ESPNowInFlight &frame = trackedFrames[(trackedFirst + tracked) % ESPNOW_TX_TRACKED];
+    memcpy(frame.mac, entry.mac, 6);
+    frame.onSent = entry.onSent;
+    frame.cookie = entry.cookie;
+    frame.traceId = entry.traceId;
+    frame.generation = txGeneration;
+    tracked++;
+    inFlight++;
+    portEXIT_CRITICAL(&txQueueMux);
+
+    int64_t submittedAt = esp_timer_get_time();
+    esp_err_t result = esp_now_send(entry.mac, entry.data, entry.length);
+
+    portENTER_CRITICAL(&txQueueMux);
+    if (result == ESP_OK) {
+      uint32_t traceId = entry.traceId;
+      txTail++;
+      txStats.submitted++;
+      lastActivityMs = millis();
+      portEXIT_CRITICAL(&txQueueMux);
+      traceEventAt(traceId, TRACE_ESPNOW_SUBMITTED, 0, submittedAt);
+      continue;
+    }
+    tracked--;
+    inFlight--;
+    if (result == ESP_ERR_ESPNOW_NO_MEM) {
+      // Keep the frame and try again once the driver completes something (or after ESPNOW_TX_RETRY_MS)
+      txStats.noMemRetries++;
+      portEXIT_CRITICAL(&txQueueMux);
+      return;
+    }
+    txTail++;
+    txStats.sendErrors++;
+    portEXIT_CRITICAL(&txQueueMux);
+  }
+}
+
+static void espnowTxTask(void *pvParameters) {
+  uint32_t waitMs = ESPNOW_TX_STALL_MS;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+
+    ESPNowInFlight abandoned[ESPNOW_TX_MAX_IN_FLIGHT];
+    int abandonedCount = 0;
+    portENTER_CRITICAL(&txQueueMux);
+    if (inFlight > 0 && millis() - lastActivityMs >= ESPNOW_TX_STALL_MS) {
+      // A send callback never came; don't let it block the queue forever.  Frames given up on
+      // at an earlier stall had their chance, the ones in flight now stay tracked in case theirs still comes.
+      while (tracked > 0 && trackedFrames[trackedFirst].generation != txGeneration) {
+        dropOldestTracked();
+      }
+      for (int i = 0; i < tracked; i++) {
+        abandoned[abandonedCount++] = trackedFrames[(trackedFirst + i) % ESPNOW_TX_TRACKED];
+      }
+      txStats.lostCompletions += inFlight;
+      inFlight = 0;
+      txGeneration++;
+    }
+    portEXIT_CRITICAL(&txQueueMux);
+
+    // Their senders hear about it as a failed send
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < abandonedCount; i++) {
+      if (abandoned[i].onSent) {
+        abandoned[i].onSent(abandoned[i].cookie, false, now);
+      }
+      traceEventAt(abandoned[i].traceId, TRACE_ESPNOW_SENT, false, now);
+    }
+
+    submitQueuedFrames();
+
+    // Frames left behind are retried soon even if no completion wakes us
+    portENTER_CRITICAL(&txQueueMux);
+    waitMs = (txHead != txTail) ? ESPNOW_TX_RETRY_MS : ESPNOW_TX_STALL_MS;
+    portEXIT_CRITICAL(&txQueueMux);
+  }
+}
+
+void initESPNowTxQueue() {
+  xTaskCreatePinnedToCore(espnowTxTask, "ESP-NOW TX Task", 3072, NULL, 3, &espnowTxTaskHandle, 1);
+}
+
+void printESPNowTxStats() {
+  portENTER_CRITICAL(&txQueueMux);
+  ESPNowTxStats stats = txStats;
+  uint32_t waiting = txHead - txTail;
+  uint8_t flying = inFlight;
+  portEXIT_CRITICAL(&txQueueMux);
+
+  Serial.println("--------------- ESP-NOW Transmit ----------------------");
+  Serial.printf("Queued %lu, submitted %lu, waiting %lu, in flight %u, high watermark %u/%d\n",
+                (unsigned long)stats.queued, (unsigned long)stats.submitted, (unsigned long)waiting, flying,
+                stats.highWatermark, ESPNOW_TX_QUEUE_SIZE);
+  Serial.printf("Queue full drops %lu, driver out of memory retries %lu, send errors %lu, failed sends %lu, lost completions %lu, late completions %lu\n",
+                (unsigned long)stats.dropped, (unsigned long)stats.noMemRetries, (unsigned long)stats.sendErrors,
+                (unsigned long)stats.sendFailures, (unsigned long)stats.lostCompletions, (unsigned long)stats.lateCompletions);
+}
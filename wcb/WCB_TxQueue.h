@@ -0,0 +1,60 @@
+#ifndef WCB_TXQUEUE_H
+#define WCB_TXQUEUE_H
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include "WCB_Frame.h"
+
+// =============== ESP-NOW Transmit Queue ===============
+// Calling esp_now_send() back-to-back (a Stealth gesture fanning out a macro)
+// overruns the driver's internal buffer and frames fail with
+// ESP_ERR_ESPNOW_NO_MEM.  Every frame is instead copied into this FIFO and the
+// ESP-NOW TX task hands them to the driver, never more than
+// ESPNOW_TX_MAX_IN_FLIGHT at a time.  The send callback frees an in-flight
+// place and wakes the task for the next frame, so a burst drains as fast as the
+// radio completes sends.  The FIFO keeps frames to each target in order.  If
+// the driver still runs out of memory, the frame stays at the head of the
+// queue and is retried on the next completion or after ESPNOW_TX_RETRY_MS.
+//
+// queueESPNowSendTimed() also reports the frame's own send status: the send
+// callback of the frame calls onSent with the cookie it was queued with,
+// whether it was delivered and esp_timer_get_time().  Completions arrive in
+// the order frames were handed to the driver, which is how the callback is
+// matched to its frame, so a sender never sees the status of anyone else's
+// frame to the same peer.  Frames queued while loop() runs a traced
+// command record TRACE_ESPNOW_SUBMITTED and TRACE_ESPNOW_SENT the same way.
+//
+// A completion missing for ESPNOW_TX_STALL_MS gives up on every frame in
+// flight: their onSent is called as failed, the tracking generation moves on
+// and the queue carries on.  A completion that still comes in for one of them
+// (recognized by its peer address) is dropped instead of being taken for the
+// status of a frame submitted after the stall.
+
+#define ESPNOW_TX_QUEUE_SIZE        32      // Frames waiting for the driver, must be a power of two
+#define ESPNOW_TX_MAX_IN_FLIGHT     3       // Frames handed to the driver and not yet completed
+#define ESPNOW_TX_STALL_MS          100     // A completion missing for this long is given up on
+#define ESPNOW_TX_RETRY_MS          2       // Retry interval while frames are waiting
+
+typedef struct {
+  uint32_t queued;            // Frames accepted into the queue
+  uint32_t submitted;         // Frames accepted by esp_now_send()
+  uint32_t dropped;           // Frames rejected because the queue was full
+  uint32_t noMemRetries;      // esp_now_send() ran out of memory, frame kept for a retry
+  uint32_t sendErrors;        // Frames dropped for any other esp_now_send() error
+  uint32_t sendFailures;      // Completions that reported a failed send
+  uint32_t lostCompletions;   // In-flight places reclaimed after ESPNOW_TX_STALL_MS
+  uint32_t lateCompletions;   // Completions that came in after their frame was given up on
+  uint16_t highWatermark;     // Most frames ever waiting
+} ESPNowTxStats;
+
+// Send status of one frame (Wi-Fi task)
+typedef void (*ESPNowSentCallback)(uint32_t cookie, bool success, int64_t sentAtUs);
+
+// =============== Function Declarations ===============
+void initESPNowTxQueue();
+esp_err_t queueESPNowSend(const uint8_t *mac, const uint8_t *data, size_t len);
+esp_err_t queueESPNowSendTimed(const uint8_t *mac, const uint8_t *data, size_t len, ESPNowSentCallback onSent, uint32_t cookie);
+void espnowTxComplete(const uint8_t *mac, bool success);
+void printESPNowTxStats();
+
+#endif
@@ -0,0 +1,155 @@
+// Host benchmark of local command dispatch: the keyword table of WCB_Dispatch.h
+// against the startsWith() chain it replaced.  Prints the cost per command in
+// ns and fails if the two resolve a sample command differently.
+
+#include "WCB_Dispatch.h"
+#include <chrono>
+
+typedef void (*LocalCommandHandler)(const char *message, size_t length);
+
+static volatile size_t handled = 0;
+
+static void handle(const char *, size_t length) {
+  handled += length;
+}
+
+// The keywords of localCommands in WCB.ino
+static constexpr CommandEntry<LocalCommandHandler> localCommands[] = {
+    {"don",             MATCH_EXACT,  handle},
+    {"doff",            MATCH_EXACT,  handle},
+    {"d",               MATCH_PREFIX, handle},
+    {"lf",              MATCH_PREFIX, handle},
+    {"cclear",          MATCH_EXACT,  handle},
+    {"cc",              MATCH_PREFIX, handle},
+    {"cs",              MATCH_PREFIX, handle},
+    {"stats",           MATCH_EXACT,  handle},
+    {"reboot",          MATCH_EXACT,  handle},
+    {"config",          MATCH_EXACT,  handle},
+    {"m2",              MATCH_PREFIX, handle},
+    {"m3",              MATCH_PREFIX, handle},
+    {"wcb_erase",       MATCH_EXACT,  handle},
+    {"wcbq",            MATCH_PREFIX, handle},
+    {"wcb",             MATCH_PREFIX, handle},
+    {"elegacy",         MATCH_PREFIX, handle},
+    {"epass",           MATCH_PREFIX, handle},
+    {"ereliable",       MATCH_PREFIX, handle},
+    {"ecoalesce",       MATCH_PREFIX, handle},
+    {"s",               MATCH_PREFIX, handle},
+    {"scoalesce_clear", MATCH_PREFIX, handle},
+    {"scoalesce",       MATCH_PREFIX, handle},
+    {"maestro_enable",  MATCH_PREFIX, handle},
+    {"maestro_disable", MATCH_PREFIX, handle},
+    {"kyber_local",     MATCH_EXACT,  handle},
+    {"kyber_remote",    MATCH_EXACT,  handle},
+    {"kyber_clear",     MATCH_EXACT,  handle},
+    {"kyber_peer",      MATCH_PREFIX, handle},
+    {"tunnel_clear",    MATCH_PREFIX, handle},
+    {"tunnel",          MATCH_PREFIX, handle},
+    {"prio_port",       MATCH_PREFIX, handle},
+    {"prio_prefix",     MATCH_PREFIX, handle},
+    {"prio_clear",      MATCH_EXACT,  handle},
+    {"route_clear",     MATCH_EXACT,  handle},
+    {"route_del",       MATCH_PREFIX, handle},
+    {"route",           MATCH_PREFIX, handle},
+    {"group_del",       MATCH_PREFIX, handle},
+    {"group",           MATCH_PREFIX, handle},
+    {"seq_stop",        MATCH_PREFIX, handle},
+    {"seq_clear",       MATCH_EXACT,  handle},
+    {"time_clear",      MATCH_EXACT,  handle},
+    {"trace",           MATCH_PREFIX, handle},
+    {"trace_dump",      MATCH_EXACT,  handle},
+    {"trace_clear",     MATCH_EXACT,  handle},
+    {"hw",              MATCH_PREFIX, handle},
+};
+
+// The if/else chain processLocalCommand() used to be, in its order.  Returns the keyword it picked.
+static const char *legacyLocalCommand(const String &message) {
+  if (message == "don" || message == "DON") return "don";
+  if (message == "doff" || message == "DOFF") return "doff";
+  if (message.startsWith("lf") || message.startsWith("LF")) return "lf";
+  if (message.equals("cclear") || message.equals("CCLEAR")) return "cclear";
+  if (message.startsWith("cc") || message.startsWith("CC")) return "cc";
+  if (message.startsWith("cs") || message.startsWith("CS")) return "cs";
+  if (message == "stats" || message == "STATS") return "stats";
+  if (message == "reboot" || message == "REBOOT") return "reboot";
+  if (message == "config" || message == "CONFIG") return "config";
+  if (message.startsWith("d") || message.startsWith("D")) return "d";
+  if (message.startsWith("m2") || message.startsWith("M2")) return "m2";
+  if (message.startsWith("m3") || message.startsWith("M3")) return "m3";
+  if (message == "wcb_erase" || message == "WCB_ERASE") return "wcb_erase";
+  if (message.startsWith("wcbq") || message.startsWith("WCBQ")) return "wcbq";
+  if (message.startsWith("wcb") || message.startsWith("WCB")) return "wcb";
+  if (message.startsWith("elegacy") || message.startsWith("ELEGACY")) return "elegacy";
+  if (message.startsWith("epass") || message.startsWith("EPASS")) return "epass";
+  if (message.startsWith("s") || message.startsWith("S")) return "s";
+  if (message.startsWith("maestro_enable") || message.startsWith("MAESTRO_ENABLE")) return "maestro_enable";
+  if (message.startsWith("maestro_disable") || message.startsWith("MAESTRO_DISABLE")) return "maestro_disable";
+  if (message.equals("kyber_local") || message.equals("KYBER_LOCAL")) return "kyber_local";
+  if (message.equals("kyber_remote") || message.equals("KYBER_REMOTE")) return "kyber_remote";
+  if (message.equals("kyber_clear") || message.equals("KYBER_CLEAR")) return "kyber_clear";
+  if (message.startsWith("hw") || message.startsWith("HW")) return "hw";
+  return nullptr;
+}
+
+// Commands the old chain knew, as they arrive after the local function identifier
+static const char *const samples[] = {
+    "don", "cclear", "cs1,:S1:PP100", "config", "wcbq3", "wcb2", "s19600",
+    "epassmy_password", "maestro_enable", "kyber_remote", "hw24", "bogus"
+};
+static const int sampleCount = sizeof(samples) / sizeof(samples[0]);
+
+static bool dispatchTable(const char *message) {
+  int index = matchCommandKeyword(localCommands, message);
+  if (index < 0) return false;
+  localCommands[index].handler(message, strlen(message));
+  return true;
+}
+
+static bool dispatchChain(const char *message) {
+  // The chain was handed the command as a String
+  String command(message);
+  const char *keyword = legacyLocalCommand(command);
+  if (!keyword) return false;
+  handled += command.length();
+  return true;
+}
+
+template <typename Dispatch>
+static double nsPerCommand(Dispatch dispatch, int rounds) {
+  volatile int matched = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < sampleCount; i++) {
+      matched += dispatch(samples[i]);
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / ((double)rounds * sampleCount);
+}
+
+int main() {
+  int failures = 0;
+  for (int i = 0; i < sampleCount; i++) {
+    int index = matchCommandKeyword(localCommands, samples[i]);
+    const char *table = (index < 0) ? nullptr : localCommands[index].keyword;
+    const char *chain = legacyLocalCommand(String(samples[i]));
+    if ((table == nullptr) != (chain == nullptr) || (table && strcmp(table, chain) != 0)) {
+      printf("FAIL \"%s\": table picks %s, chain picks %s\n", samples[i], table ? table : "nothing", chain ? chain : "nothing");
+      failures++;
+    }
+  }
+
+  const int rounds = 200000;
+  nsPerCommand(dispatchTable, rounds / 10);    // Warm up
+  double table = nsPerCommand(dispatchTable, rounds);
+  double chain = nsPerCommand(dispatchChain, rounds);
+  printf("Local command dispatch over %d commands:\n", rounds * sampleCount);
+  printf("  keyword table:    %.1f ns per command\n", table);
+  printf("  startsWith chain: %.1f ns per command\n", chain);
+
+  if (failures) {
+    printf("%d samples resolved differently\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,102 @@
+// Just enough of the ESP32 Arduino core to build the hardware-free parts of
+// the sketch on a PC.  Anything that would touch hardware does nothing.
+#ifndef WCB_TEST_ARDUINO_H
+#define WCB_TEST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+
+#define IRAM_ATTR
+#define HIGH 1
+#define LOW 0
+#define INPUT_PULLUP 0x05
+#define OUTPUT 0x03
+#define CHANGE 0x03
+
+using std::min;
+using std::max;
+
+inline void delay(uint32_t) {}
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline void attachInterruptArg(int, void (*)(void *), void *, int) {}
+inline void detachInterrupt(int) {}
+
+typedef union {
+  struct {
+    uint32_t duration0 : 15;
+    uint32_t level0 : 1;
+    uint32_t duration1 : 15;
+    uint32_t level1 : 1;
+  };
+  uint32_t val;
+} rmt_data_t;
+
+typedef enum { RMT_RX_MODE, RMT_TX_MODE } rmt_ch_dir_t;
+typedef enum { RMT_MEM_NUM_BLOCKS_1 = 1 } rmt_reserve_memsize_t;
+inline bool rmtInit(int, rmt_ch_dir_t, rmt_reserve_memsize_t, uint32_t) { return false; }
+inline bool rmtDeinit(int) { return true; }
+inline bool rmtSetEOT(int, uint8_t) { return true; }
+inline bool rmtWriteAsync(int, rmt_data_t *, size_t) { return false; }
+inline bool rmtTransmitCompleted(int) { return true; }
+
+// The few String calls the benchmarks need.  std::string keeps short strings
+// off the heap much like the ESP32 core's String does.
+class String {
+public:
+  String(const char *text = "") : value(text) {}
+  size_t length() const { return value.size(); }
+  const char *c_str() const { return value.c_str(); }
+  bool equals(const char *other) const { return value == other; }
+  bool operator==(const char *other) const { return equals(other); }
+  bool startsWith(const char *prefix) const { return value.compare(0, strlen(prefix), prefix) == 0; }
+
+private:
+  std::string value;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+  size_t printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n < 0 ? 0 : n;
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HostSerial : public Stream {
+public:
+  size_t write(uint8_t byte) override { return fputc(byte, stdout) == EOF ? 0 : 1; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+};
+
+inline HostSerial Serial;
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef WCB_TEST_GPIO_LL_H
+#define WCB_TEST_GPIO_LL_H
+
+#include <stdint.h>
+#include <soc/gpio_struct.h>
+
+inline int gpio_ll_get_level(gpio_dev_t *hw, uint32_t gpio_num) {
+  return (hw->in >> gpio_num) & 1;
+}
+
+#endif
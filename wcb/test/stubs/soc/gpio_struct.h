@@ -0,0 +1,10 @@
+#ifndef WCB_TEST_GPIO_STRUCT_H
+#define WCB_TEST_GPIO_STRUCT_H
+
+typedef struct {
+  uint32_t in;
+} gpio_dev_t;
+
+inline gpio_dev_t GPIO;
+
+#endif
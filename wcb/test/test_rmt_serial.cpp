@@ -0,0 +1,260 @@
+// Host test of the RmtSerial line code: the edge decoder is fed simulated
+// waveforms, and the RMT symbols of the encoder are checked and decoded back.
+
+#include "WCB_RmtSerial.h"
+#include <stdlib.h>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                                   \
+  do {                                                          \
+    if (!(condition)) {                                         \
+      printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #condition); \
+      printf(__VA_ARGS__);                                      \
+      printf("\n");                                             \
+      failures++;                                               \
+    }                                                           \
+  } while (0)
+
+typedef struct {
+  double time;              // us
+  uint8_t level;
+} LineEdge;
+
+// Edges of 8N1 bytes starting at start.  gapBits of idle line after each byte, 0 = back to back.
+// stopLevel 0 sends a broken stop bit.
+static void addBytes(std::vector<LineEdge> &edges, double &time, uint8_t &level, uint32_t baud,
+                     const std::vector<uint8_t> &bytes, double gapBits, uint8_t stopLevel = 1) {
+  double bitUs = 1e6 / baud;
+  for (uint8_t byte : bytes) {
+    uint16_t frame = (byte << 1) | (stopLevel << 9);
+    for (int i = 0; i < 10; i++, time += bitUs) {
+      uint8_t bit = (frame >> i) & 1;
+      if (bit != level) {
+        edges.push_back({time, bit});
+        level = bit;
+      }
+    }
+    if (stopLevel == 0) {
+      // The line has to go back to idle before anything else can start
+      edges.push_back({time, 1});
+      level = 1;
+    }
+    time += gapBits * bitUs;
+  }
+}
+
+// Runs the edges through a decoder the way RmtSerial does: whole microsecond timestamps with up to
+// jitterUs of interrupt latency, then idle() long after the last edge.
+static std::vector<uint8_t> decode(RmtSerialDecoder &decoder, const std::vector<LineEdge> &edges, double endTime,
+                                   uint32_t start, int jitterUs) {
+  std::vector<uint8_t> out;
+  uint8_t byte;
+  for (const LineEdge &edge : edges) {
+    uint32_t time = start + (uint32_t)edge.time + (jitterUs ? rand() % (jitterUs + 1) : 0);
+    if (decoder.edge(time, edge.level, &byte)) out.push_back(byte);
+  }
+  if (decoder.idle(start + (uint32_t)endTime + 1000, &byte)) out.push_back(byte);
+  return out;
+}
+
+static std::vector<uint8_t> testBytes() {
+  std::vector<uint8_t> bytes = {0x00, 0xFF, 0x55, 0xAA, 0x01, 0x80, 0x0F, 0xF0};
+  const char *command = ":OP01\r";
+  bytes.insert(bytes.end(), command, command + strlen(command));
+  for (int i = 0; i < 64; i++) bytes.push_back(rand());
+  return bytes;
+}
+
+static void testDecodeBackToBack(uint32_t baud) {
+  std::vector<uint8_t> bytes = testBytes();
+  std::vector<LineEdge> edges;
+  double time = 10;
+  uint8_t level = 1;
+  addBytes(edges, time, level, baud, bytes, 0);
+
+  RmtSerialDecoder decoder;
+  decoder.begin(baud);
+  // Start close to the 32 bit wrap of the timestamps
+  int jitter = baud >= 115200 ? 1 : 3;
+  std::vector<uint8_t> out = decode(decoder, edges, time, 0xFFFFFFFF - 2000, jitter);
+  CHECK(out == bytes, "%lu baud back to back: %zu of %zu bytes", (unsigned long)baud, out.size(), bytes.size());
+  CHECK(decoder.framingErrors == 0, "%lu baud back to back: %lu framing errors", (unsigned long)baud,
+        (unsigned long)decoder.framingErrors);
+}
+
+static void testDecodeWithGaps(uint32_t baud) {
+  std::vector<uint8_t> bytes = testBytes();
+  std::vector<LineEdge> edges;
+  double time = 10;
+  uint8_t level = 1;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    addBytes(edges, time, level, baud, {bytes[i]}, (i % 5) * 0.7 + 0.3);
+  }
+
+  RmtSerialDecoder decoder;
+  decoder.begin(baud);
+  std::vector<uint8_t> out = decode(decoder, edges, time, 1000, 1);
+  CHECK(out == bytes, "%lu baud with gaps: %zu of %zu bytes", (unsigned long)baud, out.size(), bytes.size());
+}
+
+// A byte whose stop bit is low is counted and dropped; the bytes around it still come through
+static void testFramingError(uint32_t baud) {
+  std::vector<LineEdge> edges;
+  double time = 10;
+  uint8_t level = 1;
+  addBytes(edges, time, level, baud, {'A'}, 0);
+  addBytes(edges, time, level, baud, {0x3C}, 2, 0);
+  addBytes(edges, time, level, baud, {'B', 'C'}, 0);
+
+  RmtSerialDecoder decoder;
+  decoder.begin(baud);
+  std::vector<uint8_t> out = decode(decoder, edges, time, 5000, 0);
+  std::vector<uint8_t> expected = {'A', 'B', 'C'};
+  CHECK(out == expected, "%lu baud framing error: got %zu bytes", (unsigned long)baud, out.size());
+  CHECK(decoder.framingErrors == 1, "%lu baud framing error: %lu framing errors", (unsigned long)baud,
+        (unsigned long)decoder.framingErrors);
+}
+
+// A short low glitch on an idle line is not taken for a start bit
+static void testGlitch(uint32_t baud) {
+  double bitUs = 1e6 / baud;
+  std::vector<LineEdge> edges = {{10, 0}, {10 + bitUs / 4, 1}};
+  double time = 10 + 3 * bitUs;
+  uint8_t level = 1;
+  addBytes(edges, time, level, baud, {'Z'}, 0);
+
+  RmtSerialDecoder decoder;
+  decoder.begin(baud);
+  std::vector<uint8_t> out = decode(decoder, edges, time, 100, 0);
+  CHECK(out.size() == 1 && out[0] == 'Z', "%lu baud glitch: got %zu bytes", (unsigned long)baud, out.size());
+  CHECK(decoder.framingErrors == 0, "%lu baud glitch: %lu framing errors", (unsigned long)baud,
+        (unsigned long)decoder.framingErrors);
+}
+
+// The edges the RMT puts on an idle high line for these symbols
+static std::vector<LineEdge> symbolsToEdges(const rmt_data_t *symbols, size_t count, double &endTime) {
+  std::vector<LineEdge> edges;
+  uint8_t level = 1;
+  uint64_t ticks = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint8_t levels[2] = {(uint8_t)symbols[i].level0, (uint8_t)symbols[i].level1};
+    uint32_t durations[2] = {symbols[i].duration0, symbols[i].duration1};
+    for (int half = 0; half < 2; half++) {
+      if (levels[half] != level) {
+        edges.push_back({(double)ticks * 1e6 / RMT_SERIAL_TICK_HZ, levels[half]});
+        level = levels[half];
+      }
+      ticks += durations[half];
+    }
+  }
+  endTime = (double)ticks * 1e6 / RMT_SERIAL_TICK_HZ;
+  return edges;
+}
+
+static void testEncode(uint32_t baud) {
+  std::vector<uint8_t> bytes = testBytes();
+  bytes.insert(bytes.end(), 200, 0x55);     // The most edges a byte can have, so it takes several chunks
+  rmt_data_t symbols[RMT_SERIAL_TX_SYMBOLS];
+  RmtSerialDecoder decoder;
+  decoder.begin(baud);
+  std::vector<uint8_t> out;
+  uint32_t start = 100;
+
+  size_t offset = 0;
+  int chunks = 0;
+  while (offset < bytes.size()) {
+    memset(symbols, 0xAA, sizeof(symbols));
+    size_t symbolCount = 0;
+    size_t taken = encodeRmtSerial(baud, bytes.data() + offset, bytes.size() - offset, symbols,
+                                   RMT_SERIAL_TX_SYMBOLS, symbolCount);
+    CHECK(taken > 0, "%lu baud: empty chunk", (unsigned long)baud);
+    CHECK(symbolCount > 0 && symbolCount <= RMT_SERIAL_TX_SYMBOLS, "%lu baud: %zu symbols", (unsigned long)baud,
+          symbolCount);
+    if (taken == 0) return;
+
+    // The chunk starts with the start bit and ends idle high, with no zero length half that would end it early
+    uint64_t ticks = 0;
+    for (size_t i = 0; i < symbolCount; i++) {
+      CHECK(symbols[i].duration0 > 0 && symbols[i].duration1 > 0, "%lu baud: empty half in symbol %zu",
+            (unsigned long)baud, i);
+      ticks += symbols[i].duration0 + symbols[i].duration1;
+    }
+    CHECK(symbols[0].level0 == 0, "%lu baud: chunk doesn't start with a start bit", (unsigned long)baud);
+    CHECK(symbols[symbolCount - 1].level1 == 1, "%lu baud: chunk doesn't end high", (unsigned long)baud);
+
+    // Rounding is against the start of the chunk, so its length is within a tick of 10 bits per byte
+    double expectedTicks = (double)taken * 10 * RMT_SERIAL_TICK_HZ / baud;
+    CHECK(ticks + 1.0 >= expectedTicks && ticks <= expectedTicks + 2.0, "%lu baud: chunk is %llu ticks, not %.1f",
+          (unsigned long)baud, (unsigned long long)ticks, expectedTicks);
+
+    double endTime;
+    std::vector<LineEdge> edges = symbolsToEdges(symbols, symbolCount, endTime);
+    std::vector<uint8_t> chunk = decode(decoder, edges, endTime, start, 0);
+    out.insert(out.end(), chunk.begin(), chunk.end());
+    start += (uint32_t)endTime + 1000;
+    offset += taken;
+    chunks++;
+  }
+  CHECK(out == bytes, "%lu baud encode and decode: %zu of %zu bytes", (unsigned long)baud, out.size(), bytes.size());
+  CHECK(decoder.framingErrors == 0, "%lu baud encode: %lu framing errors", (unsigned long)baud,
+        (unsigned long)decoder.framingErrors);
+  CHECK(chunks > 1, "%lu baud: %zu bytes fit in one chunk", (unsigned long)baud, bytes.size());
+}
+
+// 0x55 is a run per bit: start, then 1 0 1 0 1 0 1 0, stop
+static void testEncodeSymbols(uint32_t baud) {
+  rmt_data_t symbols[RMT_SERIAL_TX_SYMBOLS];
+  uint8_t byte = 0x55;
+  size_t symbolCount = 0;
+  size_t taken = encodeRmtSerial(baud, &byte, 1, symbols, RMT_SERIAL_TX_SYMBOLS, symbolCount);
+  CHECK(taken == 1 && symbolCount == 5, "%lu baud 0x55: %zu bytes in %zu symbols", (unsigned long)baud, taken,
+        symbolCount);
+  uint32_t bitTicks = RMT_SERIAL_TICK_HZ / baud;
+  for (size_t i = 0; i < symbolCount && i < 5; i++) {
+    CHECK(symbols[i].level0 == 0 && symbols[i].level1 == 1, "%lu baud 0x55: levels of symbol %zu",
+          (unsigned long)baud, i);
+    CHECK(symbols[i].duration0 >= bitTicks && symbols[i].duration0 <= bitTicks + 1 &&
+          symbols[i].duration1 >= bitTicks && symbols[i].duration1 <= bitTicks + 1,
+          "%lu baud 0x55: symbol %zu is %u/%u ticks", (unsigned long)baud, i, (unsigned)symbols[i].duration0,
+          (unsigned)symbols[i].duration1);
+  }
+}
+
+// At 300 baud the 9 low bits of 0x00 are longer than one half symbol can count
+static void testEncodeLongRun() {
+  rmt_data_t symbols[RMT_SERIAL_TX_SYMBOLS];
+  uint8_t byte = 0x00;
+  size_t symbolCount = 0;
+  encodeRmtSerial(300, &byte, 1, symbols, RMT_SERIAL_TX_SYMBOLS, symbolCount);
+  double endTime;
+  std::vector<LineEdge> edges = symbolsToEdges(symbols, symbolCount, endTime);
+  CHECK(symbolCount > 1 && edges.size() == 2, "300 baud 0x00: %zu symbols, %zu edges", symbolCount, edges.size());
+
+  RmtSerialDecoder decoder;
+  decoder.begin(300);
+  std::vector<uint8_t> out = decode(decoder, edges, endTime, 0, 0);
+  CHECK(out.size() == 1 && out[0] == 0x00, "300 baud 0x00: got %zu bytes", out.size());
+}
+
+int main() {
+  srand(1);
+  const uint32_t bauds[] = {9600, 57600, 115200};
+  for (uint32_t baud : bauds) {
+    testDecodeBackToBack(baud);
+    testDecodeWithGaps(baud);
+    testFramingError(baud);
+    testGlitch(baud);
+    testEncode(baud);
+    testEncodeSymbols(baud);
+  }
+  testEncodeLongRun();
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All RmtSerial checks passed\n");
+  return 0;
+}